@@ -7,13 +7,21 @@
 
 #include "KlipperAPI.h"
 
+#if defined(ESP32)
+#include <WiFi.h>
+#elif defined(ESP8266)
+#include <ESP8266WiFi.h>
+#endif
+
 // Default constructor
 KlipperApi::KlipperApi() {
   _client = nullptr;
   _usingIpAddress = false;
-  _moonrakerHost = nullptr;
+  _moonrakerHost[0] = '\0';
   _moonrakerPort = 80;
   _hasApiKey = false;
+  _hostHeader[0] = '\0';
+  _apiKeyHeader[0] = '\0';
   httpStatusCode = 0;
 }
 
@@ -33,26 +41,40 @@ void KlipperApi::init(Client &client, IPAddress moonrakerIp, uint16_t moonrakerP
   _moonrakerIp = moonrakerIp;
   _moonrakerPort = moonrakerPort;
   _usingIpAddress = true;
-  _hasApiKey = (apiKey != nullptr && strlen(apiKey) > 0);
-  if (_hasApiKey) {
-    _apiKey = String(apiKey);
-  }
+  snprintf(_hostHeader, sizeof(_hostHeader), "Host: %u.%u.%u.%u:%u\r\n",
+           moonrakerIp[0], moonrakerIp[1], moonrakerIp[2], moonrakerIp[3], moonrakerPort);
+  setApiKey(apiKey);
   httpStatusCode = 0;
 }
 
 // Initialize with hostname
 void KlipperApi::init(Client &client, const char *moonrakerHost, uint16_t moonrakerPort, const char* apiKey) {
   _client = &client;
-  _moonrakerHost = (char*)moonrakerHost;
   _moonrakerPort = moonrakerPort;
   _usingIpAddress = false;
+  _hostResolved = false;
+  if (strlen(moonrakerHost) >= sizeof(_moonrakerHost) && _debug) {
+    Serial.println("KlipperAPI: Hostname too long for KAPI_HOST_NAME_SIZE");
+  }
+  copyField(_moonrakerHost, sizeof(_moonrakerHost), moonrakerHost);
+  snprintf(_hostHeader, sizeof(_hostHeader), "Host: %s:%u\r\n", moonrakerHost, moonrakerPort);
+  setApiKey(apiKey);
+  httpStatusCode = 0;
+}
+
+// Precompute the API key header sent with every request
+void KlipperApi::setApiKey(const char* apiKey) {
   _hasApiKey = (apiKey != nullptr && strlen(apiKey) > 0);
+  _apiKeyHeader[0] = '\0';
   if (_hasApiKey) {
-    _apiKey = String(apiKey);
+    int length = snprintf(_apiKeyHeader, sizeof(_apiKeyHeader), "X-Api-Key: %s\r\n", apiKey);
+    if (length >= (int)sizeof(_apiKeyHeader) && _debug) {
+      Serial.println("KlipperAPI: API key too long for KAPI_APIKEY_HEADER_SIZE");
+    }
   }
-  httpStatusCode = 0;
 }
 
+#if KAPI_ENABLE_STRING_API
 // Send GET request to Moonraker
 String KlipperApi::sendGetToMoonraker(const char* endpoint) {
   return sendRequestToMoonraker("GET", endpoint);
@@ -67,195 +89,771 @@ String KlipperApi::sendPostToMoonraker(const char* endpoint, const char* postDat
 String KlipperApi::getMoonrakerEndpointResults(const char* endpoint) {
   return sendGetToMoonraker(endpoint);
 }
+#endif
+
+// Enable or disable persistent connections
+void KlipperApi::setKeepAlive(bool enable) {
+  _keepAlive = enable;
+  if (!enable) {
+    closeClient();
+  }
+}
 
+#if KAPI_ENABLE_STRING_API
 // Main request method
 String KlipperApi::sendRequestToMoonraker(const char* method, const char* endpoint, const char* data) {
+  String response = "";
+  
+  if (!beginRequest(method, endpoint, data)) {
+    return response;
+  }
+  
+  // Callers of the String API get at most maxMessageLength bytes; the rest
+  // of the body is drained so a kept-alive connection stays usable.
+  int c;
+  while ((c = _body.read()) >= 0) {
+    if (response.length() < maxMessageLength) {
+      response += (char)c;
+    }
+  }
+  
+  endRequest();
+  
+  if (_debug) {
+    Serial.println("KlipperAPI Response:");
+    Serial.println("Status Code: " + String(httpStatusCode));
+    Serial.println("Response: " + response);
+  }
+  
+  return response;
+}
+#endif
+
+// POST a command and discard the response body. Commands are sent even
+// while the printer looks unreachable.
+bool KlipperApi::postToMoonraker(const char* endpoint, const char* data) {
+  if (!beginRequest("POST", endpoint, data, nullptr, true)) {
+    return false;
+  }
+  endRequest();
+  return (httpStatusCode == 200);
+}
+
+// Send a request and read the response headers. On success the body is
+// left on the connection for the caller to consume through _body. While
+// the printer is unreachable the request fails at once unless forced.
+bool KlipperApi::beginRequest(const char* method, const char* endpoint, const char* data,
+                              KlipperBodySource* source, bool force) {
+#if KAPI_ENABLE_FILES
+  // An open listing still owns the connection
+  if (_listing) {
+    if (_debug) Serial.println("KlipperAPI: Abandoning file listing");
+    abortFileList();
+  }
+#endif
+#if KAPI_ENABLE_ASYNC
+#if KAPI_ENABLE_GCODE_QUEUE
+  // A G-code batch may already be running on the printer; finish it, as
+  // flushGcode() does, so its commands are neither lost nor reported failed
+  while (_asyncRequest == KAPI_REQUEST_GCODE_BATCH && isBusy()) {
+    poll();
+    delay(1);
+  }
+#endif
+  // Both paths share the connection, a blocking call takes precedence
+  if (isBusy()) {
+    if (_debug) Serial.println("KlipperAPI: Cancelling non-blocking request");
+    cancelRequest();
+  }
+#endif
+  
+  httpStatusCode = 0;
+  
   if (_client == nullptr) {
     if (_debug) Serial.println("KlipperAPI: Client not initialized");
-    return "";
+    return false;
+  }
+  if (!requestAllowed(force)) {
+    return false;
   }
-
-  String response = "";
   
-  // Connect to server
-  bool connected = false;
-  if (_usingIpAddress) {
-    connected = _client->connect(_moonrakerIp, _moonrakerPort);
+  KAPI_METRICS(metrics.beginRequest(endpoint));
+  
+  // Reuse the open connection in keep-alive mode, otherwise connect fresh.
+  // connected() turns false once the server has closed its side.
+  bool reused = false;
+  if (_keepAlive && _client->connected()) {
+    reused = true;
   } else {
-    connected = _client->connect(_moonrakerHost, _moonrakerPort);
+    closeClient();
+    if (!openConnection()) {
+      noteFailure();
+      return false;
+    }
+  }
+
+  if (_debug) {
+    Serial.print("KlipperAPI Request: ");
+    Serial.print(method);
+    Serial.print(' ');
+    Serial.println(endpoint);
+    if (data != nullptr) Serial.println(data);
   }
   
-  if (!connected) {
-    if (_debug) Serial.println("KlipperAPI: Connection failed");
-    return "";
+  // Send request and wait for the first response byte, which may take as
+  // long as Moonraker needs to answer. A kept-alive socket may have been
+  // closed by the server while idle, which may also fail the write; in that
+  // case reconnect once and resend on a fresh connection.
+  unsigned long phaseStart = millis();
+  while (true) {
+    KAPI_METRICS(metrics.startPhase(KAPI_PHASE_FIRST_BYTE));
+    bool written = writeRequest(method, endpoint, data, source);
+    if (!written) {
+      if (_debug) Serial.println("KlipperAPI: Request write failed");
+      if (!reused) {
+        // A fresh connection that does not take the request counts as down
+        KAPI_METRICS(metrics.markError(); metrics.finishRequest());
+        closeClient();
+        noteFailure();
+        return false;
+      }
+    }
+    
+    while (written && !_client->available() && _client->connected() && millis() - phaseStart < KAPI_TIMEOUT) {
+      delay(1);
+    }
+    
+    if (written && (!reused || _client->available() || _client->connected())) {
+      break;
+    }
+    
+    if (_debug) Serial.println("KlipperAPI: Kept-alive connection closed by server, reconnecting");
+    closeClient();
+    reused = false;
+    reconnectCount++;
+    if (!openConnection()) {
+      noteFailure();
+      return false;
+    }
+    phaseStart = millis();
   }
-
-  // Build HTTP request
-  String request = String(method) + " " + String(endpoint) + " HTTP/1.1\r\n";
   
-  if (_usingIpAddress) {
-    request += "Host: " + _moonrakerIp.toString() + ":" + String(_moonrakerPort) + "\r\n";
-  } else {
-    request += "Host: " + String(_moonrakerHost) + ":" + String(_moonrakerPort) + "\r\n";
+  if (reused) {
+    connectionReuseCount++;
   }
+#if KAPI_ENABLE_METRICS
+  if (_client->available()) metrics.endPhase(KAPI_PHASE_FIRST_BYTE);
+#endif
   
-  request += "User-Agent: " + String(USER_AGENT) + "\r\n";
-  request += "Connection: close\r\n";
+  // Once the response has started, the rest of the head must follow within
+  // KAPI_HEADER_TIMEOUT. Lines go through the fixed buffer of _head.
+  _head.reset();
+  bool headComplete = false;
+  phaseStart = millis();
+  
+  while (millis() - phaseStart < KAPI_HEADER_TIMEOUT) {
+    int c = _client->read();
+    if (c < 0) {
+      if (!_client->connected()) break;
+      delay(1);
+      continue;
+    }
+    
+    if (_head.feed((char)c)) {
+      headComplete = true;
+      break;
+    }
+  }
+  
+  httpStatusCode = _head.statusCode;
+  _serverClose = _head.connectionClose;
+  
+  if (!headComplete) {
+    if (_debug) Serial.println("KlipperAPI: Incomplete response headers");
+#if KAPI_ENABLE_METRICS
+    // Still connected means the server did not answer in time
+    if (_client->connected()) metrics.markTimeout();
+    metrics.markError();
+    metrics.finishRequest();
+#endif
+    closeClient();
+    noteFailure();
+    return false;
+  }
+  
+  noteSuccess();
+  KAPI_METRICS(metrics.startPhase(KAPI_PHASE_BODY));
+  
+  // A Content-Length or chunked body has a known end, which is what allows
+  // the connection to be reused; otherwise the body runs until the server
+  // closes the socket. Gaps between body bytes are bounded by KAPI_BODY_TIMEOUT.
+  _body.begin(_client, _head, KAPI_BODY_TIMEOUT);
+  return true;
+}
+
+// Write request line, headers and body without building a String.
+// Host and API key headers were formatted once in init(). The body is
+// either data or produced by source while it is written.
+bool KlipperApi::writeRequest(const char* method, const char* endpoint, const char* data, KlipperBodySource* source) {
+  uint32_t dataLength = 0;
+  if (source != nullptr) {
+    dataLength = source->length();
+  } else if (data != nullptr) {
+    dataLength = strlen(data);
+  }
+  KlipperRequestWriter out(_client);
+  
+  out.print(method);
+  out.print(' ');
+  out.print(endpoint);
+  out.print(" HTTP/1.1\r\n");
+  out.print(_hostHeader);
+  out.print("User-Agent: " USER_AGENT "\r\n");
+  out.print(_keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
   
   // Add API key if available
   if (_hasApiKey) {
-    request += "X-Api-Key: " + _apiKey + "\r\n";
+    out.print(_apiKeyHeader);
   }
   
   // Add content for POST requests
-  if (data != nullptr && strlen(data) > 0) {
-    request += "Content-Type: application/json\r\n";
-    request += "Content-Length: " + String(strlen(data)) + "\r\n";
+  if (dataLength > 0) {
+    out.print("Content-Type: ");
+    out.print(source != nullptr ? source->contentType() : "application/json");
+    out.print("\r\nContent-Length: ");
+    out.print(dataLength);
+    out.print("\r\n");
   }
   
-  request += "\r\n";
+  out.print("\r\n");
   
   // Add POST data
-  if (data != nullptr && strlen(data) > 0) {
-    request += String(data);
+  if (source != nullptr) {
+    source->writeTo(out);
+  } else if (dataLength > 0) {
+    out.write(data, dataLength);
   }
   
-  if (_debug) {
-    Serial.println("KlipperAPI Request:");
-    Serial.println(request);
+  bool ok = out.finish();
+  KAPI_METRICS(metrics.addBytes(out.bytesWritten(), 0));
+  requestCount++;
+  if (out.allocated()) {
+    requestHeapAllocs++;
   }
+  return ok;
+}
+
+// Finish the current response and keep or close the connection
+void KlipperApi::endRequest() {
+  // Keep the socket only when the response was framed and fully consumed
+  bool bodyComplete = _body.drain();
+  _body.end();
   
-  // Send request
-  _client->print(request);
+#if KAPI_ENABLE_METRICS
+  metrics.endPhase(KAPI_PHASE_BODY);
+  metrics.addBytes(0, _head.bytesRead() + _body.bytesRead());
+  if (httpStatusCode != 200) metrics.markError();
+  metrics.finishRequest();
+#endif
   
-  // Wait for response
-  unsigned long timeout = millis() + KAPI_TIMEOUT;
-  while (!_client->available() && millis() < timeout) {
-    delay(10);
+  if (!_keepAlive || _serverClose || !bodyComplete) {
+    closeClient();
+  }
+}
+
+// GET an endpoint and parse the JSON body straight off the connection.
+// Only the fields selected by the filter are kept in the document.
+bool KlipperApi::getJsonFromMoonraker(const char* endpoint, JsonDocument& doc, JsonDocument& filter) {
+  if (!beginRequest("GET", endpoint)) {
+    return false;
   }
   
-  // Read response
-  bool headerComplete = false;
-  String headers = "";
+  if (httpStatusCode != 200) {
+    endRequest();
+    return false;
+  }
   
-  while (_client->available() && millis() < timeout) {
-    String line = _client->readStringUntil('\n');
-    
-    if (!headerComplete) {
-      headers += line + "\n";
-      if (line.length() <= 1) { // Empty line indicates end of headers
-        headerComplete = true;
-      }
-    } else {
-      response += line;
-      if (response.length() > maxMessageLength) {
-        break; // Prevent memory overflow
-      }
+  bool ok = parseBody(doc, filter);
+  endRequest();
+  if (!ok && jsonPool.outgrown()) {
+    // The pool grew for this response; a GET is safe to repeat
+    return getJsonFromMoonraker(endpoint, jsonPool.acquire(), filter);
+  }
+  return ok;
+}
+
+// Parse the current response body into doc
+bool KlipperApi::parseBody(JsonDocument& doc, JsonDocument& filter) {
+  KAPI_METRICS(metrics.startPhase(KAPI_PHASE_PARSE));
+  DeserializationError error = deserializeJson(doc, _body, DeserializationOption::Filter(filter));
+  KAPI_METRICS(metrics.endPhase(KAPI_PHASE_PARSE));
+  jsonPool.release();
+  
+  if (error) {
+    KAPI_METRICS(metrics.markError());
+    if (_debug) {
+      Serial.print("KlipperAPI: JSON parse failed: ");
+      Serial.println(error.c_str());
     }
+    return false;
   }
   
-  // Extract HTTP status code
-  httpStatusCode = extractHttpCode(headers, response);
+  return true;
+}
+
+// Run one of the built-in queries and store its result
+bool KlipperApi::runQuery(uint8_t request) {
+  if (cacheFresh(request)) {
+    return true;
+  }
   
-  if (_debug) {
-    Serial.println("KlipperAPI Response:");
-    Serial.println("Status Code: " + String(httpStatusCode));
-    Serial.println("Response: " + response);
+  char query[KAPI_QUERY_SIZE];
+  const char* endpoint = queryEndpoint(request, query, sizeof(query));
+  if (endpoint == nullptr) {
+    return false;
   }
   
-  closeClient();
-  return response;
+  StaticJsonDocument<KAPI_FILTER_SIZE> filter;
+  addQueryFilter(request, filter.to<JsonObject>());
+  
+  JsonDocument& doc = jsonPool.acquire();
+  if (!getJsonFromMoonraker(endpoint, doc, filter)) {
+    return false;
+  }
+  
+  return applyQueryResult(request, doc["result"]);
 }
 
-// Extract HTTP status code from response
-int KlipperApi::extractHttpCode(const String& statusCode, const String& body) {
-  if (statusCode.length() > 12) {
-    int firstSpace = statusCode.indexOf(' ');
-    int secondSpace = statusCode.indexOf(' ', firstSpace + 1);
-    
-    if (firstSpace != -1 && secondSpace != -1) {
-      String code = statusCode.substring(firstSpace + 1, secondSpace);
-      return code.toInt();
-    }
+// Endpoint of a built-in query; object queries are built into buffer
+const char* KlipperApi::queryEndpoint(uint8_t request, char* buffer, size_t size) {
+  uint8_t mask = queryRefreshMask(request);
+  if (mask != 0) {
+    return buildObjectQuery(mask, buffer, size) ? buffer : nullptr;
   }
-  return 0;
+  
+  switch (request) {
+    case KAPI_REQUEST_PRINTER_INFO:
+      return "/printer/info";
+    case KAPI_REQUEST_SERVER_INFO:
+      return "/server/info";
+#if KAPI_ENABLE_MOTION
+    case KAPI_REQUEST_MOTION_LIMITS:
+      // Configured limits plus the current ones, which SET_VELOCITY_LIMIT changes
+      return "/printer/objects/query?configfile=settings"
+             "&toolhead=max_velocity,max_accel,square_corner_velocity,axis_minimum,axis_maximum";
+#endif
+  }
+  return nullptr;
 }
 
-// Close client connection
-void KlipperApi::closeClient() {
-  if (_client != nullptr && _client->connected()) {
-    _client->stop();
+// Printer object data behind a query, 0 for the non object endpoints
+uint8_t KlipperApi::queryRefreshMask(uint8_t request) {
+  switch (request) {
+    case KAPI_REQUEST_PRINTER_STATISTICS:
+      return KAPI_REFRESH_STATISTICS;
+    case KAPI_REQUEST_PRINT_JOB:
+      return KAPI_REFRESH_JOB;
+    case KAPI_REQUEST_REFRESH:
+      return _refreshMask;
   }
+  return 0;
 }
 
-// Get printer information
-bool KlipperApi::getPrinterInfo() {
-  String response = sendGetToMoonraker("/printer/info");
+// Printer object attributes requested for each KAPI_REFRESH_* flag.
+// Entries for the same object are adjacent so their lists can be joined.
+typedef struct {
+  uint8_t mask;
+  const char* object;
+  const char* attributes;
+} RefreshField;
+
+static const RefreshField refreshFields[] = {
+  { KAPI_REFRESH_TEMPERATURES, "extruder", "temperature,target,power" },
+  { KAPI_REFRESH_TEMPERATURES, "heater_bed", "temperature,target,power" },
+  { KAPI_REFRESH_POSITION, "toolhead", "position,homed_axes" },
+#if KAPI_ENABLE_MOTION
+  { KAPI_REFRESH_MOTION, "toolhead", "max_velocity,max_accel,square_corner_velocity,axis_minimum,axis_maximum" },
+#endif
+  { KAPI_REFRESH_STATE | KAPI_REFRESH_JOB, "print_stats", "state" },
+#if KAPI_ENABLE_PRINT_JOB
+  { KAPI_REFRESH_JOB, "print_stats", "filename,print_duration,total_duration" },
+#endif
+  { KAPI_REFRESH_FACTORS, "gcode_move", "speed_factor,extrude_factor" },
+#if KAPI_ENABLE_PRINT_JOB
+  { KAPI_REFRESH_JOB, "virtual_sdcard", "progress,file_size" }
+#endif
+};
+
+// Whether a field continues the object written last. Names are compared
+// by content: identical literals need not share one address.
+static bool continuesObject(const char* lastObject, const RefreshField& field) {
+  return lastObject != nullptr && strcmp(lastObject, field.object) == 0;
+}
+
+// Build "/printer/objects/query?extruder=temperature,target,power&..."
+// asking only for the attributes selected by mask
+bool KlipperApi::buildObjectQuery(uint8_t mask, char* buffer, size_t size) {
+  size_t length = snprintf(buffer, size, "/printer/objects/query");
+  const char* lastObject = nullptr;
+  
+  for (uint8_t i = 0; i < sizeof(refreshFields) / sizeof(refreshFields[0]); i++) {
+    const RefreshField& field = refreshFields[i];
+    if ((field.mask & mask) == 0) {
+      continue;
+    }
+    
+    if (continuesObject(lastObject, field)) {
+      length += snprintf(buffer + length, length < size ? size - length : 0, ",%s", field.attributes);
+    } else {
+      length += snprintf(buffer + length, length < size ? size - length : 0, "%c%s=%s",
+                         lastObject == nullptr ? '?' : '&', field.object, field.attributes);
+      lastObject = field.object;
+    }
+  }
   
-  if (httpStatusCode != 200 || response.length() == 0) {
+  if (lastObject == nullptr || length >= size) {
+    if (_debug) Serial.println("KlipperAPI: Empty refresh mask or KAPI_QUERY_SIZE too small");
     return false;
   }
+  return true;
+}
+
+// Keep only the response fields a built-in query is stored from. Filters
+// of several queries can be merged into one.
+void KlipperApi::addQueryFilter(uint8_t request, JsonObject filter) {
+  JsonObject result = filter["result"];
+  if (result.isNull()) {
+    result = filter.createNestedObject("result");
+  }
   
-  DynamicJsonDocument doc(JSONDOCUMENT_SIZE);
-  deserializeJson(doc, response);
+  // Object queries already name the attributes they want
+  if (queryRefreshMask(request) != 0) {
+    result["status"] = true;
+    return;
+  }
   
-  if (doc.containsKey("result")) {
-    JsonObject result = doc["result"];
-    
-    // Extract printer state
-    if (result.containsKey("state")) {
-      String state = result["state"];
-      state.toCharArray(printerStats.state, sizeof(printerStats.state));
-      parsePrinterState(state.c_str(), printerStats.stateFlags);
-    }
-    
-    // Extract software versions
-    if (result.containsKey("software_version")) {
-      String version = result["software_version"];
-      version.toCharArray(serverInfo.klipperVersion, sizeof(serverInfo.klipperVersion));
+  switch (request) {
+    case KAPI_REQUEST_PRINTER_INFO:
+      result["state"] = true;
+      result["software_version"] = true;
+      result["hostname"] = true;
+      break;
+    case KAPI_REQUEST_SERVER_INFO:
+      result["moonraker_version"] = true;
+      break;
+#if KAPI_ENABLE_MOTION
+    case KAPI_REQUEST_MOTION_LIMITS: {
+      // configfile.settings holds every section of printer.cfg; keep [printer]
+      JsonObject status = result.createNestedObject("status");
+      JsonObject printer = status.createNestedObject("configfile").createNestedObject("settings").createNestedObject("printer");
+      printer["kinematics"] = true;
+      printer["max_velocity"] = true;
+      printer["max_accel"] = true;
+      printer["max_z_velocity"] = true;
+      printer["max_z_accel"] = true;
+      printer["square_corner_velocity"] = true;
+      status["toolhead"] = true;
+      break;
     }
-    
-    if (result.containsKey("hostname")) {
-      String hostname = result["hostname"];
-      hostname.toCharArray(serverInfo.hostname, sizeof(serverInfo.hostname));
+#endif
+  }
+}
+
+// Store the result member of a built-in query's response
+bool KlipperApi::applyQueryResult(uint8_t request, JsonObject result) {
+  if (result.isNull()) {
+    return false;
+  }
+  
+  if (queryRefreshMask(request) != 0) {
+    if (!result.containsKey("status")) {
+      return false;
     }
-    
+    // Each apply function only reads the objects present in status
+    JsonObject status = result["status"];
+    uint16_t changed = applyPrinterStatus(status);
+#if KAPI_ENABLE_PRINT_JOB
+    changed |= applyPrintJobStatus(status);
+#endif
+#if KAPI_ENABLE_MOTION
+    applyMotionLimits(status);
+#endif
+#if KAPI_ENABLE_OBJECTS
+    applyObjectStatus(status);
+#endif
+#if KAPI_ENABLE_SCHEDULER
+    markUpdated(queryRefreshMask(request), changed);
+#else
+    (void)changed;
+#endif
     return true;
   }
   
+  switch (request) {
+    case KAPI_REQUEST_PRINTER_INFO:
+      applyPrinterInfo(result);
+      // Anything but ready means Klipper is restarting or down, and its
+      // configuration may change before it is back
+      if (printerStats.stateId == KAPI_STATE_READY) {
+        cacheStore(request);
+      } else {
+        invalidateCache();
+      }
+      return true;
+#if KAPI_ENABLE_SERVER_INFO
+    case KAPI_REQUEST_SERVER_INFO:
+      applyServerInfo(result);
+      cacheStore(request);
+      return true;
+#endif
+#if KAPI_ENABLE_MOTION
+    case KAPI_REQUEST_MOTION_LIMITS:
+      if (!result.containsKey("status")) {
+        return false;
+      }
+      applyMotionLimits(result["status"]);
+      cacheStore(request);
+      return true;
+#endif
+  }
   return false;
 }
 
-// Get comprehensive printer statistics
-bool KlipperApi::getPrinterStatistics() {
-  // Query multiple printer objects in one request
-  String response = sendGetToMoonraker("/printer/objects/query?heater_bed&extruder&toolhead&print_stats&gcode_move");
+void KlipperApi::setCacheTtl(unsigned long ttl) {
+  _cacheTtl = ttl;
+  invalidateCache();
+}
+
+void KlipperApi::invalidateCache() {
+  _cacheValid = 0;
+}
+
+// Cache slot of a request, -1 if its result is not cached
+int8_t KlipperApi::cacheSlot(uint8_t request) {
+  switch (request) {
+    case KAPI_REQUEST_PRINTER_INFO:
+      return 0;
+    case KAPI_REQUEST_SERVER_INFO:
+      return 1;
+    case KAPI_REQUEST_MOTION_LIMITS:
+      return 2;
+  }
+  return -1;
+}
+
+// True if the request's last result is still valid, which then stands in
+// for asking Moonraker again
+bool KlipperApi::cacheFresh(uint8_t request) {
+  int8_t slot = cacheSlot(request);
+  if (slot < 0 || !(_cacheValid & (1 << slot))) {
+    return false;
+  }
+  
+  if (millis() - _cacheTime[slot] >= _cacheTtl) {
+    _cacheValid &= ~(1 << slot);
+    return false;
+  }
+  
+  cacheHits++;
+  if (_debug) Serial.println("KlipperAPI: Served from cache");
+  return true;
+}
+
+void KlipperApi::cacheStore(uint8_t request) {
+  int8_t slot = cacheSlot(request);
+  if (slot < 0 || _cacheTtl == 0) {
+    return;
+  }
+  _cacheTime[slot] = millis();
+  _cacheValid |= (1 << slot);
+}
+
+// Open a new connection to Moonraker
+bool KlipperApi::connectClient(Client* client) {
+  if (_usingIpAddress) {
+    return client->connect(_moonrakerIp, _moonrakerPort);
+  }
+  if (_resolver == nullptr || _dnsTtl == 0) {
+    return client->connect(_moonrakerHost, _moonrakerPort);
+  }
+  
+  // A lookup that fails keeps the last address in use
+  if (!_hostResolved || millis() - _resolvedAt >= _resolveInterval) {
+    resolveHost();
+  }
+  if (!_hostResolved) {
+    return false;
+  }
+  if (client->connect(_resolvedIp, _moonrakerPort)) {
+    return true;
+  }
+  
+  // The printer may have a new address, e.g. after a DHCP lease change.
+  // Only try again if the lookup gives a different one.
+  IPAddress previous = _resolvedIp;
+  if (!resolveHost() || _resolvedIp == previous) {
+    return false;
+  }
+  return client->connect(_resolvedIp, _moonrakerPort);
+}
+
+bool KlipperApi::resolveHost() {
+  IPAddress ip;
+  dnsLookupCount++;
+  _resolvedAt = millis();
+  
+  if (!_resolver(_moonrakerHost, ip) || ip == IPAddress(0, 0, 0, 0)) {
+    dnsFailCount++;
+    _resolveInterval = KAPI_DNS_RETRY;
+    if (_debug) {
+      Serial.print("KlipperAPI: Lookup of ");
+      Serial.print(_moonrakerHost);
+      Serial.println(" failed");
+    }
+    return false;
+  }
   
-  if (httpStatusCode != 200 || response.length() == 0) {
+  _resolvedIp = ip;
+  _hostResolved = true;
+  _resolveInterval = _dnsTtl;
+  return true;
+}
+
+#if defined(ESP32) || defined(ESP8266)
+bool KlipperApi::hostByName(const char* host, IPAddress& ip) {
+  return WiFi.hostByName(host, ip) == 1;
+}
+#endif
+
+bool KlipperApi::prewarm(unsigned long lead) {
+  if (_client == nullptr) {
     return false;
   }
+#if KAPI_ENABLE_ASYNC
+  if (isBusy()) {
+    return true;
+  }
+#endif
+#if KAPI_ENABLE_FILES
+  if (_listing) {
+    return true;
+  }
+#endif
   
-  DynamicJsonDocument doc(JSONDOCUMENT_SIZE);
-  deserializeJson(doc, response);
+  // Refresh the address ahead of the connect that would otherwise wait for it
+  if (!_usingIpAddress && _resolver != nullptr && _dnsTtl > 0 &&
+      (!_hostResolved || millis() - _resolvedAt >= _resolveInterval)) {
+    resolveHost();
+  }
+  
+  if (_client->connected()) {
+    return true;
+  }
+  if (!_keepAlive) {
+    return false;
+  }
+#if KAPI_ENABLE_SCHEDULER
+  if (nextUpdateIn() > lead) {
+    return false;
+  }
+#endif
   
-  if (!doc.containsKey("result") || !doc["result"].containsKey("status")) {
+  if (!requestAllowed(false)) {
+    return false;
+  }
+  if (!connectClient(_client)) {
+    if (_debug) Serial.println("KlipperAPI: Connection failed");
+    noteFailure();
+    return false;
+  }
+  noteSuccess();
+  prewarmCount++;
+  return true;
+}
+
+#if KAPI_ENABLE_HEALTH
+void KlipperApi::noteFailure() {
+  if (health.failure() && _debug) {
+    Serial.print("KlipperAPI: Printer unreachable, retrying in ");
+    Serial.print(health.retryIn());
+    Serial.println(" ms");
+  }
+}
+#endif
+
+// Connect the request client, timing the connect for the metrics
+bool KlipperApi::openConnection() {
+  KAPI_METRICS(metrics.startPhase(KAPI_PHASE_CONNECT));
+  if (!connectClient(_client)) {
+    if (_debug) Serial.println("KlipperAPI: Connection failed");
+    KAPI_METRICS(metrics.markError(); metrics.finishRequest());
     return false;
   }
+  KAPI_METRICS(metrics.endPhase(KAPI_PHASE_CONNECT));
+  return true;
+}
+
+// Close client connection
+void KlipperApi::closeClient() {
+  if (_client != nullptr && _client->connected()) {
+    _client->stop();
+  }
+}
+
+// Get printer information
+bool KlipperApi::getPrinterInfo() {
+  return runQuery(KAPI_REQUEST_PRINTER_INFO);
+}
+
+// Store the /printer/info result
+void KlipperApi::applyPrinterInfo(JsonObject result) {
+  // Extract printer state
+  if (result.containsKey("state")) {
+    const char* state = result["state"] | "";
+    copyField(printerStats.state, sizeof(printerStats.state), state);
+    printerStats.stateId = decodeState(state);
+    parsePrinterState(printerStats.stateId, printerStats.stateFlags);
+  }
+  
+#if KAPI_ENABLE_SERVER_INFO
+  // Extract software versions
+  if (result.containsKey("software_version")) {
+    copyField(serverInfo.klipperVersion, sizeof(serverInfo.klipperVersion), result["software_version"] | "");
+  }
   
-  JsonObject status = doc["result"]["status"];
+  if (result.containsKey("hostname")) {
+    copyField(serverInfo.hostname, sizeof(serverInfo.hostname), result["hostname"] | "");
+  }
+#endif
+}
+
+// Get comprehensive printer statistics
+bool KlipperApi::getPrinterStatistics() {
+  return runQuery(KAPI_REQUEST_PRINTER_STATISTICS);
+}
+
+// Merge printer objects into printerStats. Only fields present in status
+// are touched, so full query results and subscription deltas both work.
+// Returns KAPI_CHANGED_* flags for the values that actually changed.
+uint16_t KlipperApi::applyPrinterStatus(JsonObject status) {
+  uint16_t changed = 0;
   
   // Parse extruder temperature
   if (status.containsKey("extruder")) {
+    TemperatureData before = printerStats.extruder;
     JsonObject extruder = status["extruder"];
     parseTemperatureData(extruder, printerStats.extruder);
     printerStats.hasExtruder = 1;
+    if (!sameTemperature(before, printerStats.extruder)) changed |= KAPI_CHANGED_EXTRUDER;
   }
   
   // Parse heated bed temperature
   if (status.containsKey("heater_bed")) {
+    TemperatureData before = printerStats.heatedBed;
     JsonObject bed = status["heater_bed"];
     parseTemperatureData(bed, printerStats.heatedBed);
     printerStats.hasHeatedBed = 1;
+    if (!sameTemperature(before, printerStats.heatedBed)) changed |= KAPI_CHANGED_BED;
   }
   
   // Parse toolhead position and status
@@ -265,18 +863,28 @@ bool KlipperApi::getPrinterStatistics() {
     if (toolhead.containsKey("position")) {
       JsonArray position = toolhead["position"];
       if (position.size() >= 4) {
-        printerStats.positionX = position[0];
-        printerStats.positionY = position[1];
-        printerStats.positionZ = position[2];
-        printerStats.positionE = position[3];
+        float x = position[0];
+        float y = position[1];
+        float z = position[2];
+        float e = position[3];
+        if (x != printerStats.positionX || y != printerStats.positionY ||
+            z != printerStats.positionZ || e != printerStats.positionE) {
+          changed |= KAPI_CHANGED_POSITION;
+        }
+        printerStats.positionX = x;
+        printerStats.positionY = y;
+        printerStats.positionZ = z;
+        printerStats.positionE = e;
       }
     }
     
     if (toolhead.containsKey("homed_axes")) {
-      String homedAxes = toolhead["homed_axes"];
-      printerStats.isHomed = (homedAxes.indexOf('x') != -1 && 
-                             homedAxes.indexOf('y') != -1 && 
-                             homedAxes.indexOf('z') != -1);
+      const char* homedAxes = toolhead["homed_axes"] | "";
+      uint8_t homed = (strchr(homedAxes, 'x') != nullptr &&
+                       strchr(homedAxes, 'y') != nullptr &&
+                       strchr(homedAxes, 'z') != nullptr);
+      if (homed != printerStats.isHomed) changed |= KAPI_CHANGED_HOMED;
+      printerStats.isHomed = homed;
     }
   }
   
@@ -285,15 +893,24 @@ bool KlipperApi::getPrinterStatistics() {
     JsonObject printStats = status["print_stats"];
     
     if (printStats.containsKey("state")) {
-      String state = printStats["state"];
-      state.toCharArray(printerStats.state, sizeof(printerStats.state));
-      parsePrinterState(state.c_str(), printerStats.stateFlags);
+      const char* state = printStats["state"] | "";
+      KlipperState stateId = decodeState(state);
+      // Only states the decoder does not know need the string compared
+      if (stateId != printerStats.stateId ||
+          (stateId == KAPI_STATE_UNKNOWN && strncmp(state, printerStats.state, sizeof(printerStats.state) - 1) != 0)) {
+        changed |= KAPI_CHANGED_STATE;
+        copyField(printerStats.state, sizeof(printerStats.state), state);
+        printerStats.stateId = stateId;
+        parsePrinterState(stateId, printerStats.stateFlags);
+      }
     }
   }
   
   // Parse GCode move information
   if (status.containsKey("gcode_move")) {
     JsonObject gcodeMove = status["gcode_move"];
+    uint16_t speedFactor = printerStats.speedFactor;
+    uint16_t flowFactor = printerStats.flowFactor;
     
     if (gcodeMove.containsKey("speed_factor")) {
       printerStats.speedFactor = (uint16_t)(gcodeMove["speed_factor"].as<float>() * 100);
@@ -302,76 +919,565 @@ bool KlipperApi::getPrinterStatistics() {
     if (gcodeMove.containsKey("extrude_factor")) {
       printerStats.flowFactor = (uint16_t)(gcodeMove["extrude_factor"].as<float>() * 100);
     }
+    
+    if (speedFactor != printerStats.speedFactor || flowFactor != printerStats.flowFactor) {
+      changed |= KAPI_CHANGED_FACTORS;
+    }
   }
   
-  return true;
+  return changed;
 }
 
+#if KAPI_ENABLE_SERVER_INFO
 // Get server information
 bool KlipperApi::getServerInfo() {
-  String response = sendGetToMoonraker("/server/info");
-  
-  if (httpStatusCode != 200 || response.length() == 0) {
-    return false;
+  return runQuery(KAPI_REQUEST_SERVER_INFO);
+}
+
+// Store the /server/info result
+void KlipperApi::applyServerInfo(JsonObject result) {
+  if (result.containsKey("moonraker_version")) {
+    copyField(serverInfo.moonrakerVersion, sizeof(serverInfo.moonrakerVersion), result["moonraker_version"] | "");
   }
+}
+#endif
+
+#if KAPI_ENABLE_PRINT_JOB
+// Get current print job information
+bool KlipperApi::getPrintJob() {
+  return runQuery(KAPI_REQUEST_PRINT_JOB);
+}
+#endif
+
+#if KAPI_ENABLE_MOTION
+// Get kinematics, velocity, acceleration and axis limits. One query reads
+// the configured [printer] limits and the toolhead's current ones.
+bool KlipperApi::getMotionLimits() {
+  return runQuery(KAPI_REQUEST_MOTION_LIMITS);
+}
+#endif
+
+// Query everything selected by mask in a single request
+bool KlipperApi::refresh(uint8_t mask) {
+  _refreshMask = mask;
+  return runQuery(KAPI_REQUEST_REFRESH);
+}
+
+#if KAPI_ENABLE_OBJECTS || KAPI_ENABLE_BATCH
+// Write a piece of a body, or only count it when out is nullptr
+static uint32_t queryPart(KlipperRequestWriter* out, const char* text, size_t length) {
+  if (out != nullptr) {
+    out->write(text, length);
+  }
+  return length;
+}
+
+static uint32_t queryPart(KlipperRequestWriter* out, const char* text) {
+  return queryPart(out, text, strlen(text));
+}
+#endif
+
+#if KAPI_ENABLE_BATCH
+#define KAPI_BATCH_FILTER_SIZE  JSON_OBJECT_SIZE(32)  // Filter merged from every call
+
+// Methods of the KAPI_BATCH_* flags, in bit order. The flag doubles as
+// the call's JSON-RPC id.
+static const char* const batchMethods[] = {
+  "printer.objects.query",
+  "printer.info",
+  "server.info",
+  "server.job_queue.status",
+  "server.history.list"
+};
+
+// [{"jsonrpc":"2.0","method":"printer.info","id":2},...] for a POST to
+// /server/jsonrpc. The object query is written from refreshFields, the
+// same table refresh() builds its URL from.
+class BatchBody : public KlipperBodySource {
+public:
+  BatchBody(uint8_t calls, uint8_t mask) : _calls(calls), _mask(mask) {}
+  
+  uint32_t length() override { return write(nullptr); }
+  void writeTo(KlipperRequestWriter& out) override { write(&out); }
   
-  DynamicJsonDocument doc(JSONDOCUMENT_SIZE);
-  deserializeJson(doc, response);
+private:
+  uint32_t write(KlipperRequestWriter* out) {
+    uint32_t length = queryPart(out, "[");
+    bool first = true;
+    for (uint8_t i = 0; i < sizeof(batchMethods) / sizeof(batchMethods[0]); i++) {
+      uint8_t call = 1 << i;
+      if ((_calls & call) == 0) {
+        continue;
+      }
+      
+      length += queryPart(out, first ? "{\"jsonrpc\":\"2.0\",\"method\":\""
+                                     : ",{\"jsonrpc\":\"2.0\",\"method\":\"");
+      first = false;
+      length += queryPart(out, batchMethods[i]);
+      length += queryPart(out, "\"");
+      if (call == KAPI_BATCH_STATUS) {
+        length += writeObjects(out);
+      } else if (call == KAPI_BATCH_HISTORY) {
+        length += queryPart(out, ",\"params\":{\"limit\":1}");
+      }
+      char id[12];
+      snprintf(id, sizeof(id), ",\"id\":%u}", (unsigned)call);
+      length += queryPart(out, id);
+    }
+    return length + queryPart(out, "]");
+  }
   
-  if (doc.containsKey("result")) {
-    JsonObject result = doc["result"];
+  // ,"params":{"objects":{"extruder":["temperature","target","power"],...}}
+  uint32_t writeObjects(KlipperRequestWriter* out) {
+    uint32_t length = queryPart(out, ",\"params\":{\"objects\":{");
+    const char* lastObject = nullptr;
     
-    if (result.containsKey("moonraker_version")) {
-      String version = result["moonraker_version"];
-      version.toCharArray(serverInfo.moonrakerVersion, sizeof(serverInfo.moonrakerVersion));
+    for (uint8_t i = 0; i < sizeof(refreshFields) / sizeof(refreshFields[0]); i++) {
+      const RefreshField& field = refreshFields[i];
+      if ((field.mask & _mask) == 0) {
+        continue;
+      }
+      
+      if (continuesObject(lastObject, field)) {
+        length += queryPart(out, ",");
+      } else {
+        length += queryPart(out, lastObject == nullptr ? "\"" : "],\"");
+        length += queryPart(out, field.object);
+        length += queryPart(out, "\":[");
+        lastObject = field.object;
+      }
+      
+      // temperature,target becomes "temperature","target"
+      const char* attribute = field.attributes;
+      while (true) {
+        const char* end = strchr(attribute, ',');
+        length += queryPart(out, "\"");
+        length += queryPart(out, attribute, end != nullptr ? (size_t)(end - attribute) : strlen(attribute));
+        if (end == nullptr) {
+          break;
+        }
+        length += queryPart(out, "\",");
+        attribute = end + 1;
+      }
+      length += queryPart(out, "\"");
+    }
+    return length + queryPart(out, lastObject == nullptr ? "}}" : "]}}");
+  }
+  
+  uint8_t _calls;
+  uint8_t _mask;
+};
+
+// One POST instead of a request per call. The replies come back as one
+// array, parsed in a single pass through a filter merged from every call,
+// and each is stored by its id.
+uint8_t KlipperApi::refreshBatch(uint8_t calls, uint8_t mask) {
+  calls &= KAPI_BATCH_ALL;
+#if !KAPI_ENABLE_SERVER_INFO
+  calls &= ~KAPI_BATCH_SERVER_INFO;
+#endif
+  if (mask == 0) {
+    calls &= ~KAPI_BATCH_STATUS;
+  }
+  
+  // Cached results stand in for their calls, as in runQuery()
+  uint8_t done = 0;
+  if ((calls & KAPI_BATCH_PRINTER_INFO) && cacheFresh(KAPI_REQUEST_PRINTER_INFO)) {
+    done |= KAPI_BATCH_PRINTER_INFO;
+  }
+  if ((calls & KAPI_BATCH_SERVER_INFO) && cacheFresh(KAPI_REQUEST_SERVER_INFO)) {
+    done |= KAPI_BATCH_SERVER_INFO;
+  }
+  calls &= ~done;
+  if (calls == 0) {
+    return done;
+  }
+  
+  _refreshMask = mask;
+  BatchBody body(calls, mask);
+  if (!beginRequest("POST", "/server/jsonrpc", nullptr, &body)) {
+    return done;
+  }
+  batchCount++;
+  for (uint8_t call = calls; call != 0; call &= call - 1) {
+    batchCallCount++;
+  }
+  
+  if (httpStatusCode != 200) {
+    endRequest();
+    return done;
+  }
+  
+  // Replies share one filter: every member any of the calls is stored from
+  StaticJsonDocument<KAPI_BATCH_FILTER_SIZE> filter;
+  JsonObject replyFilter = filter.to<JsonArray>().createNestedObject();
+  replyFilter["id"] = true;
+  replyFilter["error"]["message"] = true;
+  JsonObject resultFilter = replyFilter.createNestedObject("result");
+  if (calls & KAPI_BATCH_STATUS) {
+    addQueryFilter(KAPI_REQUEST_REFRESH, replyFilter);
+  }
+  if (calls & KAPI_BATCH_PRINTER_INFO) {
+    addQueryFilter(KAPI_REQUEST_PRINTER_INFO, replyFilter);
+  }
+  if (calls & KAPI_BATCH_SERVER_INFO) {
+    addQueryFilter(KAPI_REQUEST_SERVER_INFO, replyFilter);
+  }
+  if (calls & KAPI_BATCH_JOB_QUEUE) {
+    resultFilter["queue_state"] = true;
+    resultFilter.createNestedArray("queued_jobs").createNestedObject()["filename"] = true;
+  }
+  if (calls & KAPI_BATCH_HISTORY) {
+    JsonObject job = resultFilter.createNestedArray("jobs").createNestedObject();
+    job["filename"] = true;
+    job["status"] = true;
+    job["start_time"] = true;
+    job["print_duration"] = true;
+    job["total_duration"] = true;
+    job["filament_used"] = true;
+  }
+  
+  JsonDocument& doc = jsonPool.acquire();
+  bool parsed = parseBody(doc, filter);
+  endRequest();
+  if (!parsed && jsonPool.outgrown()) {
+    // The combined reply is larger than any single one; send it again
+    // into the grown pool, as getJsonFromMoonraker() does
+    return done | refreshBatch(calls, mask);
+  }
+  if (!parsed) {
+    return done;
+  }
+  
+  // printer.info stores Klipper's state in printerStats.state, which the
+  // object query's print_stats state refines, so the status goes last
+  JsonObject status;
+  for (JsonObject reply : doc.as<JsonArray>()) {
+    uint8_t call = reply["id"] | 0;
+    if ((call & calls) == 0 || (call & (call - 1)) != 0) {
+      continue;
     }
     
-    return true;
+    if (reply.containsKey("error")) {
+      if (_debug) {
+        Serial.print("KlipperAPI: Batch call failed: ");
+        Serial.println(reply["error"]["message"] | "");
+      }
+      continue;
+    }
+    
+    JsonObject result = reply["result"];
+    bool ok = !result.isNull();
+    switch (call) {
+      case KAPI_BATCH_STATUS:
+        status = result;
+        ok = false;
+        break;
+      case KAPI_BATCH_PRINTER_INFO:
+        ok = applyQueryResult(KAPI_REQUEST_PRINTER_INFO, result);
+        break;
+#if KAPI_ENABLE_SERVER_INFO
+      case KAPI_BATCH_SERVER_INFO:
+        ok = applyQueryResult(KAPI_REQUEST_SERVER_INFO, result);
+        break;
+#endif
+      case KAPI_BATCH_JOB_QUEUE:
+        if (ok) applyJobQueue(result);
+        break;
+      case KAPI_BATCH_HISTORY:
+        if (ok) applyHistory(result);
+        break;
+    }
+    if (ok) {
+      done |= call;
+    }
   }
+  if (applyQueryResult(KAPI_REQUEST_REFRESH, status)) {
+    done |= KAPI_BATCH_STATUS;
+  }
+  return done;
+}
+
+// Store a server.job_queue.status result
+void KlipperApi::applyJobQueue(JsonObject result) {
+  copyField(jobQueue.state, sizeof(jobQueue.state), result["queue_state"] | "");
+  JsonArray jobs = result["queued_jobs"];
+  jobQueue.queuedJobs = jobs.size() > 255 ? 255 : jobs.size();
+  copyField(jobQueue.nextFilename, sizeof(jobQueue.nextFilename), jobs[0]["filename"] | "");
+}
+
+// Store the newest job of a server.history.list result, an empty
+// lastJob if the history is empty
+void KlipperApi::applyHistory(JsonObject result) {
+  JsonObject job = result["jobs"][0];
+  copyField(lastJob.filename, sizeof(lastJob.filename), job["filename"] | "");
+  copyField(lastJob.status, sizeof(lastJob.status), job["status"] | "");
+  lastJob.startTime = (uint32_t)(job["start_time"] | 0.0);  // Too large for a float's precision
+  lastJob.printDuration = (uint32_t)(job["print_duration"] | 0.0f);
+  lastJob.totalDuration = (uint32_t)(job["total_duration"] | 0.0f);
+  lastJob.filamentUsed = job["filament_used"] | 0.0f;
+}
+#endif
+
+#if KAPI_ENABLE_SCHEDULER
+// Groups the object query can actually fetch in this build
+static const uint8_t scheduledGroups = KAPI_REFRESH_STATISTICS
+#if KAPI_ENABLE_PRINT_JOB
+  | KAPI_REFRESH_JOB
+#endif
+#if KAPI_ENABLE_MOTION
+  | KAPI_REFRESH_MOTION
+#endif
+  ;
+
+uint8_t KlipperApi::update() {
+  uint8_t due = updateDue();
+  if (due == 0) {
+    return 0;
+  }
+  updateCount++;
+  return refresh(due) ? due : 0;
+}
+
+// A group is due once its interval has passed. Groups within the last
+// quarter of their interval ride along, so they do not cost a request of
+// their own shortly after.
+uint8_t KlipperApi::updateDue() {
+  uint8_t mask = _updateMask & scheduledGroups;
+#if KAPI_ENABLE_SUBSCRIPTION
+  // Pushed status updates keep these current
+  if (isSubscribed()) {
+    mask &= ~(KAPI_REFRESH_STATISTICS | KAPI_REFRESH_JOB);
+  }
+#endif
   
-  return false;
+  unsigned long now = millis();
+  uint8_t due = 0;
+  uint8_t soon = 0;
+  for (uint8_t i = 0; i < KAPI_UPDATE_GROUPS; i++) {
+    uint8_t group = 1 << i;
+    if ((mask & group) == 0) {
+      continue;
+    }
+    if ((_updatedMask & group) == 0) {
+      due |= group;
+      continue;
+    }
+    
+    unsigned long interval = updateInterval(group);
+    unsigned long elapsed = now - _updatedAt[i];
+    if (elapsed >= interval) {
+      due |= group;
+    } else if (elapsed >= interval - interval / 4) {
+      soon |= group;
+    }
+  }
+  
+  return due != 0 ? (due | soon) : 0;
 }
 
-// Get current print job information
-bool KlipperApi::getPrintJob() {
-  String response = sendGetToMoonraker("/printer/objects/query?print_stats&virtual_sdcard");
+unsigned long KlipperApi::nextUpdateIn() {
+  // Nothing goes out before the breaker lets it
+  unsigned long retry = 0;
+#if KAPI_ENABLE_HEALTH
+  retry = health.retryIn();
+#endif
+  if (updateDue() != 0) {
+    return retry;
+  }
   
-  if (httpStatusCode != 200 || response.length() == 0) {
-    return false;
+  uint8_t mask = _updateMask & scheduledGroups;
+#if KAPI_ENABLE_SUBSCRIPTION
+  if (isSubscribed()) {
+    mask &= ~(KAPI_REFRESH_STATISTICS | KAPI_REFRESH_JOB);
+  }
+#endif
+  
+  unsigned long now = millis();
+  unsigned long next = ~0UL;
+  for (uint8_t i = 0; i < KAPI_UPDATE_GROUPS; i++) {
+    uint8_t group = 1 << i;
+    if ((mask & group) == 0) {
+      continue;
+    }
+    unsigned long left = updateInterval(group) - (now - _updatedAt[i]);
+    if (left < next) {
+      next = left;
+    }
   }
+  return next > retry ? next : retry;
+}
+
+static bool heating(const TemperatureData& heater) {
+  return heater.target > 0 && fabs(heater.current - heater.target) > KAPI_POLL_HEATING_BAND;
+}
+
+unsigned long KlipperApi::updateInterval(uint8_t group) {
+  bool printing = (printerStats.stateId == KAPI_STATE_PRINTING);
+  bool active = printing || printerStats.stateId == KAPI_STATE_PAUSED;
   
-  DynamicJsonDocument doc(JSONDOCUMENT_SIZE);
-  deserializeJson(doc, response);
+  switch (group) {
+    case KAPI_REFRESH_TEMPERATURES:
+      if (heating(printerStats.extruder) || heating(printerStats.heatedBed)) {
+        return KAPI_POLL_FAST;
+      }
+      return (printerStats.extruder.target > 0 || printerStats.heatedBed.target > 0) ? KAPI_POLL_NORMAL : KAPI_POLL_IDLE;
+    
+    case KAPI_REFRESH_POSITION:
+      // Moving covers homing and moves started by other clients
+      if (printing || _positionMoving || millis() - _motionCommandAt < KAPI_POLL_MOTION_WINDOW) {
+        return KAPI_POLL_FAST;
+      }
+      return KAPI_POLL_IDLE;
+    
+    case KAPI_REFRESH_STATE:
+      return active ? KAPI_POLL_NORMAL : KAPI_POLL_STATE;
+    
+    case KAPI_REFRESH_FACTORS:
+      return active ? KAPI_POLL_NORMAL : KAPI_POLL_IDLE;
+    
+    case KAPI_REFRESH_JOB:
+      if (!printing) {
+        return active ? KAPI_POLL_NORMAL : KAPI_POLL_IDLE;
+      }
+      // Poll about as often as progress moves by KAPI_POLL_PROGRESS_STEP
+      if (_progressRate > 0) {
+        float interval = KAPI_POLL_PROGRESS_STEP / _progressRate;
+        if (interval < KAPI_POLL_FAST) return KAPI_POLL_FAST;
+        if (interval > KAPI_POLL_IDLE) return KAPI_POLL_IDLE;
+        return (unsigned long)interval;
+      }
+      return KAPI_POLL_NORMAL;
+  }
+  return KAPI_POLL_STATIC;
+}
+
+// Record a successful object query for the scheduler, whoever started it
+void KlipperApi::markUpdated(uint8_t mask, uint16_t changed) {
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < KAPI_UPDATE_GROUPS; i++) {
+    if (mask & (1 << i)) {
+      _updatedAt[i] = now;
+    }
+  }
+  _updatedMask |= mask;
   
-  if (!doc.containsKey("result") || !doc["result"].containsKey("status")) {
-    return false;
+  if (mask & KAPI_REFRESH_POSITION) {
+    _positionMoving = (changed & KAPI_CHANGED_POSITION) != 0;
+  }
+  
+  // A print starting or ending changes every rule; fetch the rest now
+  if (changed & KAPI_CHANGED_STATE) {
+    _updatedMask &= (mask | ~(KAPI_REFRESH_POSITION | KAPI_REFRESH_FACTORS | KAPI_REFRESH_JOB));
   }
   
-  JsonObject status = doc["result"]["status"];
+#if KAPI_ENABLE_PRINT_JOB
+  if (mask & KAPI_REFRESH_JOB) {
+    if (!printJob.isPrinting) {
+      _progressAt = 0;
+      _progressRate = 0;
+    } else if (_progressAt == 0 || printJob.progress < _progress) {
+      _progress = printJob.progress;
+      _progressAt = now;
+    } else if (printJob.progress > _progress) {
+      _progressRate = (printJob.progress - _progress) / (float)(now - _progressAt);
+      _progress = printJob.progress;
+      _progressAt = now;
+    }
+  }
+#endif
+}
+#endif
+
+#if KAPI_ENABLE_MOTION
+// Merge configured and toolhead limits into motionLimits. The toolhead
+// values come last since they include SET_VELOCITY_LIMIT changes.
+void KlipperApi::applyMotionLimits(JsonObject status) {
+  JsonObject printer = status["configfile"]["settings"]["printer"];
+  if (!printer.isNull()) {
+    const char* kinematics = printer["kinematics"] | "";
+    snprintf(motionLimits.kinematics, sizeof(motionLimits.kinematics), "%s", kinematics);
+    motionLimits.maxVelocity = printer["max_velocity"] | motionLimits.maxVelocity;
+    motionLimits.maxAcceleration = printer["max_accel"] | motionLimits.maxAcceleration;
+    motionLimits.squareCornerVelocity = printer["square_corner_velocity"] | 5.0f;
+    // Klipper defaults the Z limits to the general ones
+    motionLimits.maxZVelocity = printer["max_z_velocity"] | motionLimits.maxVelocity;
+    motionLimits.maxZAcceleration = printer["max_z_accel"] | motionLimits.maxAcceleration;
+  }
+  
+  if (!status.containsKey("toolhead")) {
+    return;
+  }
+  JsonObject toolhead = status["toolhead"];
+  
+  if (toolhead.containsKey("max_velocity")) {
+    motionLimits.maxVelocity = toolhead["max_velocity"];
+  }
+  
+  if (toolhead.containsKey("max_accel")) {
+    motionLimits.maxAcceleration = toolhead["max_accel"];
+  }
+  
+  if (toolhead.containsKey("square_corner_velocity")) {
+    motionLimits.squareCornerVelocity = toolhead["square_corner_velocity"];
+  }
+  
+  // [x, y, z, e]
+  JsonArray minimum = toolhead["axis_minimum"];
+  if (minimum.size() >= 3) {
+    motionLimits.xMin = minimum[0];
+    motionLimits.yMin = minimum[1];
+    motionLimits.zMin = minimum[2];
+  }
+  
+  JsonArray maximum = toolhead["axis_maximum"];
+  if (maximum.size() >= 3) {
+    motionLimits.xMax = maximum[0];
+    motionLimits.yMax = maximum[1];
+    motionLimits.zMax = maximum[2];
+  }
+}
+#endif
+
+#if KAPI_ENABLE_PRINT_JOB
+// Merge print_stats and virtual_sdcard into printJob, see applyPrinterStatus
+uint16_t KlipperApi::applyPrintJobStatus(JsonObject status) {
+  uint16_t changed = 0;
   
   // Parse print statistics
   if (status.containsKey("print_stats")) {
     JsonObject printStats = status["print_stats"];
     
     if (printStats.containsKey("filename")) {
-      String filename = printStats["filename"];
-      filename.toCharArray(printJob.filename, sizeof(printJob.filename));
+      const char* filename = printStats["filename"] | "";
+      if (strncmp(filename, printJob.filename, sizeof(printJob.filename) - 1) != 0) {
+        changed |= KAPI_CHANGED_JOB;
+        copyField(printJob.filename, sizeof(printJob.filename), filename);
+      }
     }
     
     if (printStats.containsKey("state")) {
-      String state = printStats["state"];
-      state.toCharArray(printJob.state, sizeof(printJob.state));
+      const char* state = printStats["state"] | "";
+      KlipperState stateId = decodeState(state);
+      if (stateId != printJob.stateId ||
+          (stateId == KAPI_STATE_UNKNOWN && strncmp(state, printJob.state, sizeof(printJob.state) - 1) != 0)) {
+        changed |= KAPI_CHANGED_JOB;
+        copyField(printJob.state, sizeof(printJob.state), state);
+        printJob.stateId = stateId;
+      }
       
       // Set job state flags
-      printJob.isPrinting = (state == "printing");
-      printJob.isPaused = (state == "paused");
-      printJob.isComplete = (state == "complete");
-      printJob.isCancelled = (state == "cancelled");
-      printJob.hasError = (state == "error");
+      printJob.isPrinting = (stateId == KAPI_STATE_PRINTING);
+      printJob.isPaused = (stateId == KAPI_STATE_PAUSED);
+      printJob.isComplete = (stateId == KAPI_STATE_COMPLETE);
+      printJob.isCancelled = (stateId == KAPI_STATE_CANCELLED);
+      printJob.hasError = (stateId == KAPI_STATE_ERROR);
     }
     
     if (printStats.containsKey("print_duration")) {
-      printJob.printTime = printStats["print_duration"];
+      uint32_t printTime = printStats["print_duration"];
+      if (printTime != printJob.printTime) changed |= KAPI_CHANGED_PROGRESS;
+      printJob.printTime = printTime;
     }
     
     if (printStats.containsKey("total_duration")) {
@@ -379,54 +1485,671 @@ bool KlipperApi::getPrintJob() {
     }
   }
   
-  // Parse virtual SD card information
-  if (status.containsKey("virtual_sdcard")) {
-    JsonObject sdcard = status["virtual_sdcard"];
-    
-    if (sdcard.containsKey("progress")) {
-      printJob.progress = sdcard["progress"];
-    }
-    
-    if (sdcard.containsKey("file_size")) {
-      printJob.fileSize = sdcard["file_size"];
-      printJob.printedBytes = (uint32_t)(printJob.progress * printJob.fileSize);
-    }
+  // Parse virtual SD card information
+  if (status.containsKey("virtual_sdcard")) {
+    JsonObject sdcard = status["virtual_sdcard"];
+    
+    if (sdcard.containsKey("progress")) {
+      float progress = sdcard["progress"];
+      if (progress != printJob.progress) changed |= KAPI_CHANGED_PROGRESS;
+      printJob.progress = progress;
+    }
+    
+    if (sdcard.containsKey("file_size")) {
+      printJob.fileSize = sdcard["file_size"];
+    }
+    
+    printJob.printedBytes = (uint32_t)(printJob.progress * printJob.fileSize);
+  }
+  
+  // Calculate time left
+  if (printJob.progress > 0 && printJob.printTime > 0) {
+    float totalEstimated = printJob.printTime / printJob.progress;
+    printJob.timeLeft = (uint32_t)(totalEstimated - printJob.printTime);
+  }
+  
+  return changed;
+}
+#endif
+
+#if KAPI_ENABLE_OBJECTS
+// Object name prefixes worth monitoring. A prefix ending in a space takes
+// any section name after it, the others must match exactly.
+typedef struct {
+  const char* prefix;
+  uint8_t kind;
+} ObjectPrefix;
+
+static const ObjectPrefix objectPrefixes[] = {
+  { "heater_bed", KAPI_OBJECT_HEATER },
+  { "heater_generic ", KAPI_OBJECT_HEATER },
+  { "temperature_sensor ", KAPI_OBJECT_SENSOR },
+  { "temperature_fan ", KAPI_OBJECT_TEMP_FAN },
+  { "fan", KAPI_OBJECT_FAN },
+  { "fan_generic ", KAPI_OBJECT_FAN },
+  { "heater_fan ", KAPI_OBJECT_FAN },
+  { "controller_fan ", KAPI_OBJECT_FAN }
+};
+
+// Kind of a printer object, -1 for objects that are not monitored
+static int8_t objectKind(const char* name) {
+  // extruder, extruder1, ... but not extruder_stepper
+  if (strncmp(name, "extruder", 8) == 0 && strspn(name + 8, "0123456789") == strlen(name + 8)) {
+    return KAPI_OBJECT_HEATER;
+  }
+  
+  for (uint8_t i = 0; i < sizeof(objectPrefixes) / sizeof(objectPrefixes[0]); i++) {
+    const char* prefix = objectPrefixes[i].prefix;
+    size_t length = strlen(prefix);
+    bool match = (prefix[length - 1] == ' ') ? (strncmp(name, prefix, length) == 0 && name[length] != '\0')
+                                            : (strcmp(name, prefix) == 0);
+    if (match) {
+      return objectPrefixes[i].kind;
+    }
+  }
+  return -1;
+}
+
+// {"objects":{"extruder":["temperature","target","power"],...}} for a POST
+// to /printer/objects/query, written straight from the object table
+class ObjectQueryBody : public KlipperBodySource {
+public:
+  ObjectQueryBody(const KlipperObject* objects, uint8_t count, const char* names)
+    : _objects(objects), _count(count), _names(names) {}
+  
+  uint32_t length() override { return write(nullptr); }
+  void writeTo(KlipperRequestWriter& out) override { write(&out); }
+  
+private:
+  uint32_t write(KlipperRequestWriter* out) {
+    static const char* const attributes[] = {
+      "[\"temperature\",\"target\",\"power\"]",
+      "[\"temperature\"]",
+      "[\"speed\"]",
+      "[\"temperature\",\"target\",\"speed\"]"
+    };
+    
+    uint32_t length = queryPart(out, "{\"objects\":{");
+    for (uint8_t i = 0; i < _count; i++) {
+      length += queryPart(out, i == 0 ? "\"" : ",\"");
+      length += queryPart(out, _names + _objects[i].name);
+      length += queryPart(out, "\":");
+      length += queryPart(out, attributes[_objects[i].kind]);
+    }
+    return length + queryPart(out, "}}");
+  }
+  
+  const KlipperObject* _objects;
+  uint8_t _count;
+  const char* _names;
+};
+
+// Walk the object list off the connection; only names are read, no JSON
+// document is built
+bool KlipperApi::discoverObjects() {
+  if (!beginRequest("GET", "/printer/objects/list")) {
+    return false;
+  }
+  
+  if (httpStatusCode != 200) {
+    endRequest();
+    return false;
+  }
+  
+  _objectCount = 0;
+  _objectNamesUsed = 0;
+  memset(_objectSlots, 0, sizeof(_objectSlots));
+  
+  static const char* const keys[] = { "objects" };
+  bool ok = (seekArray(keys, 1) == 0);
+  char name[KAPI_OBJECT_NAME_SIZE];
+  
+  while (ok) {
+    int c = skipSpace();
+    _body.read();
+    if (c == ']') {
+      break;
+    }
+    if (c == ',') {
+      continue;
+    }
+    
+    int length = (c == '"') ? readBodyString(name, sizeof(name)) : -1;
+    if (length < 0) {
+      ok = false;
+    } else if (length < (int)sizeof(name)) {
+      int8_t kind = objectKind(name);
+      if (kind >= 0) {
+        addObject(name, kind);
+      }
+    }
+  }
+  
+  endRequest();
+  
+  if (_debug) {
+    Serial.print("KlipperAPI: Discovered ");
+    Serial.print(_objectCount);
+    Serial.println(" heaters, fans and sensors");
+  }
+  return ok;
+}
+
+bool KlipperApi::addObject(const char* name, uint8_t kind) {
+  size_t length = strlen(name) + 1;
+  if (_objectCount == KAPI_OBJECT_MAX || _objectNamesUsed + length > sizeof(_objectNames)) {
+    if (_debug) Serial.println("KlipperAPI: Object table full, raise KAPI_OBJECT_MAX or KAPI_OBJECT_ARENA_SIZE");
+    return false;
+  }
+  
+  KlipperObject& object = _objects[_objectCount];
+  memset(&object, 0, sizeof(object));
+  object.name = _objectNamesUsed;
+  object.kind = kind;
+  memcpy(_objectNames + _objectNamesUsed, name, length);
+  _objectNamesUsed += length;
+  
+  // Linear probing; the index is twice the table size, so a free slot is
+  // always near
+  uint8_t slot = objectHash(name);
+  while (_objectSlots[slot] != 0) {
+    slot = (slot + 1) % KAPI_OBJECT_SLOTS;
+  }
+  _objectSlots[slot] = ++_objectCount;
+  return true;
+}
+
+// FNV-1a of the name, reduced to a slot of the index
+uint8_t KlipperApi::objectHash(const char* name) {
+  uint32_t hash = 2166136261UL;
+  while (*name != '\0') {
+    hash = (hash ^ (uint8_t)*name++) * 16777619UL;
+  }
+  return hash % KAPI_OBJECT_SLOTS;
+}
+
+const KlipperObject* KlipperApi::findObject(const char* name) const {
+  uint8_t slot = objectHash(name);
+  while (_objectSlots[slot] != 0) {
+    const KlipperObject& object = _objects[_objectSlots[slot] - 1];
+    if (strcmp(_objectNames + object.name, name) == 0) {
+      return &object;
+    }
+    slot = (slot + 1) % KAPI_OBJECT_SLOTS;
+  }
+  return nullptr;
+}
+
+bool KlipperApi::refreshObjects() {
+  if (_objectCount == 0) {
+    return false;
+  }
+  
+  ObjectQueryBody query(_objects, _objectCount, _objectNames);
+  if (!beginRequest("POST", "/printer/objects/query", nullptr, &query)) {
+    return false;
+  }
+  
+  if (httpStatusCode != 200) {
+    endRequest();
+    return false;
+  }
+  
+  StaticJsonDocument<KAPI_FILTER_SIZE> filter;
+  filter["result"]["status"] = true;
+  JsonDocument& doc = jsonPool.acquire();
+  bool ok = parseBody(doc, filter);
+  endRequest();
+  if (!ok && jsonPool.outgrown()) {
+    return refreshObjects();
+  }
+  
+  if (ok) {
+    applyObjectStatus(doc["result"]["status"]);
+  }
+  return ok;
+}
+
+// Store the values of discovered objects present in a status update
+void KlipperApi::applyObjectStatus(JsonObject status) {
+  if (_objectCount == 0) {
+    return;
+  }
+  
+  for (JsonPair pair : status) {
+    KlipperObject* object = (KlipperObject*)findObject(pair.key().c_str());
+    if (object == nullptr) {
+      continue;
+    }
+    
+    JsonObject values = pair.value();
+    object->temperature = values["temperature"] | object->temperature;
+    object->target = values["target"] | object->target;
+    object->value = values[object->kind == KAPI_OBJECT_HEATER ? "power" : "speed"] | object->value;
+  }
+}
+#endif
+
+#if KAPI_ENABLE_FILES || KAPI_ENABLE_OBJECTS
+// Large responses are walked key by key off the connection and only their
+// elements are parsed, so nothing holds the whole body.
+
+// Skip whitespace and return the next body character without consuming it
+int KlipperApi::skipSpace() {
+  int c = _body.peek();
+  while (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+    _body.read();
+    c = _body.peek();
+  }
+  return c;
+}
+
+// Read the rest of a JSON string whose opening quote was consumed. Escapes
+// are kept as their second character; what does not fit is dropped.
+// Returns the full length, -1 if the body ended.
+int KlipperApi::readBodyString(char* out, size_t size) {
+  size_t length = 0;
+  int c;
+  
+  while ((c = _body.read()) >= 0 && c != '"') {
+    if (c == '\\') {
+      c = _body.read();
+    }
+    if (length + 1 < size) {
+      out[length] = (char)c;
+    }
+    length++;
+  }
+  out[length < size ? length : size - 1] = '\0';
+  return c < 0 ? -1 : (int)length;
+}
+
+// Read up to the opening bracket of the next array under one of keys and
+// return the index of its key, -1 at the end of the body. Only keys are
+// matched, so a string value equal to a key does not confuse it.
+int8_t KlipperApi::seekArray(const char* const* keys, uint8_t count) {
+  char key[12];
+  int c;
+  
+  while ((c = _body.read()) >= 0) {
+    if (c != '"') {
+      continue;
+    }
+    if (readBodyString(key, sizeof(key)) < 0) {
+      break;
+    }
+    
+    // A string value is followed by ',' or '}' and is passed over here;
+    // an opening quote is left for the loop
+    if (skipSpace() != ':') {
+      continue;
+    }
+    _body.read();
+    if (skipSpace() != '[') {
+      continue;
+    }
+    
+    for (uint8_t i = 0; i < count; i++) {
+      if (strcmp(key, keys[i]) == 0) {
+        _body.read();
+        return i;
+      }
+    }
+  }
+  
+  return -1;
+}
+#endif
+
+#if KAPI_ENABLE_FILES
+// Append text to out with everything but unreserved characters and '/'
+// percent encoded. Returns false if it did not fit.
+static bool appendUrlEncoded(char* out, size_t size, const char* text) {
+  static const char hex[] = "0123456789ABCDEF";
+  size_t length = strlen(out);
+  
+  for (; *text != '\0'; text++) {
+    uint8_t c = (uint8_t)*text;
+    bool plain = isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~' || c == '/';
+    if (length + (plain ? 1 : 3) >= size) {
+      return false;
+    }
+    if (plain) {
+      out[length++] = c;
+    } else {
+      out[length++] = '%';
+      out[length++] = hex[c >> 4];
+      out[length++] = hex[c & 0x0F];
+    }
+  }
+  out[length] = '\0';
+  return true;
+}
+
+// Request a directory listing and leave the body on the connection.
+// /server/files/directory with extended=true carries the slicer time
+// estimate of each file, which /server/files/list does not.
+bool KlipperApi::openFileList(const char* directory) {
+  closeFileList();
+  
+  // Paths are kept relative to the gcodes root without a trailing slash
+  while (*directory == '/') directory++;
+  copyField(_listDirectory, sizeof(_listDirectory), directory);
+  size_t length = strlen(_listDirectory);
+  while (length > 0 && _listDirectory[length - 1] == '/') {
+    _listDirectory[--length] = '\0';
+  }
+  
+  char endpoint[KAPI_QUERY_SIZE] = "/server/files/directory?path=gcodes";
+  if (length > 0) {
+    strcat(endpoint, "/");
+    if (!appendUrlEncoded(endpoint, sizeof(endpoint) - 16, _listDirectory)) {
+      if (_debug) Serial.println("KlipperAPI: Directory name too long");
+      return false;
+    }
+  }
+  strcat(endpoint, "&extended=true");
+  
+  if (!beginRequest("GET", endpoint)) {
+    return false;
+  }
+  
+  if (httpStatusCode != 200) {
+    endRequest();
+    return false;
+  }
+  
+  _listing = true;
+  _listInArray = false;
+  return true;
+}
+
+static const char* const fileArrays[] = { "dirs", "files" };
+
+// Parse the next entry off the connection. Only one entry is held in the
+// JSON document at a time. Hidden entries such as .thumbs are skipped.
+bool KlipperApi::nextFile(KlipperFileInfo& file) {
+  while (_listing) {
+    if (!_listInArray) {
+      int8_t array = seekArray(fileArrays, 2);
+      if (array < 0) {
+        // Nothing but disk usage left, let endRequest() keep the connection
+        closeFileList();
+        return false;
+      }
+      _listDirs = (array == 0);
+      _listInArray = true;
+    }
+    
+    int c = skipSpace();
+    if (c == ',') {
+      _body.read();
+      c = skipSpace();
+    }
+    if (c == ']') {
+      _body.read();
+      _listInArray = false;
+      continue;
+    }
+    if (c != '{') {
+      if (_debug) Serial.println("KlipperAPI: Unexpected data in file listing");
+      abortFileList();
+      return false;
+    }
+    
+    StaticJsonDocument<KAPI_FILTER_SIZE> filter;
+    filter[_listDirs ? "dirname" : "filename"] = true;
+    filter["size"] = true;
+    filter["modified"] = true;
+    filter["estimated_time"] = true;
+    
+    JsonDocument& doc = jsonPool.acquire();
+    if (!parseBody(doc, filter)) {
+      abortFileList();
+      return false;
+    }
+    
+    const char* name = doc[_listDirs ? "dirname" : "filename"] | "";
+    if (name[0] == '.' || name[0] == '\0') {
+      continue;
+    }
+    
+    int length;
+    if (_listDirectory[0] != '\0') {
+      length = snprintf(file.name, sizeof(file.name), "%s/%s", _listDirectory, name);
+    } else {
+      length = snprintf(file.name, sizeof(file.name), "%s", name);
+    }
+    file.truncated = (length >= (int)sizeof(file.name));
+    file.isDirectory = _listDirs;
+    file.size = doc["size"] | 0UL;
+    file.modified = (uint32_t)(doc["modified"] | 0.0);
+    file.estimatedTime = (uint32_t)(doc["estimated_time"] | 0.0);
+    return true;
+  }
+  
+  return false;
+}
+
+// Stop listing. A listing that was not read to the end is abandoned by
+// closing the connection, which is cheaper than reading the rest of it.
+void KlipperApi::closeFileList() {
+  if (!_listing) {
+    return;
+  }
+  
+  if (_body.complete()) {
+    _listing = false;
+    endRequest();
+  } else {
+    abortFileList();
+  }
+}
+
+void KlipperApi::abortFileList() {
+  _listing = false;
+  _body.end();
+#if KAPI_ENABLE_METRICS
+  metrics.endPhase(KAPI_PHASE_BODY);
+  metrics.addBytes(0, _head.bytesRead() + _body.bytesRead());
+  metrics.finishRequest();
+#endif
+  closeClient();
+}
+
+// Entries offset.. of a listing, read until count are filled
+uint16_t KlipperApi::listFiles(KlipperFileInfo* files, uint16_t count, uint16_t offset,
+                               const char* directory, KlipperFileFilter filter) {
+  if (count == 0 || !openFileList(directory)) {
+    return 0;
+  }
+  
+  uint16_t filled = 0;
+  while (filled < count && nextFile(files[filled])) {
+    if (filter != nullptr && !filter(files[filled])) {
+      continue;
+    }
+    if (offset > 0) {
+      offset--;
+      continue;
+    }
+    filled++;
+  }
+  
+  closeFileList();
+  return filled;
+}
+
+// Keep the newest files seen so far sorted in files[], so the whole
+// listing never has to be held to sort it
+uint16_t KlipperApi::listRecentFiles(KlipperFileInfo* files, uint16_t count,
+                                     const char* directory, KlipperFileFilter filter) {
+  if (count == 0 || !openFileList(directory)) {
+    return 0;
+  }
+  
+  KlipperFileInfo file;
+  uint16_t filled = 0;
+  while (nextFile(file)) {
+    if (file.isDirectory || (filter != nullptr && !filter(file))) {
+      continue;
+    }
+    
+    uint16_t position = filled;
+    while (position > 0 && files[position - 1].modified < file.modified) {
+      position--;
+    }
+    if (position == count) {
+      continue;
+    }
+    
+    uint16_t moved = (filled < count ? filled : count - 1) - position;
+    memmove(&files[position + 1], &files[position], moved * sizeof(KlipperFileInfo));
+    files[position] = file;
+    if (filled < count) {
+      filled++;
+    }
+  }
+  
+  return filled;
+}
+
+// Size and slicer estimates of a single file
+bool KlipperApi::getFileMetadata(const char* filename, KlipperFileInfo& file) {
+  char endpoint[KAPI_QUERY_SIZE] = "/server/files/metadata?filename=";
+  if (!appendUrlEncoded(endpoint, sizeof(endpoint), filename)) {
+    if (_debug) Serial.println("KlipperAPI: File name too long");
+    return false;
+  }
+  
+  StaticJsonDocument<KAPI_FILTER_SIZE> filter;
+  JsonObject result = filter.createNestedObject("result");
+  result["size"] = true;
+  result["modified"] = true;
+  result["estimated_time"] = true;
+  
+  JsonDocument& doc = jsonPool.acquire();
+  if (!getJsonFromMoonraker(endpoint, doc, filter)) {
+    return false;
+  }
+  
+  JsonObject metadata = doc["result"];
+  int length = snprintf(file.name, sizeof(file.name), "%s", filename);
+  file.truncated = (length >= (int)sizeof(file.name));
+  file.isDirectory = false;
+  file.size = metadata["size"] | 0UL;
+  file.modified = (uint32_t)(metadata["modified"] | 0.0);
+  file.estimatedTime = (uint32_t)(metadata["estimated_time"] | 0.0);
+  return true;
+}
+#endif
+
+#if KAPI_ENABLE_UPLOAD
+// Copy the name, since a non-blocking upload outlives the caller's string
+bool KlipperApi::prepareUpload(Stream& file, const char* filename, uint32_t size, bool startAfterUpload) {
+  if (strlen(filename) >= sizeof(_uploadName)) {
+    if (_debug) Serial.println("KlipperAPI: File name too long");
+    return false;
+  }
+  strcpy(_uploadName, filename);
+  
+  if (!_upload.begin(&file, _uploadName, size, startAfterUpload)) {
+    if (_debug) Serial.println("KlipperAPI: Invalid upload file name");
+    return false;
+  }
+  return true;
+}
+
+// POST the file as multipart/form-data. Only KAPI_WRITE_BUFFER_SIZE bytes
+// of it are in RAM at a time. The body cannot be read again, so it never
+// goes out on a kept-alive socket that may turn out to be closed.
+bool KlipperApi::uploadFile(Stream& file, const char* filename, uint32_t size, bool startAfterUpload) {
+  if (!prepareUpload(file, filename, size, startAfterUpload)) {
+    return false;
+  }
+  _upload.setIncremental(false);
+  
+  closeClient();
+  if (!beginRequest("POST", "/server/files/upload", nullptr, &_upload)) {
+    return false;
   }
+  endRequest();
   
-  // Calculate time left
-  if (printJob.progress > 0 && printJob.printTime > 0) {
-    float totalEstimated = printJob.printTime / printJob.progress;
-    printJob.timeLeft = (uint32_t)(totalEstimated - printJob.printTime);
+  if (_upload.failed()) {
+    if (_debug) Serial.println("KlipperAPI: Upload incomplete");
+    return false;
   }
   
-  return true;
+  if (_debug) {
+    Serial.print("KlipperAPI: Uploaded ");
+    Serial.print(_upload.progress.sent);
+    Serial.print(" bytes at ");
+    Serial.print(_upload.progress.bytesPerSecond);
+    Serial.println(" B/s");
+  }
+  
+  // Moonraker answers 201 Created
+  return (httpStatusCode == 201 || httpStatusCode == 200);
 }
+#endif
+
+#if KAPI_ENABLE_CONTROL
+// {"filename":"..."} body for /printer/print/start. The name is escaped
+// while it is written, so any path fits regardless of POSTDATA_SIZE.
+class PrintStartBody : public KlipperBodySource {
+public:
+  PrintStartBody(const char* filename) : _filename(filename), _length(strlen(filename)) {}
+  
+  // {"filename":"<escaped>"} is 15 bytes around the escaped name
+  uint32_t length() override {
+    return 15 + KlipperRequestWriter::jsonEscapedLength(_filename, _length);
+  }
+  
+  void writeTo(KlipperRequestWriter& out) override {
+    out.print("{\"filename\":\"");
+    out.printJsonEscaped(_filename, _length);
+    out.print("\"}");
+  }
+  
+private:
+  const char* _filename;
+  size_t _length;
+};
 
 // Start a print job
 bool KlipperApi::startPrint(const char* filename) {
-  char postData[POSTDATA_SIZE];
-  snprintf(postData, sizeof(postData), "{\"filename\":\"%s\"}", filename);
-  
-  String response = sendPostToMoonraker("/printer/print/start", postData);
+  PrintStartBody body(filename);
+  if (!beginRequest("POST", "/printer/print/start", nullptr, &body, true)) {
+    return false;
+  }
+  endRequest();
   return (httpStatusCode == 200);
 }
 
+#if KAPI_ENABLE_FILES
+// Start a file returned by the listing or metadata calls
+bool KlipperApi::startPrint(const KlipperFileInfo& file) {
+  if (file.isDirectory || file.truncated) {
+    if (_debug) Serial.println("KlipperAPI: Not a printable file");
+    return false;
+  }
+  return startPrint(file.name);
+}
+#endif
+
 // Pause current print
 bool KlipperApi::pausePrint() {
-  String response = sendPostToMoonraker("/printer/print/pause", "{}");
-  return (httpStatusCode == 200);
+  return postToMoonraker("/printer/print/pause", "{}");
 }
 
 // Resume paused print
 bool KlipperApi::resumePrint() {
-  String response = sendPostToMoonraker("/printer/print/resume", "{}");
-  return (httpStatusCode == 200);
+  return postToMoonraker("/printer/print/resume", "{}");
 }
 
 // Cancel current print
 bool KlipperApi::cancelPrint() {
-  String response = sendPostToMoonraker("/printer/print/cancel", "{}");
-  return (httpStatusCode == 200);
+  return postToMoonraker("/printer/print/cancel", "{}");
 }
 
 // Set extruder temperature
@@ -456,6 +2179,7 @@ bool KlipperApi::setFanSpeed(uint8_t speed, uint8_t fan) {
 
 // Home all axes
 bool KlipperApi::homeAll() {
+  noteMotionCommand();
   return sendGcode("G28");
 }
 
@@ -463,6 +2187,7 @@ bool KlipperApi::homeAll() {
 bool KlipperApi::homeAxis(char axis) {
   char gcode[16];
   snprintf(gcode, sizeof(gcode), "G28 %c", axis);
+  noteMotionCommand();
   return sendGcode(gcode);
 }
 
@@ -470,6 +2195,7 @@ bool KlipperApi::homeAxis(char axis) {
 bool KlipperApi::moveRelative(float x, float y, float z, float e, uint16_t feedrate) {
   char gcode[128];
   snprintf(gcode, sizeof(gcode), "G91\nG1 X%.2f Y%.2f Z%.2f E%.2f F%d\nG90", x, y, z, e, feedrate);
+  noteMotionCommand();
   return sendGcode(gcode);
 }
 
@@ -477,49 +2203,679 @@ bool KlipperApi::moveRelative(float x, float y, float z, float e, uint16_t feedr
 bool KlipperApi::moveAbsolute(float x, float y, float z, float e, uint16_t feedrate) {
   char gcode[128];
   snprintf(gcode, sizeof(gcode), "G90\nG1 X%.2f Y%.2f Z%.2f E%.2f F%d", x, y, z, e, feedrate);
+  noteMotionCommand();
   return sendGcode(gcode);
 }
 
 // Send G-code command
 bool KlipperApi::sendGcode(const char* gcode) {
-  char postData[POSTDATA_SIZE];
-  snprintf(postData, sizeof(postData), "{\"script\":\"%s\"}", gcode);
+#if KAPI_ENABLE_GCODE_QUEUE
+  if (_gcodeBatching) {
+    return queueGcode(gcode);
+  }
+#endif
   
-  String response = sendPostToMoonraker("/printer/gcode/script", postData);
-  return (httpStatusCode == 200);
+  KlipperScriptBody script(gcode, strlen(gcode));
+  return postGcodeScript(script);
 }
 
 // Send multiple G-code commands
 bool KlipperApi::sendGcodeMultiple(const char* gcodes[], uint8_t count) {
-  String script = "";
-  for (uint8_t i = 0; i < count; i++) {
-    if (i > 0) script += "\\n";
-    script += String(gcodes[i]);
+#if KAPI_ENABLE_GCODE_QUEUE
+  if (_gcodeBatching) {
+    bool ok = true;
+    for (uint8_t i = 0; i < count; i++) {
+      ok &= queueGcode(gcodes[i]);
+    }
+    return ok;
   }
+#endif
   
-  char postData[POSTDATA_SIZE];
-  snprintf(postData, sizeof(postData), "{\"script\":\"%s\"}", script.c_str());
-  
-  String response = sendPostToMoonraker("/printer/gcode/script", postData);
+  KlipperScriptBody script(gcodes, count);
+  return postGcodeScript(script);
+}
+
+// POST a script to /printer/gcode/script and wait for Klipper to run it
+bool KlipperApi::postGcodeScript(KlipperBodySource& script) {
+  if (!beginRequest("POST", "/printer/gcode/script", nullptr, &script, true)) {
+    return false;
+  }
+  endRequest();
   return (httpStatusCode == 200);
 }
+#endif
+
+#if KAPI_ENABLE_GCODE_QUEUE
+// Add a command to the G-code queue. A full queue is flushed first so no
+// command is dropped; a command larger than the whole queue is sent alone.
+bool KlipperApi::queueGcode(const char* gcode) {
+  size_t length = strlen(gcode);
+  if (length == 0) {
+    return true;
+  }
+  
+  bool ok = true;
+  if (_gcodeLength + length + 1 > sizeof(_gcodeQueue)) {
+    ok = flushGcode();
+    if (length + 1 > sizeof(_gcodeQueue)) {
+      KlipperScriptBody script(gcode, length);
+      return postGcodeScript(script) && ok;
+    }
+  }
+  
+  if (_gcodeCount == 0) {
+    _gcodeQueuedAt = millis();
+  }
+  if (_gcodeLength > 0) {
+    _gcodeQueue[_gcodeLength++] = '\n';
+  }
+  memcpy(_gcodeQueue + _gcodeLength, gcode, length);
+  _gcodeLength += length;
+  _gcodeCount++;
+  return ok;
+}
+
+// Send everything queued and wait for the result
+bool KlipperApi::flushGcode() {
+  // A batch in flight goes first so commands keep their order
+  while (isBusy()) {
+    poll();
+    delay(1);
+  }
+  
+  if (_gcodeCount == 0) {
+    return true;
+  }
+  
+  KlipperScriptBody script(_gcodeQueue, _gcodeLength);
+  _gcodeBatchLength = _gcodeLength;
+  bool ok = postGcodeScript(script);
+  finishGcodeBatch(ok);
+  
+  if (_gcodeCallback != nullptr) {
+    _gcodeCallback(*this, KAPI_REQUEST_GCODE_BATCH, ok);
+  }
+  return ok;
+}
+
+// Queued commands have waited long enough or fill a batch
+bool KlipperApi::gcodeFlushDue() {
+  if (_gcodeCount == 0 || _gcodeBatchLength > 0) {
+    return false;
+  }
+  return _gcodeLength >= KAPI_GCODE_FLUSH_SIZE || millis() - _gcodeQueuedAt >= KAPI_GCODE_FLUSH_DELAY;
+}
+
+// Drop the batch that was sent and move waiting commands to the front
+void KlipperApi::finishGcodeBatch(bool success) {
+  gcodeBatchCount++;
+  if (!success) {
+    gcodeBatchErrors++;
+  }
+  
+  if (_gcodeBatchLength < _gcodeLength) {
+    uint16_t start = _gcodeBatchLength + 1; // Skip the separating newline
+    memmove(_gcodeQueue, _gcodeQueue + start, _gcodeLength - start);
+    _gcodeLength -= start;
+  } else {
+    _gcodeLength = 0;
+    _gcodeCount = 0;
+  }
+  _gcodeBatchLength = 0;
+}
+#endif
 
 // Emergency stop
 bool KlipperApi::emergencyStop() {
-  String response = sendPostToMoonraker("/printer/emergency_stop", "{}");
-  return (httpStatusCode == 200);
+  invalidateCache();
+  return postToMoonraker("/printer/emergency_stop", "{}");
 }
 
+#if KAPI_ENABLE_CONTROL
 // Restart firmware
 bool KlipperApi::restartFirmware() {
-  String response = sendPostToMoonraker("/printer/restart", "{}");
-  return (httpStatusCode == 200);
+  invalidateCache();
+  return postToMoonraker("/printer/restart", "{}");
 }
 
 // Restart host
 bool KlipperApi::restartHost() {
-  String response = sendPostToMoonraker("/machine/reboot", "{}");
-  return (httpStatusCode == 200);
+  invalidateCache();
+  return postToMoonraker("/machine/reboot", "{}");
+}
+#endif
+
+#if KAPI_ENABLE_ASYNC
+
+// Non-blocking request states
+#define ASYNC_IDLE   0
+#define ASYNC_SEND   1   // Connect if needed and write the request
+#define ASYNC_HEAD   2   // Reading the response head as bytes arrive
+#define ASYNC_BODY   3   // Waiting until the body can be parsed without stalling
+#define ASYNC_UPLOAD 4   // Writing the file of an upload one chunk per poll()
+
+bool KlipperApi::beginGetPrinterInfo(KlipperRequestCallback callback) {
+  return beginAsync(KAPI_REQUEST_PRINTER_INFO, callback);
+}
+
+bool KlipperApi::beginGetPrinterStatistics(KlipperRequestCallback callback) {
+  return beginAsync(KAPI_REQUEST_PRINTER_STATISTICS, callback);
+}
+
+#if KAPI_ENABLE_SERVER_INFO
+bool KlipperApi::beginGetServerInfo(KlipperRequestCallback callback) {
+  return beginAsync(KAPI_REQUEST_SERVER_INFO, callback);
+}
+#endif
+
+#if KAPI_ENABLE_PRINT_JOB
+bool KlipperApi::beginGetPrintJob(KlipperRequestCallback callback) {
+  return beginAsync(KAPI_REQUEST_PRINT_JOB, callback);
+}
+#endif
+
+#if KAPI_ENABLE_MOTION
+bool KlipperApi::beginGetMotionLimits(KlipperRequestCallback callback) {
+  return beginAsync(KAPI_REQUEST_MOTION_LIMITS, callback);
+}
+#endif
+
+bool KlipperApi::beginRefresh(uint8_t mask, KlipperRequestCallback callback) {
+  if (isBusy()) {
+    return false;
+  }
+  _refreshMask = mask;
+  return beginAsync(KAPI_REQUEST_REFRESH, callback);
+}
+
+#if KAPI_ENABLE_SCHEDULER
+bool KlipperApi::beginUpdate(KlipperRequestCallback callback) {
+  uint8_t due = isBusy() ? 0 : updateDue();
+  if (due == 0) {
+    return false;
+  }
+  updateCount++;
+  return beginRefresh(due, callback);
+}
+#endif
+
+#if KAPI_ENABLE_CONTROL
+// Send G-code without waiting for Klipper to execute it
+bool KlipperApi::beginSendGcode(const char* gcode, KlipperRequestCallback callback) {
+  if (isBusy()) {
+    return false;
+  }
+  
+  // Escaped into the body when it is sent; refuse rather than truncate
+  if (strlen(gcode) >= sizeof(_asyncData)) {
+    if (_debug) Serial.println("KlipperAPI: G-code longer than POSTDATA_SIZE");
+    return false;
+  }
+  strcpy(_asyncData, gcode);
+  return beginAsync(KAPI_REQUEST_GCODE, callback);
+}
+#endif
+
+#if KAPI_ENABLE_UPLOAD
+bool KlipperApi::beginUploadFile(Stream& file, const char* filename, uint32_t size,
+                                 bool startAfterUpload, KlipperRequestCallback callback) {
+  if (_client == nullptr || isBusy() || !prepareUpload(file, filename, size, startAfterUpload)) {
+    return false;
+  }
+  _upload.setIncremental(true);
+  return beginAsync(KAPI_REQUEST_UPLOAD, callback);
+}
+#endif
+
+// Queue a request; nothing touches the network until the next poll()
+bool KlipperApi::beginAsync(uint8_t request, KlipperRequestCallback callback) {
+  if (_client == nullptr || isBusy()) {
+    return false;
+  }
+  
+  _asyncRequest = request;
+  _asyncCallback = callback;
+  _asyncState = ASYNC_SEND;
+  return true;
+}
+
+// Advance the request in flight. Each call only handles what the client
+// already has available, except for opening a new connection, which the
+// Client API does not offer without blocking. Keep-alive avoids that cost.
+void KlipperApi::poll() {
+#if KAPI_ENABLE_GCODE_QUEUE
+  // Queued G-code goes out as soon as the connection is free
+  // The batch is only taken out of the queue once it is on its way;
+  // otherwise the commands stay queued for the next try or flushGcode()
+  if (!isBusy() && gcodeFlushDue() && beginAsync(KAPI_REQUEST_GCODE_BATCH, _gcodeCallback)) {
+    _gcodeBatchLength = _gcodeLength;
+    _gcodeCount = 0;
+  }
+#endif
+  
+  switch (_asyncState) {
+    case ASYNC_SEND:
+      pollSend();
+      break;
+    case ASYNC_HEAD:
+      pollHead();
+      break;
+    case ASYNC_BODY:
+      pollBody();
+      break;
+#if KAPI_ENABLE_UPLOAD
+    case ASYNC_UPLOAD:
+      pollUpload();
+      break;
+#endif
+  }
+}
+
+// Abort the request in flight; its callback reports failure
+void KlipperApi::cancelRequest() {
+  if (isBusy()) {
+    failAsync();
+  }
+}
+
+void KlipperApi::pollSend() {
+  if (cacheFresh(_asyncRequest)) {
+    finishAsync(true);
+    return;
+  }
+  
+#if KAPI_ENABLE_FILES
+  if (_listing) {
+    abortFileList();
+  }
+#endif
+  
+  bool post = (_asyncRequest == KAPI_REQUEST_GCODE || _asyncRequest == KAPI_REQUEST_GCODE_BATCH);
+  const char* method = post ? "POST" : "GET";
+  char query[KAPI_QUERY_SIZE];
+  const char* endpoint = post ? "/printer/gcode/script" : queryEndpoint(_asyncRequest, query, sizeof(query));
+  KlipperBodySource* source = nullptr;
+#if KAPI_ENABLE_UPLOAD
+  if (_asyncRequest == KAPI_REQUEST_UPLOAD) {
+    // Never on a kept-alive socket, the file cannot be resent
+    method = "POST";
+    endpoint = "/server/files/upload";
+    source = &_upload;
+    closeClient();
+  }
+#endif
+  if (endpoint == nullptr || !requestAllowed(post)) {
+    finishAsync(false);
+    return;
+  }
+  
+  KAPI_METRICS(metrics.beginRequest(endpoint));
+  
+  _asyncReused = false;
+  if (_keepAlive && _client->connected()) {
+    _asyncReused = true;
+  } else {
+    closeClient();
+    if (!openConnection()) {
+      noteFailure();
+      failAsync();
+      return;
+    }
+  }
+  
+  if (_debug) {
+    Serial.print("KlipperAPI Request: ");
+    Serial.print(method);
+    Serial.print(' ');
+    Serial.println(endpoint);
+  }
+  
+  // The script is read from its buffer again if the request has to be resent
+  KlipperScriptBody script(_asyncData, strlen(_asyncData));
+#if KAPI_ENABLE_GCODE_QUEUE
+  if (_asyncRequest == KAPI_REQUEST_GCODE_BATCH) {
+    script = KlipperScriptBody(_gcodeQueue, _gcodeBatchLength);
+  }
+#endif
+  if (post) {
+    source = &script;
+  }
+  
+  httpStatusCode = 0;
+  KAPI_METRICS(metrics.startPhase(KAPI_PHASE_FIRST_BYTE));
+  if (!writeRequest(method, endpoint, nullptr, source)) {
+    if (_debug) Serial.println("KlipperAPI: Request write failed");
+    noteFailure();
+    failAsync();
+    return;
+  }
+  
+#if KAPI_ENABLE_UPLOAD
+  if (_asyncRequest == KAPI_REQUEST_UPLOAD) {
+    _asyncState = ASYNC_UPLOAD;
+    return;
+  }
+#endif
+  
+  _head.reset();
+  _asyncPhaseStart = millis();
+  _asyncState = ASYNC_HEAD;
+}
+
+// Waits up to KAPI_TIMEOUT for the first byte, then KAPI_HEADER_TIMEOUT
+// for the rest of the head
+void KlipperApi::pollHead() {
+  while (_client->available()) {
+    if (!_head.started()) {
+      _asyncPhaseStart = millis();
+      KAPI_METRICS(metrics.endPhase(KAPI_PHASE_FIRST_BYTE));
+    }
+    if (_head.feed((char)_client->read())) {
+      httpStatusCode = _head.statusCode;
+      _serverClose = _head.connectionClose;
+      if (_asyncReused) {
+        connectionReuseCount++;
+      }
+      noteSuccess();
+      KAPI_METRICS(metrics.startPhase(KAPI_PHASE_BODY));
+      
+      _body.begin(_client, _head, KAPI_BODY_TIMEOUT);
+      _asyncBody.begin(_client, _head);
+      _asyncAvailable = -1;
+      _asyncPhaseStart = millis();
+      _asyncState = ASYNC_BODY;
+      pollBody();
+      return;
+    }
+  }
+  
+  if (!_client->connected()) {
+    // Idle keep-alive socket closed by the server: resend once on a new one
+    if (_asyncReused && !_head.started()) {
+      if (_debug) Serial.println("KlipperAPI: Kept-alive connection closed by server, reconnecting");
+      closeClient();
+      reconnectCount++;
+      _asyncState = ASYNC_SEND;
+      return;
+    }
+    noteFailure();
+    failAsync();
+    return;
+  }
+  
+  unsigned long timeout = _head.started() ? KAPI_HEADER_TIMEOUT : KAPI_TIMEOUT;
+  if (millis() - _asyncPhaseStart >= timeout) {
+    if (_debug) Serial.println("KlipperAPI: Response timeout");
+    KAPI_METRICS(metrics.markTimeout());
+    noteFailure();
+    failAsync();
+  }
+}
+
+// The body is collected as it arrives, at most what the client already has
+// per call, and parsed from memory once it is complete, so poll() never
+// waits for the network. A body larger than KAPI_ASYNC_BODY_SIZE is parsed
+// once the client holds the rest, or after KAPI_ASYNC_STALL_TIME without
+// new bytes; the parse may then wait for the remainder.
+void KlipperApi::pollBody() {
+  unsigned long now = millis();
+  if (_asyncBody.collect()) {
+    _asyncPhaseStart = now;
+  }
+  
+  if (!_asyncBody.complete()) {
+    if (!_asyncBody.full()) {
+      if (now - _asyncPhaseStart >= KAPI_BODY_TIMEOUT) {
+        if (_debug) Serial.println("KlipperAPI: Response timeout");
+        KAPI_METRICS(metrics.markTimeout());
+        failAsync();
+      }
+      return;
+    }
+    
+    int available = _client->available();
+    bool complete = _asyncBody.remaining() >= 0 ? (available >= _asyncBody.remaining()) : !_client->connected();
+    if (!complete) {
+      if (available != _asyncAvailable) {
+        _asyncAvailable = available;
+        _asyncPhaseStart = now;
+        return;
+      }
+      if (available == 0) {
+        if (now - _asyncPhaseStart >= KAPI_BODY_TIMEOUT) {
+          if (_debug) Serial.println("KlipperAPI: Response timeout");
+          KAPI_METRICS(metrics.markTimeout());
+          failAsync();
+        }
+        return;
+      }
+      if (now - _asyncPhaseStart < KAPI_ASYNC_STALL_TIME) {
+        return;
+      }
+    }
+    asyncOverflowCount++;
+  }
+  _body.replay(_asyncBody.data(), _asyncBody.length());
+  
+  bool success = (httpStatusCode == 200);
+#if KAPI_ENABLE_UPLOAD
+  if (_asyncRequest == KAPI_REQUEST_UPLOAD) {
+    endRequest();
+    finishAsync(httpStatusCode == 201 || httpStatusCode == 200);
+    return;
+  }
+#endif
+  if (success && _asyncRequest != KAPI_REQUEST_GCODE && _asyncRequest != KAPI_REQUEST_GCODE_BATCH) {
+    StaticJsonDocument<KAPI_FILTER_SIZE> filter;
+    addQueryFilter(_asyncRequest, filter.to<JsonObject>());
+    JsonDocument& doc = jsonPool.acquire();
+    success = parseBody(doc, filter) && applyQueryResult(_asyncRequest, doc["result"]);
+    if (!success && jsonPool.outgrown()) {
+      // Ask again once the pool has grown, as getJsonFromMoonraker() does
+      endRequest();
+      _asyncState = ASYNC_SEND;
+      return;
+    }
+  }
+  
+  endRequest();
+  finishAsync(success);
+}
+
+#if KAPI_ENABLE_UPLOAD
+// Write the next chunk of the file, then wait for the response
+void KlipperApi::pollUpload() {
+  KlipperRequestWriter out(_client);
+  bool done = _upload.writeChunk(out);
+  bool ok = out.finish();
+  KAPI_METRICS(metrics.addBytes(out.bytesWritten(), 0));
+  
+  if (!ok || _upload.failed()) {
+    if (_debug) Serial.println("KlipperAPI: Upload incomplete");
+    failAsync();
+    return;
+  }
+  
+  if (done) {
+    _head.reset();
+    _asyncPhaseStart = millis();
+    _asyncState = ASYNC_HEAD;
+  }
+}
+#endif
+
+void KlipperApi::failAsync() {
+  KAPI_METRICS(metrics.markError(); metrics.finishRequest());
+  _body.end();
+  closeClient();
+  finishAsync(false);
+}
+
+// Return to idle before the callback so it can start the next request
+void KlipperApi::finishAsync(bool success) {
+  uint8_t request = _asyncRequest;
+  KlipperRequestCallback callback = _asyncCallback;
+  
+  _asyncState = ASYNC_IDLE;
+  _asyncRequest = KAPI_REQUEST_NONE;
+  _asyncCallback = nullptr;
+  
+#if KAPI_ENABLE_GCODE_QUEUE
+  if (request == KAPI_REQUEST_GCODE_BATCH) {
+    finishGcodeBatch(success);
+  }
+#endif
+  
+  if (callback != nullptr) {
+    callback(*this, request, success);
+  }
+}
+#endif
+
+#if KAPI_ENABLE_SUBSCRIPTION
+// Printer objects and fields pushed by the status subscription
+static const char subscribeRequest[] =
+  "{\"jsonrpc\":\"2.0\",\"method\":\"printer.objects.subscribe\",\"params\":{\"objects\":{"
+  "\"extruder\":[\"temperature\",\"target\",\"power\"],"
+  "\"heater_bed\":[\"temperature\",\"target\",\"power\"],"
+  "\"toolhead\":[\"position\",\"homed_axes\"],"
+  "\"print_stats\":[\"state\",\"filename\",\"print_duration\",\"total_duration\"],"
+  "\"gcode_move\":[\"speed_factor\",\"extrude_factor\"],"
+  "\"virtual_sdcard\":[\"progress\",\"file_size\"]}},\"id\":1}";
+
+static const char* const subscribedObjects[] = {
+  "extruder", "heater_bed", "toolhead", "print_stats", "gcode_move", "virtual_sdcard"
+};
+
+// Subscribe to printer status updates over the websocket
+bool KlipperApi::subscribeStatus(Client& wsClient, KlipperStatusCallback callback) {
+  _wsClient = &wsClient;
+  _statusCallback = callback;
+  return openSubscription();
+}
+
+// Close the websocket and stop receiving updates
+void KlipperApi::unsubscribeStatus() {
+  if (_wsClient != nullptr) {
+    _ws.close();
+    _wsClient = nullptr;
+  }
+}
+
+bool KlipperApi::isSubscribed() {
+  return _wsClient != nullptr && _ws.connected();
+}
+
+// Connect, upgrade to a websocket and send printer.objects.subscribe
+bool KlipperApi::openSubscription() {
+  _wsLastAttempt = millis();
+  
+  if (_wsClient->connected()) {
+    _wsClient->stop();
+  }
+  
+  if (!connectClient(_wsClient)) {
+    if (_debug) Serial.println("KlipperAPI: Websocket connection failed");
+    return false;
+  }
+  
+  if (!_ws.begin(_wsClient, "/websocket", _hostHeader, _hasApiKey ? _apiKeyHeader : nullptr, KAPI_TIMEOUT)) {
+    if (_debug) Serial.println("KlipperAPI: Websocket upgrade failed");
+    _ws.close();
+    return false;
+  }
+  
+  // The reply carries the full current state, later notifications only deltas
+  if (!_ws.sendText(subscribeRequest, sizeof(subscribeRequest) - 1)) {
+    _ws.close();
+    return false;
+  }
+  
+  return true;
+}
+
+// Process received websocket messages, reconnecting if the socket dropped
+void KlipperApi::handleSubscription() {
+  if (_wsClient == nullptr) {
+    return;
+  }
+  
+  if (!_ws.connected()) {
+    if (millis() - _wsLastAttempt >= KAPI_WS_RETRY_INTERVAL) {
+      openSubscription();
+    }
+    return;
+  }
+  
+  // Bounded so a busy printer cannot starve the rest of loop()
+  for (uint8_t i = 0; i < KAPI_WS_MAX_MESSAGES && _ws.nextMessage(); i++) {
+    handleSubscriptionMessage();
+  }
+}
+
+// Merge one JSON-RPC message into printerStats and printJob
+void KlipperApi::handleSubscriptionMessage() {
+  // Keep the method name, the subscribe reply and status deltas only;
+  // other notifications (proc stats, gcode responses) reduce to nothing.
+  StaticJsonDocument<KAPI_FILTER_SIZE> filter;
+  filter["method"] = true;
+  filter["result"]["status"] = true;
+  JsonObject paramFields = filter.createNestedArray("params").createNestedObject();
+  for (uint8_t i = 0; i < sizeof(subscribedObjects) / sizeof(subscribedObjects[0]); i++) {
+    paramFields[subscribedObjects[i]] = true;
+  }
+  
+  JsonDocument& doc = jsonPool.acquire();
+  DeserializationError error = deserializeJson(doc, _ws.payload(), DeserializationOption::Filter(filter));
+  jsonPool.release();
+  _ws.endMessage();
+  
+  if (error) {
+    if (_debug) {
+      Serial.print("KlipperAPI: Websocket message parse failed: ");
+      Serial.println(error.c_str());
+    }
+    return;
+  }
+  
+  JsonObject status;
+  const char* method = doc["method"];
+  if (method == nullptr) {
+    status = doc["result"]["status"];
+  } else if (strcmp(method, "notify_status_update") == 0) {
+    status = doc["params"][0];
+  } else if (strcmp(method, "notify_klippy_ready") == 0) {
+    // Subscriptions do not survive a Klipper restart
+    invalidateCache();
+    _ws.sendText(subscribeRequest, sizeof(subscribeRequest) - 1);
+    return;
+  } else if (strcmp(method, "notify_klippy_shutdown") == 0 || strcmp(method, "notify_klippy_disconnected") == 0) {
+    invalidateCache();
+    return;
+  }
+  
+  if (status.isNull()) {
+    return;
+  }
+  
+  uint16_t changed = applyPrinterStatus(status);
+#if KAPI_ENABLE_PRINT_JOB
+  changed |= applyPrintJobStatus(status);
+#endif
+#if KAPI_ENABLE_OBJECTS
+  applyObjectStatus(status);
+#endif
+  statusUpdateCount++;
+  
+  if (changed != 0 && _statusCallback != nullptr) {
+    _statusCallback(*this, changed);
+  }
+}
+#endif
+
+// Compare the fields of two temperature readings
+bool KlipperApi::sameTemperature(const TemperatureData& a, const TemperatureData& b) {
+  return a.current == b.current && a.target == b.target && a.power == b.power;
 }
 
 // Helper function to parse temperature data
@@ -539,27 +2895,72 @@ bool KlipperApi::parseTemperatureData(JsonObject& obj, TemperatureData& tempData
   return true;
 }
 
-// Parse printer state string into bit flags
-void KlipperApi::parsePrinterState(const char* stateStr, PrinterStateFlags& flags) {
-  // Reset all flags
-  flags.ready = 0;
-  flags.error = 0;
-  flags.paused = 0;
-  flags.printing = 0;
-  flags.standby = 0;
-  flags.shutdown = 0;
-  flags.startup = 0;
-  
-  String state = String(stateStr);
-  state.toLowerCase();
-  
-  if (state == "ready") flags.ready = 1;
-  else if (state == "error") flags.error = 1;
-  else if (state == "paused") flags.paused = 1;
-  else if (state == "printing") flags.printing = 1;
-  else if (state == "standby") flags.standby = 1;
-  else if (state == "shutdown") flags.shutdown = 1;
-  else if (state == "startup") flags.startup = 1;
+// Names indexed by KlipperState
+static const char* const stateNames[] = {
+  "", "ready", "startup", "shutdown", "error",
+  "standby", "printing", "paused", "complete", "cancelled"
+};
+
+// Classify a state by its length and first and last characters, which
+// tell all known states apart, then confirm with a single compare
+KlipperState KlipperApi::decodeState(const char* state) {
+  if (state == nullptr || state[0] == '\0') {
+    return KAPI_STATE_UNKNOWN;
+  }
+  // Case-insensitive, as the String based parser was; | 0x20 lowercases a
+  // letter, and anything else is ruled out by the comparison below
+  size_t length = strlen(state);
+  char first = state[0] | 0x20;
+  char last = state[length - 1] | 0x20;
+  
+  KlipperState candidate = KAPI_STATE_UNKNOWN;
+  switch (length) {
+    case 5:
+      if (first == 'r') candidate = KAPI_STATE_READY;
+      else if (first == 'e') candidate = KAPI_STATE_ERROR;
+      break;
+    case 6:
+      if (first == 'p') candidate = KAPI_STATE_PAUSED;
+      break;
+    case 7:
+      if (last == 'p') candidate = KAPI_STATE_STARTUP;
+      else if (last == 'y') candidate = KAPI_STATE_STANDBY;
+      break;
+    case 8:
+      if (first == 's') candidate = KAPI_STATE_SHUTDOWN;
+      else if (first == 'p') candidate = KAPI_STATE_PRINTING;
+      else if (first == 'c') candidate = KAPI_STATE_COMPLETE;
+      break;
+    case 9:
+      if (first == 'c') candidate = KAPI_STATE_CANCELLED;
+      break;
+  }
+  
+  if (candidate != KAPI_STATE_UNKNOWN && strcasecmp(state, stateNames[candidate]) != 0) {
+    candidate = KAPI_STATE_UNKNOWN;
+  }
+  return candidate;
+}
+
+const char* KlipperApi::stateName(KlipperState state) {
+  return state <= KAPI_STATE_CANCELLED ? stateNames[state] : "";
+}
+
+// Set the printer state flags from a decoded state
+void KlipperApi::parsePrinterState(KlipperState state, PrinterStateFlags& flags) {
+  flags.ready = (state == KAPI_STATE_READY);
+  flags.error = (state == KAPI_STATE_ERROR);
+  flags.paused = (state == KAPI_STATE_PAUSED);
+  flags.printing = (state == KAPI_STATE_PRINTING);
+  flags.standby = (state == KAPI_STATE_STANDBY);
+  flags.shutdown = (state == KAPI_STATE_SHUTDOWN);
+  flags.startup = (state == KAPI_STATE_STARTUP);
+}
+
+// Copy a JSON string into a fixed field, truncating if needed
+void KlipperApi::copyField(char* dest, size_t size, const char* value) {
+  strncpy(dest, value, size - 1);
+  dest[size - 1] = '\0';
 }
 
 // Validate temperature value
@@ -16,12 +16,145 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include <Client.h>
+#include "KlipperConfig.h"
+#include "KlipperHttp.h"
+#include "KlipperJsonPool.h"
+#include "KlipperMetrics.h"
+#include "KlipperHealth.h"
+#if KAPI_ENABLE_SUBSCRIPTION
+#include "KlipperWebsocket.h"
+#endif
 
 #define KAPI_TIMEOUT       5000
+#define KAPI_HEADER_TIMEOUT 2000   // Rest of the response head after its first byte
+#define KAPI_BODY_TIMEOUT   2000   // Longest gap between two body bytes
+#ifndef POSTDATA_SIZE
 #define POSTDATA_SIZE      256
+#endif
 #define POSTDATA_GCODE_SIZE 128
+#ifndef JSONDOCUMENT_SIZE
 #define JSONDOCUMENT_SIZE  2048
+#endif
+#ifndef KAPI_JSON_POOL_MAX
+#define KAPI_JSON_POOL_MAX (JSONDOCUMENT_SIZE * 4)  // Largest size the response document grows to
+#endif
+#define KAPI_FILTER_SIZE   JSON_OBJECT_SIZE(24)  // Response field filters
 #define USER_AGENT         "KlipperAPI/1.0.0 (Arduino)"
+#define KAPI_HOST_HEADER_SIZE   80   // "Host: <host>:<port>\r\n"
+#define KAPI_HOST_NAME_SIZE     64   // Hostname kept for connecting
+#ifndef KAPI_DNS_TTL
+#define KAPI_DNS_TTL            300000 // ms a resolved address is reused, 0 lets the client resolve
+#endif
+#define KAPI_DNS_RETRY          10000  // ms before a failed lookup is tried again
+#define KAPI_PREWARM_LEAD       1000   // ms before an update is due that prewarm() connects
+#define KAPI_APIKEY_HEADER_SIZE 64   // "X-Api-Key: <key>\r\n"
+#define KAPI_WS_RETRY_INTERVAL  5000 // Delay between websocket reconnect attempts
+#define KAPI_WS_MAX_MESSAGES    4    // Messages handled per handleSubscription() call
+#define KAPI_ASYNC_STALL_TIME   20   // ms without new bytes before parsing a body larger than KAPI_ASYNC_BODY_SIZE
+#ifndef KAPI_QUERY_SIZE
+#define KAPI_QUERY_SIZE         384  // Longest /printer/objects/query built by refresh()
+#endif
+#ifndef KAPI_GCODE_QUEUE_SIZE
+#define KAPI_GCODE_QUEUE_SIZE   512  // Queued G-code bytes, including a batch in flight
+#endif
+#define KAPI_GCODE_FLUSH_SIZE   256  // Queued bytes that make poll() send a batch
+#define KAPI_GCODE_FLUSH_DELAY  50   // ms a queued command waits for more before poll() sends it
+#ifndef KAPI_CACHE_TTL
+#define KAPI_CACHE_TTL          60000 // ms a static endpoint result is served without a request, 0 disables
+#endif
+#define KAPI_CACHE_SLOTS        3    // Printer info, server info and motion limits
+
+// update() intervals in ms, see updateInterval()
+#ifndef KAPI_POLL_FAST
+#define KAPI_POLL_FAST          2000   // Heating, printing or moving
+#endif
+#ifndef KAPI_POLL_NORMAL
+#define KAPI_POLL_NORMAL        10000  // Holding temperature, state
+#endif
+#ifndef KAPI_POLL_IDLE
+#define KAPI_POLL_IDLE          60000  // Nothing happening
+#endif
+#ifndef KAPI_POLL_STATE
+#define KAPI_POLL_STATE         20000  // State while idle, bounds how late a print start is seen
+#endif
+#ifndef KAPI_POLL_STATIC
+#define KAPI_POLL_STATIC        600000 // Motion limits
+#endif
+#define KAPI_POLL_HEATING_BAND  2.0    // Degrees from target that count as heating
+#define KAPI_POLL_PROGRESS_STEP 0.001  // Progress change the job is polled for (0.1%)
+#define KAPI_POLL_MOTION_WINDOW 10000  // ms position stays fast after a move or home command
+#define KAPI_UPDATE_GROUPS      6      // KAPI_REFRESH_* flags scheduled by update()
+#define KAPI_FILE_NAME_SIZE     64     // File path below the gcodes root
+#ifndef KAPI_OBJECT_MAX
+#define KAPI_OBJECT_MAX         16     // Heaters, fans and sensors kept by discoverObjects()
+#endif
+#ifndef KAPI_OBJECT_ARENA_SIZE
+#define KAPI_OBJECT_ARENA_SIZE  256    // Bytes for their names
+#endif
+#define KAPI_OBJECT_SLOTS       (KAPI_OBJECT_MAX * 2)  // Name hash index
+#define KAPI_OBJECT_NAME_SIZE   48     // Longest object name discovered
+
+// Data selected by refresh(mask)
+#define KAPI_REFRESH_TEMPERATURES 0x01   // Extruder and bed temperatures
+#define KAPI_REFRESH_POSITION     0x02   // Toolhead position and homed axes
+#define KAPI_REFRESH_STATE        0x04   // Printer state
+#define KAPI_REFRESH_FACTORS      0x08   // Speed and flow factors
+#define KAPI_REFRESH_JOB          0x10   // Print job, progress and times
+#define KAPI_REFRESH_MOTION       0x20   // Motion limits
+#define KAPI_REFRESH_STATISTICS   0x0F   // Everything in printerStats
+#define KAPI_REFRESH_ALL          0x3F
+
+// Calls combined by refreshBatch()
+#define KAPI_BATCH_STATUS         0x01   // printer.objects.query for the refresh mask
+#define KAPI_BATCH_PRINTER_INFO   0x02   // printer.info
+#define KAPI_BATCH_SERVER_INFO    0x04   // server.info
+#define KAPI_BATCH_JOB_QUEUE      0x08   // server.job_queue.status
+#define KAPI_BATCH_HISTORY        0x10   // server.history.list, newest job only
+#define KAPI_BATCH_ALL            0x1F
+
+// Requests started with the begin*() methods
+#define KAPI_REQUEST_NONE               0
+#define KAPI_REQUEST_PRINTER_INFO       1
+#define KAPI_REQUEST_PRINTER_STATISTICS 2
+#define KAPI_REQUEST_SERVER_INFO        3
+#define KAPI_REQUEST_PRINT_JOB          4
+#define KAPI_REQUEST_GCODE              5
+#define KAPI_REQUEST_REFRESH            6
+#define KAPI_REQUEST_GCODE_BATCH        7
+#define KAPI_REQUEST_MOTION_LIMITS      8
+#define KAPI_REQUEST_UPLOAD             9
+
+// Kinds of discovered printer objects
+#define KAPI_OBJECT_HEATER      0   // extruder*, heater_bed, heater_generic
+#define KAPI_OBJECT_SENSOR      1   // temperature_sensor
+#define KAPI_OBJECT_FAN         2   // fan, fan_generic, heater_fan, controller_fan
+#define KAPI_OBJECT_TEMP_FAN    3   // temperature_fan
+
+// Change flags reported to a KlipperStatusCallback
+#define KAPI_CHANGED_EXTRUDER   0x0001
+#define KAPI_CHANGED_BED        0x0002
+#define KAPI_CHANGED_POSITION   0x0004
+#define KAPI_CHANGED_HOMED      0x0008
+#define KAPI_CHANGED_STATE      0x0010
+#define KAPI_CHANGED_FACTORS    0x0020
+#define KAPI_CHANGED_JOB        0x0040   // Filename or job state
+#define KAPI_CHANGED_PROGRESS   0x0080   // Progress or print time
+
+// Klipper and print job states, decoded from Moonraker's strings without
+// copying them. Klipper reports ready/startup/shutdown/error, print_stats
+// standby/printing/paused/complete/cancelled/error.
+typedef enum : uint8_t {
+  KAPI_STATE_UNKNOWN = 0,
+  KAPI_STATE_READY,
+  KAPI_STATE_STARTUP,
+  KAPI_STATE_SHUTDOWN,
+  KAPI_STATE_ERROR,
+  KAPI_STATE_STANDBY,
+  KAPI_STATE_PRINTING,
+  KAPI_STATE_PAUSED,
+  KAPI_STATE_COMPLETE,
+  KAPI_STATE_CANCELLED
+} KlipperState;
 
 // Printer state flags using bit fields for memory efficiency
 typedef struct {
@@ -45,11 +178,11 @@ typedef struct {
 // Printer statistics structure
 typedef struct {
   char state[16];                    // Current printer state string
+  KlipperState stateId;              // The same state as a byte
   PrinterStateFlags stateFlags;      // Bit flags for quick state checking
   
   // Temperature data
   TemperatureData extruder;          // Primary extruder
-  TemperatureData extruder1;         // Secondary extruder (if available)
   TemperatureData heatedBed;         // Heated bed
   
   // Position data (in mm)
@@ -64,16 +197,17 @@ typedef struct {
   
   // Available tools flags
   uint8_t hasExtruder     : 1;
-  uint8_t hasExtruder1    : 1;
   uint8_t hasHeatedBed    : 1;
   uint8_t isHomed         : 1;
-  uint8_t reserved        : 4;       // For future use
+  uint8_t reserved        : 5;       // For future use
 } PrinterStatistics;
 
+#if KAPI_ENABLE_PRINT_JOB
 // Print job information
 typedef struct {
   char filename[64];                 // Current print filename
   char state[16];                    // Print job state
+  KlipperState stateId;              // The same state as a byte
   float progress;                    // Progress 0.0-1.0
   uint32_t printTime;                // Current print time in seconds
   uint32_t estimatedTime;            // Estimated total time in seconds
@@ -91,7 +225,9 @@ typedef struct {
   uint8_t hasError       : 1;
   uint8_t reserved       : 3;        // For future use
 } PrintJobInfo;
+#endif
 
+#if KAPI_ENABLE_SERVER_INFO
 // Moonraker server information
 typedef struct {
   char klipperVersion[32];
@@ -99,18 +235,81 @@ typedef struct {
   char hostname[32];
   uint16_t port;
 } ServerInfo;
+#endif
+
+#if KAPI_ENABLE_BATCH
+// Moonraker's job queue, needs [job_queue] in moonraker.conf
+typedef struct {
+  char state[16];                    // ready, loading, starting or paused
+  uint8_t queuedJobs;                // Jobs waiting, at most 255
+  char nextFilename[64];             // First job waiting, "" if none
+} JobQueueInfo;
+
+// Newest entry of Moonraker's print history
+typedef struct {
+  char filename[64];
+  char status[16];                   // in_progress, completed, cancelled, error, ...
+  uint32_t startTime;                // Unix time
+  uint32_t printDuration;            // Seconds spent printing
+  uint32_t totalDuration;            // Seconds including pauses
+  float filamentUsed;                // mm
+} LastJobInfo;
+#endif
+
+#if KAPI_ENABLE_FILES
+// One entry of a G-code directory listing
+typedef struct {
+  char name[KAPI_FILE_NAME_SIZE];    // Path below the gcodes root, as startPrint() takes it
+  uint32_t size;                     // File size in bytes
+  uint32_t modified;                 // Unix time
+  uint32_t estimatedTime;            // Slicer estimate in seconds, 0 if unknown
+  uint8_t isDirectory    : 1;
+  uint8_t truncated      : 1;        // Path longer than name; cannot be printed
+  uint8_t reserved       : 6;
+} KlipperFileInfo;
+
+// Return false to leave a file out of listFiles()/listRecentFiles()
+typedef bool (*KlipperFileFilter)(const KlipperFileInfo& file);
+#endif
 
+#if KAPI_ENABLE_MOTION
 // Motion system information
 typedef struct {
-  float maxVelocity;
+  char kinematics[16];               // From [printer] in printer.cfg
+  float maxVelocity;                 // Current limits, SET_VELOCITY_LIMIT changes them
   float maxAcceleration;
   float squareCornerVelocity;
+  float maxZVelocity;
+  float maxZAcceleration;
   
   // Axis limits (min, max)
   float xMin, xMax;
   float yMin, yMax;
   float zMin, zMax;
 } MotionLimits;
+#endif
+
+#if KAPI_ENABLE_OBJECTS
+// A heater, fan or sensor found by discoverObjects()
+typedef struct {
+  uint16_t name;                     // Offset of the object name in the name arena
+  uint8_t kind;                      // KAPI_OBJECT_*
+  float temperature;                 // °C, heaters, sensors and temperature fans
+  float target;                      // °C, heaters and temperature fans
+  float value;                       // Heater power or fan speed, 0.0-1.0
+} KlipperObject;
+#endif
+
+class KlipperApi;
+
+// Called after a status update changed printerStats or printJob
+typedef void (*KlipperStatusCallback)(KlipperApi& api, uint16_t changed);
+
+// Called when a request started with a begin*() method has finished
+typedef void (*KlipperRequestCallback)(KlipperApi& api, uint8_t request, bool success);
+
+// Looks up host; true with ip set on success
+typedef bool (*KlipperResolver)(const char* host, IPAddress& ip);
 
 class KlipperApi {
 public:
@@ -122,19 +321,97 @@ public:
   void init(Client &client, IPAddress moonrakerIp, uint16_t moonrakerPort, const char* apiKey = nullptr);
   void init(Client &client, const char *moonrakerHost, uint16_t moonrakerPort, const char* apiKey = nullptr);
   
+  // Connection management
+  void setKeepAlive(bool enable);     // Reuse one HTTP/1.1 connection across requests
+  bool getKeepAlive() const { return _keepAlive; }
+  
+  // Hostname mode: the address is looked up through the resolver (on
+  // ESP32/ESP8266 WiFi.hostByName() by default) and reused for ttl ms.
+  // A failed connect looks it up again. Without a resolver, or with a ttl
+  // of 0, the hostname is passed to the client on every connect.
+  void setResolver(KlipperResolver resolver) { _resolver = resolver; _hostResolved = false; }
+  void setDnsTtl(unsigned long ttl) { _dnsTtl = ttl; }
+  // Refresh a stale address and, in keep-alive mode, open the connection
+  // for the next request, so neither lands on that request. With the
+  // scheduler it only connects once an update is due within lead ms.
+  // Returns true if a connection is open.
+  bool prewarm(unsigned long lead = KAPI_PREWARM_LEAD);
+#if defined(ESP32) || defined(ESP8266)
+  // The default resolver
+  static bool hostByName(const char* host, IPAddress& ip);
+#endif
+  
+#if KAPI_ENABLE_STRING_API
   // Basic communication methods
   String sendGetToMoonraker(const char* endpoint);
   String sendPostToMoonraker(const char* endpoint, const char* postData);
   String getMoonrakerEndpointResults(const char* endpoint);
+#endif
   
   // Printer information and status
   bool getPrinterInfo();
   bool getPrinterStatistics();
+#if KAPI_ENABLE_SERVER_INFO
   bool getServerInfo();
+#endif
   
-  // Print job management
+#if KAPI_ENABLE_PRINT_JOB
   bool getPrintJob();
+#endif
+  
+#if KAPI_ENABLE_OBJECTS
+  // Find the heaters, fans and temperature sensors the printer has, from
+  // /printer/objects/list. Run once after Klipper is ready; up to
+  // KAPI_OBJECT_MAX are kept.
+  bool discoverObjects();
+  // Query every discovered object in one request and store the values
+  bool refreshObjects();
+  
+  uint8_t objectCount() const { return _objectCount; }
+  const KlipperObject& object(uint8_t id) const { return _objects[id]; }
+  const char* objectName(uint8_t id) const { return _objectNames + _objects[id].name; }
+  // Object by its Klipper name, e.g. "heater_generic chamber"; nullptr if
+  // it was not discovered. Hashed, so the cost does not grow with the table.
+  const KlipperObject* findObject(const char* name) const;
+#endif
+  
+#if KAPI_ENABLE_FILES
+  // G-code files of a directory below the gcodes root ("" for the root),
+  // parsed off the connection one entry at a time, so memory use does not
+  // depend on the number of files. Subdirectories come first with
+  // isDirectory set. The listing holds the connection: until nextFile()
+  // returns false or closeFileList() is called, another request aborts it.
+  bool openFileList(const char* directory = "");
+  bool nextFile(KlipperFileInfo& file);
+  void closeFileList();
+  
+  // Up to count entries passing filter, after skipping offset of them.
+  // Returns the number filled.
+  uint16_t listFiles(KlipperFileInfo* files, uint16_t count, uint16_t offset = 0,
+                     const char* directory = "", KlipperFileFilter filter = nullptr);
+  // The count most recently modified files, newest first, in one pass
+  uint16_t listRecentFiles(KlipperFileInfo* files, uint16_t count,
+                           const char* directory = "", KlipperFileFilter filter = nullptr);
+  // Size, modified and estimated time of one file
+  bool getFileMetadata(const char* filename, KlipperFileInfo& file);
+#endif
+  
+#if KAPI_ENABLE_UPLOAD
+  // Upload size bytes from file (an SD, SPIFFS or LittleFS File) as
+  // filename below the gcodes root, optionally printing it once stored.
+  // The file is streamed in chunks; size must be exact.
+  bool uploadFile(Stream& file, const char* filename, uint32_t size, bool startAfterUpload = false);
+  // Called after every chunk written, in both blocking and non-blocking mode
+  void setUploadCallback(KlipperUploadCallback callback) { _upload.setCallback(callback); }
+  const KlipperUploadProgress& uploadProgress() const { return _upload.progress; }
+#endif
+  
+#if KAPI_ENABLE_CONTROL
+  // Print job management
   bool startPrint(const char* filename);
+#if KAPI_ENABLE_FILES
+  bool startPrint(const KlipperFileInfo& file);
+#endif
   bool pausePrint();
   bool resumePrint();
   bool cancelPrint();
@@ -153,43 +430,385 @@ public:
   // G-code execution
   bool sendGcode(const char* gcode);
   bool sendGcodeMultiple(const char* gcodes[], uint8_t count);
+#endif
+  
+#if KAPI_ENABLE_GCODE_QUEUE
+  // G-code queue: commands are collected and sent as one script. poll()
+  // sends a batch once KAPI_GCODE_FLUSH_SIZE bytes or KAPI_GCODE_FLUSH_DELAY
+  // ms have accumulated; flushGcode() sends immediately and waits.
+  bool queueGcode(const char* gcode);
+  bool flushGcode();
+  uint8_t queuedGcodeCount() const { return _gcodeCount; }
+  // Route sendGcode() and the helpers built on it through the queue
+  void setGcodeBatching(bool enable) { _gcodeBatching = enable; }
+  // Called with KAPI_REQUEST_GCODE_BATCH once per batch sent
+  void setGcodeCallback(KlipperRequestCallback callback) { _gcodeCallback = callback; }
+#endif
   
   // Emergency controls
   bool emergencyStop();
+#if KAPI_ENABLE_CONTROL
   bool restartFirmware();
   bool restartHost();
+#endif
   
+#if KAPI_ENABLE_MOTION
   // System information
   bool getMotionLimits();
+#endif
+  
+  // getPrinterInfo(), getServerInfo() and getMotionLimits() answer from
+  // their last result for ttl ms instead of asking Moonraker again. Klipper
+  // restarts and state changes drop the cached results. 0 disables caching.
+  void setCacheTtl(unsigned long ttl);
+  void invalidateCache();
+  
+  // Fill printerStats, printJob and motionLimits from one query. mask is a
+  // combination of KAPI_REFRESH_* flags; only those fields are requested.
+  bool refresh(uint8_t mask = KAPI_REFRESH_ALL);
+  
+#if KAPI_ENABLE_BATCH
+  // Send several KAPI_BATCH_* calls as one JSON-RPC batch to
+  // /server/jsonrpc and store each result where its own request would.
+  // KAPI_BATCH_STATUS queries the KAPI_REFRESH_* groups in mask. Returns
+  // the calls that succeeded; cached results count without being sent.
+  uint8_t refreshBatch(uint8_t calls = KAPI_BATCH_ALL, uint8_t mask = KAPI_REFRESH_ALL);
+#endif
+  
+#if KAPI_ENABLE_SCHEDULER
+  // Adaptive polling: call update() from loop(). Each KAPI_REFRESH_* group
+  // has its own interval, depending on what the printer is doing, and all
+  // groups that are due (or nearly) go out as one refresh(). Returns the
+  // groups refreshed, 0 if nothing was due or the request failed.
+  uint8_t update();
+  // Groups update() would refresh now
+  uint8_t updateDue();
+  // Groups update() manages, KAPI_REFRESH_ALL by default
+  void setUpdateMask(uint8_t mask) { _updateMask = mask; }
+  // Current interval of one KAPI_REFRESH_* group in ms
+  unsigned long updateInterval(uint8_t group);
+  // ms until update() has something to do, 0 if it has now
+  unsigned long nextUpdateIn();
+#endif
+  
+  // State string to KlipperState and back, without heap use
+  static KlipperState decodeState(const char* state);
+  static const char* stateName(KlipperState state);
+  
+#if KAPI_ENABLE_ASYNC
+  // Non-blocking requests: begin*() returns at once, poll() from loop()
+  // advances the request and the callback reports the result. One request
+  // is in flight at a time; a blocking call cancels it.
+  bool beginGetPrinterInfo(KlipperRequestCallback callback = nullptr);
+  bool beginGetPrinterStatistics(KlipperRequestCallback callback = nullptr);
+#if KAPI_ENABLE_SERVER_INFO
+  bool beginGetServerInfo(KlipperRequestCallback callback = nullptr);
+#endif
+#if KAPI_ENABLE_PRINT_JOB
+  bool beginGetPrintJob(KlipperRequestCallback callback = nullptr);
+#endif
+#if KAPI_ENABLE_MOTION
+  bool beginGetMotionLimits(KlipperRequestCallback callback = nullptr);
+#endif
+  bool beginRefresh(uint8_t mask = KAPI_REFRESH_ALL, KlipperRequestCallback callback = nullptr);
+#if KAPI_ENABLE_SCHEDULER
+  // update() without blocking; false if nothing is due or a request is in flight
+  bool beginUpdate(KlipperRequestCallback callback = nullptr);
+#endif
+#if KAPI_ENABLE_CONTROL
+  bool beginSendGcode(const char* gcode, KlipperRequestCallback callback = nullptr);
+#endif
+#if KAPI_ENABLE_UPLOAD
+  // Each poll() writes one KAPI_UPLOAD_CHUNK_SIZE chunk. file must stay
+  // open until the callback runs.
+  bool beginUploadFile(Stream& file, const char* filename, uint32_t size,
+                       bool startAfterUpload = false, KlipperRequestCallback callback = nullptr);
+#endif
+  void poll();
+  bool isBusy() const { return _asyncState != 0; }
+  void cancelRequest();
+#endif
+  
+#if KAPI_ENABLE_SUBSCRIPTION
+  // Push updates over Moonraker's websocket instead of polling. Needs its
+  // own Client; call handleSubscription() from loop().
+  bool subscribeStatus(Client& wsClient, KlipperStatusCallback callback = nullptr);
+  void unsubscribeStatus();
+  void handleSubscription();
+  bool isSubscribed();
+#endif
   
   // Data structures (public for easy access)
   PrinterStatistics printerStats;
+#if KAPI_ENABLE_PRINT_JOB
   PrintJobInfo printJob;
+#endif
+#if KAPI_ENABLE_SERVER_INFO
   ServerInfo serverInfo;
+#endif
+#if KAPI_ENABLE_MOTION
   MotionLimits motionLimits;
+#endif
+#if KAPI_ENABLE_BATCH
+  JobQueueInfo jobQueue;
+  LastJobInfo lastJob;
+#endif
   
   // Status and debugging
   bool _debug = false;
   int httpStatusCode = 0;
+#if KAPI_ENABLE_STRING_API
   String httpErrorBody = "";
+#endif
+  
+  // Request writer diagnostics
+  uint32_t requestCount = 0;         // Requests written to the client
+  uint32_t requestHeapAllocs = 0;    // Requests whose construction allocated heap (ESP only)
+  
+  // Document every response is parsed into, see KlipperJsonPool.h
+  KlipperJsonPool jsonPool{JSONDOCUMENT_SIZE, KAPI_JSON_POOL_MAX};
+  
+#if KAPI_ENABLE_METRICS
+  // Per endpoint counters and latencies, see KlipperMetrics.h
+  KlipperMetrics metrics;
+#endif
+  
+#if KAPI_ENABLE_HEALTH
+  // Circuit breaker for an unreachable printer, see KlipperHealth.h
+  KlipperHealth health;
+#endif
+  
+#if KAPI_ENABLE_SUBSCRIPTION
+  // Status updates merged from the websocket subscription
+  uint32_t statusUpdateCount = 0;
+#endif
+  
+#if KAPI_ENABLE_GCODE_QUEUE
+  // G-code queue statistics
+  uint32_t gcodeBatchCount = 0;      // Batches sent from the queue
+  uint32_t gcodeBatchErrors = 0;     // Batches Moonraker did not accept
+#endif
+#if KAPI_ENABLE_ASYNC
+  uint32_t asyncOverflowCount = 0;   // Non-blocking responses larger than KAPI_ASYNC_BODY_SIZE
+#endif
+  
+  // Keep-alive statistics
+  uint32_t connectionReuseCount = 0; // Requests served on an already open connection
+  uint32_t reconnectCount = 0;       // Reconnects after the server closed a kept-alive socket
+  
+  // Static endpoint cache statistics
+  uint32_t cacheHits = 0;            // Requests answered from the cache
+  uint32_t dnsLookupCount = 0;       // Hostname lookups, failed ones included
+  uint32_t dnsFailCount = 0;
+  uint32_t prewarmCount = 0;         // Connections opened by prewarm()
+  
+#if KAPI_ENABLE_SCHEDULER
+  uint32_t updateCount = 0;          // Queries sent by update()
+#endif
+#if KAPI_ENABLE_BATCH
+  uint32_t batchCount = 0;           // Requests sent by refreshBatch()
+  uint32_t batchCallCount = 0;       // Calls they carried
+#endif
 
 private:
   Client *_client;
-  String _apiKey;
   IPAddress _moonrakerIp;
   bool _usingIpAddress;
-  char *_moonrakerHost;
+  char _moonrakerHost[KAPI_HOST_NAME_SIZE];
   uint16_t _moonrakerPort;
+#if defined(ESP32) || defined(ESP8266)
+  KlipperResolver _resolver = hostByName;
+#else
+  KlipperResolver _resolver = nullptr;
+#endif
+  unsigned long _dnsTtl = KAPI_DNS_TTL;
+  IPAddress _resolvedIp;             // Cached address of _moonrakerHost
+  bool _hostResolved = false;
+  unsigned long _resolvedAt = 0;
+  unsigned long _resolveInterval = 0; // TTL, or KAPI_DNS_RETRY after a failed lookup
   bool _hasApiKey;
+  char _hostHeader[KAPI_HOST_HEADER_SIZE];      // Built once in init()
+  char _apiKeyHeader[KAPI_APIKEY_HEADER_SIZE];  // Built once in init()
+  bool _keepAlive = false;
+  bool _serverClose = false;
+  KlipperResponseHead _head;
+  KlipperBodyStream _body;
+  
+#if KAPI_ENABLE_SUBSCRIPTION
+  // Status subscription
+  Client *_wsClient = nullptr;
+  KlipperWebsocket _ws;
+  KlipperStatusCallback _statusCallback = nullptr;
+  unsigned long _wsLastAttempt = 0;
+#endif
+  
+  uint8_t _refreshMask = 0;
+  
+#if KAPI_ENABLE_FILES
+  // File listing in progress
+  bool _listing = false;
+  bool _listDirs = false;            // Inside "dirs" rather than "files"
+  bool _listInArray = false;
+  char _listDirectory[KAPI_FILE_NAME_SIZE];
+#endif
+  
+#if KAPI_ENABLE_OBJECTS
+  // Discovered objects; names are packed into _objectNames and
+  // _objectSlots maps a name hash to id + 1 (0 for an empty slot)
+  KlipperObject _objects[KAPI_OBJECT_MAX];
+  char _objectNames[KAPI_OBJECT_ARENA_SIZE];
+  uint8_t _objectSlots[KAPI_OBJECT_SLOTS];
+  uint8_t _objectCount = 0;
+  uint16_t _objectNamesUsed = 0;
+#endif
+  
+#if KAPI_ENABLE_UPLOAD
+  KlipperUploadBody _upload;
+  char _uploadName[KAPI_FILE_NAME_SIZE];
+#endif
+  
+  // Static endpoint cache: one slot per cacheable request
+  unsigned long _cacheTtl = KAPI_CACHE_TTL;
+  unsigned long _cacheTime[KAPI_CACHE_SLOTS];
+  uint8_t _cacheValid = 0;           // Bit per slot
+  
+#if KAPI_ENABLE_SCHEDULER
+  // Adaptive polling, one entry per KAPI_REFRESH_* bit
+  uint8_t _updateMask = KAPI_REFRESH_ALL;
+  uint8_t _updatedMask = 0;          // Groups refreshed at least once
+  unsigned long _updatedAt[KAPI_UPDATE_GROUPS];
+  bool _positionMoving = false;      // Position changed on its last refresh
+  unsigned long _motionCommandAt = 0;
+  float _progress = 0;               // Progress and time it last changed
+  unsigned long _progressAt = 0;
+  float _progressRate = 0;           // Progress per ms while printing
+#endif
+  
+#if KAPI_ENABLE_ASYNC
+  // Non-blocking request in flight
+  uint8_t _asyncState = 0;
+  uint8_t _asyncRequest = KAPI_REQUEST_NONE;
+  KlipperRequestCallback _asyncCallback = nullptr;
+  bool _asyncReused = false;
+  unsigned long _asyncPhaseStart = 0;
+  int _asyncAvailable = 0;
+  char _asyncData[POSTDATA_SIZE];
+  KlipperBodyBuffer _asyncBody;
+#endif
+  
+#if KAPI_ENABLE_GCODE_QUEUE
+  // G-code queue: newline separated commands. The first _gcodeBatchLength
+  // bytes belong to the batch in flight, later commands wait behind it.
+  char _gcodeQueue[KAPI_GCODE_QUEUE_SIZE];
+  uint16_t _gcodeLength = 0;
+  uint16_t _gcodeBatchLength = 0;
+  uint8_t _gcodeCount = 0;
+  unsigned long _gcodeQueuedAt = 0;
+  bool _gcodeBatching = false;
+  KlipperRequestCallback _gcodeCallback = nullptr;
+#endif
   
-  static const int maxMessageLength = 1500;
+#if KAPI_ENABLE_STRING_API
+  static const int maxMessageLength = 1500;  // Limit for the String based API
+#endif
   
   // Private helper methods
+  bool connectClient(Client* client);
+  bool resolveHost();
+  bool openConnection();
+  void setApiKey(const char* apiKey);
+  bool writeRequest(const char* method, const char* endpoint, const char* data, KlipperBodySource* source = nullptr);
   void closeClient();
-  int extractHttpCode(const String& statusCode, const String& body);
+#if KAPI_ENABLE_STRING_API
   String sendRequestToMoonraker(const char* method, const char* endpoint, const char* data = nullptr);
+#endif
+  bool postToMoonraker(const char* endpoint, const char* data);
+  bool beginRequest(const char* method, const char* endpoint, const char* data = nullptr,
+                    KlipperBodySource* source = nullptr, bool force = false);
+  void endRequest();
+  bool getJsonFromMoonraker(const char* endpoint, JsonDocument& doc, JsonDocument& filter);
+  bool parseBody(JsonDocument& doc, JsonDocument& filter);
+  bool runQuery(uint8_t request);
+  const char* queryEndpoint(uint8_t request, char* buffer, size_t size);
+  uint8_t queryRefreshMask(uint8_t request);
+  bool buildObjectQuery(uint8_t mask, char* buffer, size_t size);
+  void addQueryFilter(uint8_t request, JsonObject filter);
+  bool applyQueryResult(uint8_t request, JsonObject result);
+  int8_t cacheSlot(uint8_t request);
+#if KAPI_ENABLE_UPLOAD
+  bool prepareUpload(Stream& file, const char* filename, uint32_t size, bool startAfterUpload);
+#endif
+#if KAPI_ENABLE_FILES || KAPI_ENABLE_OBJECTS
+  int skipSpace();
+  int readBodyString(char* out, size_t size);
+  int8_t seekArray(const char* const* keys, uint8_t count);
+#endif
+#if KAPI_ENABLE_FILES
+  void abortFileList();
+#endif
+#if KAPI_ENABLE_OBJECTS
+  bool addObject(const char* name, uint8_t kind);
+  void applyObjectStatus(JsonObject status);
+  static uint8_t objectHash(const char* name);
+#endif
+#if KAPI_ENABLE_HEALTH
+  bool requestAllowed(bool force) { return force || health.allow(); }
+  void noteFailure();
+  void noteSuccess() { health.success(); }
+#else
+  bool requestAllowed(bool force) { return true; }
+  void noteFailure() {}
+  void noteSuccess() {}
+#endif
+#if KAPI_ENABLE_SCHEDULER
+  void markUpdated(uint8_t mask, uint16_t changed);
+  void noteMotionCommand() { _motionCommandAt = millis(); }
+#else
+  void noteMotionCommand() {}
+#endif
+  bool cacheFresh(uint8_t request);
+  void cacheStore(uint8_t request);
+  void applyPrinterInfo(JsonObject result);
+#if KAPI_ENABLE_SERVER_INFO
+  void applyServerInfo(JsonObject result);
+#endif
+#if KAPI_ENABLE_BATCH
+  void applyJobQueue(JsonObject result);
+  void applyHistory(JsonObject result);
+#endif
+#if KAPI_ENABLE_ASYNC
+  bool beginAsync(uint8_t request, KlipperRequestCallback callback);
+  void pollSend();
+  void pollHead();
+  void pollBody();
+#if KAPI_ENABLE_UPLOAD
+  void pollUpload();
+#endif
+  void failAsync();
+  void finishAsync(bool success);
+#endif
+#if KAPI_ENABLE_CONTROL
+  bool postGcodeScript(KlipperBodySource& script);
+#endif
+#if KAPI_ENABLE_GCODE_QUEUE
+  bool gcodeFlushDue();
+  void finishGcodeBatch(bool success);
+#endif
+  uint16_t applyPrinterStatus(JsonObject status);
+#if KAPI_ENABLE_PRINT_JOB
+  uint16_t applyPrintJobStatus(JsonObject status);
+#endif
+#if KAPI_ENABLE_MOTION
+  void applyMotionLimits(JsonObject status);
+#endif
+#if KAPI_ENABLE_SUBSCRIPTION
+  bool openSubscription();
+  void handleSubscriptionMessage();
+#endif
+  bool sameTemperature(const TemperatureData& a, const TemperatureData& b);
   bool parseTemperatureData(JsonObject& obj, TemperatureData& tempData);
-  void parsePrinterState(const char* stateStr, PrinterStateFlags& flags);
+  void parsePrinterState(KlipperState state, PrinterStateFlags& flags);
+  static void copyField(char* dest, size_t size, const char* value);
   bool isValidTemperature(float temp);
   bool isValidPosition(float pos);
 };
@@ -0,0 +1,455 @@
+/*
+  KlipperCodec.cpp - Compact binary status frames for KlipperAPI
+*/
+
+#include "KlipperCodec.h"
+
+#if KAPI_ENABLE_CODEC
+
+// Field bits, the ones that change while printing first so the bitmap of
+// a typical delta fits in one or two bytes
+#define FIELD_EXTRUDER_TEMP     0
+#define FIELD_EXTRUDER_TARGET   1
+#define FIELD_EXTRUDER_POWER    2
+#define FIELD_BED_TEMP          3
+#define FIELD_BED_TARGET        4
+#define FIELD_BED_POWER         5
+#define FIELD_POSITION_X        6
+#define FIELD_POSITION_Y        7
+#define FIELD_POSITION_Z        8
+#define FIELD_POSITION_E        9
+#define FIELD_PROGRESS          10     // 0.01 %
+#define FIELD_PRINT_TIME        11
+#define FIELD_PRINTED_BYTES     12
+#define FIELD_TIME_LEFT         13
+#define FIELD_STATE             14     // stateId, state flags << 8
+#define FIELD_SPEED_FACTOR      15
+#define FIELD_FLOW_FACTOR       16
+#define FIELD_TOOLS             17     // hasExtruder, hasHeatedBed << 1, isHomed << 2
+#define FIELD_JOB_STATE         18     // stateId, job flags << 8
+#define FIELD_ESTIMATED_TIME    19
+#define FIELD_FILE_SIZE         20
+#define FIELD_PORT              21
+#define FIELD_FILENAME          22
+#define FIELD_KLIPPER_VERSION   23
+#define FIELD_MOONRAKER_VERSION 24
+#define FIELD_HOSTNAME          25
+#define FIELD_COUNT             26
+
+#define STATUS_FIELDS   0x0003C3FFUL   // Bits 0-9 and 14-17
+#define JOB_FIELDS      0x005C3C00UL   // Bits 10-13, 18-20 and 22
+#define SERVER_FIELDS   0x03A00000UL   // Bits 21 and 23-25
+
+#define TEXT_SIZE_FILENAME      64
+#define TEXT_SIZE_OTHER         32
+
+static uint32_t zigzag(int32_t value) {
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+// value * scale rounded and kept within +-limit, zigzag encoded
+static uint32_t fixedPoint(float value, float scale, float limit) {
+  float scaled = value * scale;
+  if (scaled > limit) scaled = limit;
+  if (scaled < -limit) scaled = -limit;
+  return zigzag((int32_t)lroundf(scaled));
+}
+
+static uint32_t temperature(float value) {
+  return fixedPoint(value, 10, 32767);
+}
+
+static uint32_t position(float value) {
+  return fixedPoint(value, 100, 2147483000.0f);
+}
+
+static uint32_t power(int16_t value) {
+  return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+static float fromFixedPoint(uint32_t value, float scale) {
+  return unzigzag(value) / scale;
+}
+
+static uint8_t textSize(uint8_t text) {
+  return text == 0 ? TEXT_SIZE_FILENAME : TEXT_SIZE_OTHER;
+}
+
+// Wire form of the api's data: numbers as sent, strings as pointers
+static void collect(const KlipperApi& api, uint32_t* numbers, const char** texts) {
+  const PrinterStatistics& stats = api.printerStats;
+  memset(numbers, 0, KAPI_CODEC_NUMBERS * sizeof(uint32_t));
+  for (uint8_t i = 0; i < KAPI_CODEC_TEXTS; i++) {
+    texts[i] = "";
+  }
+
+  numbers[FIELD_EXTRUDER_TEMP] = temperature(stats.extruder.current);
+  numbers[FIELD_EXTRUDER_TARGET] = temperature(stats.extruder.target);
+  numbers[FIELD_EXTRUDER_POWER] = power(stats.extruder.power);
+  numbers[FIELD_BED_TEMP] = temperature(stats.heatedBed.current);
+  numbers[FIELD_BED_TARGET] = temperature(stats.heatedBed.target);
+  numbers[FIELD_BED_POWER] = power(stats.heatedBed.power);
+  numbers[FIELD_POSITION_X] = position(stats.positionX);
+  numbers[FIELD_POSITION_Y] = position(stats.positionY);
+  numbers[FIELD_POSITION_Z] = position(stats.positionZ);
+  numbers[FIELD_POSITION_E] = position(stats.positionE);
+
+  const PrinterStateFlags& flags = stats.stateFlags;
+  numbers[FIELD_STATE] = stats.stateId |
+    (uint32_t)(flags.ready | flags.error << 1 | flags.paused << 2 | flags.printing << 3 |
+               flags.standby << 4 | flags.shutdown << 5 | flags.startup << 6) << 8;
+  numbers[FIELD_SPEED_FACTOR] = stats.speedFactor;
+  numbers[FIELD_FLOW_FACTOR] = stats.flowFactor;
+  numbers[FIELD_TOOLS] = stats.hasExtruder | stats.hasHeatedBed << 1 | stats.isHomed << 2;
+
+#if KAPI_ENABLE_PRINT_JOB
+  const PrintJobInfo& job = api.printJob;
+  float progress = job.progress < 0 ? 0 : (job.progress > 1 ? 1 : job.progress);
+  numbers[FIELD_PROGRESS] = (uint32_t)lroundf(progress * 10000);
+  numbers[FIELD_PRINT_TIME] = job.printTime;
+  numbers[FIELD_PRINTED_BYTES] = job.printedBytes;
+  numbers[FIELD_TIME_LEFT] = job.timeLeft;
+  numbers[FIELD_JOB_STATE] = job.stateId |
+    (uint32_t)(job.isPrinting | job.isPaused << 1 | job.isComplete << 2 | job.isCancelled << 3 |
+               job.hasError << 4) << 8;
+  numbers[FIELD_ESTIMATED_TIME] = job.estimatedTime;
+  numbers[FIELD_FILE_SIZE] = job.fileSize;
+  texts[FIELD_FILENAME - KAPI_CODEC_NUMBERS] = job.filename;
+#endif
+
+#if KAPI_ENABLE_SERVER_INFO
+  const ServerInfo& server = api.serverInfo;
+  numbers[FIELD_PORT] = server.port;
+  texts[FIELD_KLIPPER_VERSION - KAPI_CODEC_NUMBERS] = server.klipperVersion;
+  texts[FIELD_MOONRAKER_VERSION - KAPI_CODEC_NUMBERS] = server.moonrakerVersion;
+  texts[FIELD_HOSTNAME - KAPI_CODEC_NUMBERS] = server.hostname;
+#endif
+}
+
+// Bounds checked writes into the caller's buffer
+class FrameWriter {
+public:
+  FrameWriter(uint8_t* buffer, size_t size) : _buffer(buffer), _size(size), _length(0), _overflow(false) {}
+
+  void byte(uint8_t value) {
+    if (_length < _size) {
+      _buffer[_length++] = value;
+    } else {
+      _overflow = true;
+    }
+  }
+  void varint(uint32_t value) {
+    while (value >= 0x80) {
+      byte((uint8_t)(value | 0x80));
+      value >>= 7;
+    }
+    byte((uint8_t)value);
+  }
+  void text(const char* value, size_t limit) {
+    size_t length = strnlen(value, limit);
+    byte((uint8_t)length);
+    for (size_t i = 0; i < length; i++) {
+      byte((uint8_t)value[i]);
+    }
+  }
+  size_t length() const { return _overflow ? 0 : _length; }
+
+private:
+  uint8_t* _buffer;
+  size_t _size;
+  size_t _length;
+  bool _overflow;
+};
+
+class FrameReader {
+public:
+  FrameReader(const uint8_t* frame, size_t length) : _frame(frame), _length(length), _position(0), _error(false) {}
+
+  uint8_t byte() {
+    if (_position < _length) {
+      return _frame[_position++];
+    }
+    _error = true;
+    return 0;
+  }
+  uint32_t varint() {
+    uint32_t value = 0;
+    for (uint8_t shift = 0; shift < 35; shift += 7) {
+      uint8_t b = byte();
+      value |= (uint32_t)(b & 0x7F) << shift;
+      if ((b & 0x80) == 0) {
+        return value;
+      }
+    }
+    _error = true;
+    return 0;
+  }
+  const uint8_t* bytes(size_t count) {
+    if (count > _length - _position) {
+      _error = true;
+      return nullptr;
+    }
+    const uint8_t* start = _frame + _position;
+    _position += count;
+    return start;
+  }
+  // Malformed, or bytes left over
+  bool failed() const { return _error || _position != _length; }
+
+private:
+  const uint8_t* _frame;
+  size_t _length;
+  size_t _position;
+  bool _error;
+};
+
+KlipperEncoder::KlipperEncoder()
+  : _sequence(0), _sinceFull(0), _keyframe(KAPI_CODEC_KEYFRAME), _groups(0), _started(false) {
+  memset(_numbers, 0, sizeof(_numbers));
+  _filename[0] = _klipperVersion[0] = _moonrakerVersion[0] = _hostname[0] = '\0';
+  setGroups(KAPI_CODEC_ALL);
+}
+
+void KlipperEncoder::setGroups(uint8_t groups) {
+#if !KAPI_ENABLE_PRINT_JOB
+  groups &= ~KAPI_CODEC_JOB;
+#endif
+#if !KAPI_ENABLE_SERVER_INFO
+  groups &= ~KAPI_CODEC_SERVER;
+#endif
+  if (groups != _groups) {
+    _started = false;
+  }
+  _groups = groups;
+}
+
+size_t KlipperEncoder::encode(const KlipperApi& api, uint8_t* buffer, size_t size) {
+  bool full = !_started || (_keyframe > 0 && _sinceFull >= _keyframe);
+  return write(api, full, buffer, size);
+}
+
+size_t KlipperEncoder::encodeFull(const KlipperApi& api, uint8_t* buffer, size_t size) {
+  return write(api, true, buffer, size);
+}
+
+// Nothing is remembered unless the whole frame fit, so a failed encode
+// can be retried with a larger buffer
+size_t KlipperEncoder::write(const KlipperApi& api, bool full, uint8_t* buffer, size_t size) {
+  uint32_t numbers[KAPI_CODEC_NUMBERS];
+  const char* texts[KAPI_CODEC_TEXTS];
+  collect(api, numbers, texts);
+  char* sent[KAPI_CODEC_TEXTS] = { _filename, _klipperVersion, _moonrakerVersion, _hostname };
+
+  uint32_t groups = 0;
+  if (_groups & KAPI_CODEC_STATUS) groups |= STATUS_FIELDS;
+  if (_groups & KAPI_CODEC_JOB) groups |= JOB_FIELDS;
+  if (_groups & KAPI_CODEC_SERVER) groups |= SERVER_FIELDS;
+
+  uint32_t fields = 0;
+  for (uint8_t i = 0; i < KAPI_CODEC_NUMBERS; i++) {
+    if (full || numbers[i] != _numbers[i]) {
+      fields |= 1UL << i;
+    }
+  }
+  for (uint8_t i = 0; i < KAPI_CODEC_TEXTS; i++) {
+    if (full || strncmp(texts[i], sent[i], textSize(i) - 1) != 0) {
+      fields |= 1UL << (KAPI_CODEC_NUMBERS + i);
+    }
+  }
+  fields &= groups;
+
+  FrameWriter out(buffer, size);
+  out.byte(full ? KAPI_CODEC_FULL : KAPI_CODEC_DELTA);
+  out.varint(_sequence + 1);
+  if (!full) {
+    out.varint(1);
+  }
+  out.varint(fields);
+  for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+    if ((fields & (1UL << i)) == 0) {
+      continue;
+    }
+    if (i < KAPI_CODEC_NUMBERS) {
+      out.varint(numbers[i]);
+    } else {
+      out.text(texts[i - KAPI_CODEC_NUMBERS], textSize(i - KAPI_CODEC_NUMBERS) - 1);
+    }
+  }
+
+  size_t length = out.length();
+  if (length == 0) {
+    return 0;
+  }
+  for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+    if ((fields & (1UL << i)) == 0) {
+      continue;
+    }
+    if (i < KAPI_CODEC_NUMBERS) {
+      _numbers[i] = numbers[i];
+    } else {
+      uint8_t text = i - KAPI_CODEC_NUMBERS;
+      strncpy(sent[text], texts[text], textSize(text) - 1);
+      sent[text][textSize(text) - 1] = '\0';
+    }
+  }
+  _sequence++;
+  _started = true;
+  if (full) {
+    _sinceFull = 0;
+    fullCount++;
+  } else {
+    _sinceFull++;
+    deltaCount++;
+  }
+  return length;
+}
+
+KlipperDecoder::KlipperDecoder() : _sequence(0), _changed(0), _synced(false) {
+}
+
+// The frame is read completely before anything is applied, so a
+// malformed one leaves api untouched
+bool KlipperDecoder::decode(const uint8_t* frame, size_t length, KlipperApi& api) {
+  FrameReader in(frame, length);
+  uint8_t type = in.byte();
+  if (type != KAPI_CODEC_FULL && type != KAPI_CODEC_DELTA) {
+    errorCount++;
+    return false;
+  }
+  uint32_t sequence = in.varint();
+  uint32_t base = sequence;
+  if (type == KAPI_CODEC_DELTA) {
+    base -= in.varint();
+  }
+  uint32_t fields = in.varint();
+
+  uint32_t numbers[KAPI_CODEC_NUMBERS];
+  const uint8_t* texts[KAPI_CODEC_TEXTS];
+  uint8_t textLengths[KAPI_CODEC_TEXTS];
+  for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+    if ((fields & (1UL << i)) == 0) {
+      continue;
+    }
+    if (i < KAPI_CODEC_NUMBERS) {
+      numbers[i] = in.varint();
+    } else {
+      uint8_t text = i - KAPI_CODEC_NUMBERS;
+      textLengths[text] = in.byte();
+      texts[text] = in.bytes(textLengths[text]);
+    }
+  }
+  if (in.failed() || (fields >> FIELD_COUNT) != 0) {
+    errorCount++;
+    return false;
+  }
+
+  if (type == KAPI_CODEC_DELTA && (!_synced || base != _sequence)) {
+    // Missed a frame; wait for the next full one
+    _synced = false;
+    gapCount++;
+    return false;
+  }
+
+  uint16_t changed = 0;
+  PrinterStatistics& stats = api.printerStats;
+#define HAS(field) (fields & (1UL << (field)))
+
+  if (HAS(FIELD_EXTRUDER_TEMP)) stats.extruder.current = fromFixedPoint(numbers[FIELD_EXTRUDER_TEMP], 10);
+  if (HAS(FIELD_EXTRUDER_TARGET)) stats.extruder.target = fromFixedPoint(numbers[FIELD_EXTRUDER_TARGET], 10);
+  if (HAS(FIELD_EXTRUDER_POWER)) stats.extruder.power = (int16_t)numbers[FIELD_EXTRUDER_POWER];
+  if (fields & 0x07) changed |= KAPI_CHANGED_EXTRUDER;
+  if (HAS(FIELD_BED_TEMP)) stats.heatedBed.current = fromFixedPoint(numbers[FIELD_BED_TEMP], 10);
+  if (HAS(FIELD_BED_TARGET)) stats.heatedBed.target = fromFixedPoint(numbers[FIELD_BED_TARGET], 10);
+  if (HAS(FIELD_BED_POWER)) stats.heatedBed.power = (int16_t)numbers[FIELD_BED_POWER];
+  if (fields & 0x38) changed |= KAPI_CHANGED_BED;
+  if (HAS(FIELD_POSITION_X)) stats.positionX = fromFixedPoint(numbers[FIELD_POSITION_X], 100);
+  if (HAS(FIELD_POSITION_Y)) stats.positionY = fromFixedPoint(numbers[FIELD_POSITION_Y], 100);
+  if (HAS(FIELD_POSITION_Z)) stats.positionZ = fromFixedPoint(numbers[FIELD_POSITION_Z], 100);
+  if (HAS(FIELD_POSITION_E)) stats.positionE = fromFixedPoint(numbers[FIELD_POSITION_E], 100);
+  if (fields & 0x3C0) changed |= KAPI_CHANGED_POSITION;
+
+  if (HAS(FIELD_STATE)) {
+    uint32_t value = numbers[FIELD_STATE];
+    stats.stateId = (KlipperState)(value & 0xFF);
+    strncpy(stats.state, KlipperApi::stateName(stats.stateId), sizeof(stats.state) - 1);
+    stats.state[sizeof(stats.state) - 1] = '\0';
+    stats.stateFlags.ready = (value >> 8) & 1;
+    stats.stateFlags.error = (value >> 9) & 1;
+    stats.stateFlags.paused = (value >> 10) & 1;
+    stats.stateFlags.printing = (value >> 11) & 1;
+    stats.stateFlags.standby = (value >> 12) & 1;
+    stats.stateFlags.shutdown = (value >> 13) & 1;
+    stats.stateFlags.startup = (value >> 14) & 1;
+    changed |= KAPI_CHANGED_STATE;
+  }
+  if (HAS(FIELD_SPEED_FACTOR)) stats.speedFactor = (uint16_t)numbers[FIELD_SPEED_FACTOR];
+  if (HAS(FIELD_FLOW_FACTOR)) stats.flowFactor = (uint16_t)numbers[FIELD_FLOW_FACTOR];
+  if (HAS(FIELD_SPEED_FACTOR) || HAS(FIELD_FLOW_FACTOR)) changed |= KAPI_CHANGED_FACTORS;
+  if (HAS(FIELD_TOOLS)) {
+    uint32_t tools = numbers[FIELD_TOOLS];
+    stats.hasExtruder = tools & 1;
+    stats.hasHeatedBed = (tools >> 1) & 1;
+    if (stats.isHomed != ((tools >> 2) & 1)) changed |= KAPI_CHANGED_HOMED;
+    stats.isHomed = (tools >> 2) & 1;
+  }
+
+#if KAPI_ENABLE_PRINT_JOB
+  PrintJobInfo& job = api.printJob;
+  if (HAS(FIELD_PROGRESS)) job.progress = numbers[FIELD_PROGRESS] / 10000.0f;
+  if (HAS(FIELD_PRINT_TIME)) job.printTime = numbers[FIELD_PRINT_TIME];
+  if (HAS(FIELD_PRINTED_BYTES)) job.printedBytes = numbers[FIELD_PRINTED_BYTES];
+  if (HAS(FIELD_TIME_LEFT)) job.timeLeft = numbers[FIELD_TIME_LEFT];
+  if (HAS(FIELD_ESTIMATED_TIME)) job.estimatedTime = numbers[FIELD_ESTIMATED_TIME];
+  if (HAS(FIELD_FILE_SIZE)) job.fileSize = numbers[FIELD_FILE_SIZE];
+  if (fields & ((1UL << FIELD_PROGRESS) | (1UL << FIELD_PRINT_TIME) | (1UL << FIELD_PRINTED_BYTES) |
+                (1UL << FIELD_TIME_LEFT) | (1UL << FIELD_ESTIMATED_TIME) | (1UL << FIELD_FILE_SIZE))) {
+    changed |= KAPI_CHANGED_PROGRESS;
+  }
+  if (HAS(FIELD_JOB_STATE)) {
+    uint32_t value = numbers[FIELD_JOB_STATE];
+    job.stateId = (KlipperState)(value & 0xFF);
+    strncpy(job.state, KlipperApi::stateName(job.stateId), sizeof(job.state) - 1);
+    job.state[sizeof(job.state) - 1] = '\0';
+    job.isPrinting = (value >> 8) & 1;
+    job.isPaused = (value >> 9) & 1;
+    job.isComplete = (value >> 10) & 1;
+    job.isCancelled = (value >> 11) & 1;
+    job.hasError = (value >> 12) & 1;
+    changed |= KAPI_CHANGED_JOB;
+  }
+#endif
+
+  // Strings are clipped to the receiving field
+  char* targets[KAPI_CODEC_TEXTS] = { nullptr, nullptr, nullptr, nullptr };
+#if KAPI_ENABLE_PRINT_JOB
+  targets[0] = job.filename;
+#endif
+#if KAPI_ENABLE_SERVER_INFO
+  if (HAS(FIELD_PORT)) api.serverInfo.port = (uint16_t)numbers[FIELD_PORT];
+  targets[1] = api.serverInfo.klipperVersion;
+  targets[2] = api.serverInfo.moonrakerVersion;
+  targets[3] = api.serverInfo.hostname;
+#endif
+  for (uint8_t i = 0; i < KAPI_CODEC_TEXTS; i++) {
+    if (!HAS(KAPI_CODEC_NUMBERS + i) || targets[i] == nullptr) {
+      continue;
+    }
+    size_t count = textLengths[i] < textSize(i) - 1 ? textLengths[i] : textSize(i) - 1;
+    memcpy(targets[i], texts[i], count);
+    targets[i][count] = '\0';
+  }
+  if (HAS(FIELD_FILENAME)) changed |= KAPI_CHANGED_JOB;
+#undef HAS
+
+  _sequence = sequence;
+  _synced = true;
+  _changed = changed;
+  frameCount++;
+  return true;
+}
+
+#endif
@@ -0,0 +1,132 @@
+/*
+  KlipperCodec.h - Compact binary status frames for KlipperAPI
+
+  For a gateway that polls Moonraker and forwards the status to other
+  boards over ESP-NOW, UDP or a serial link. KlipperEncoder turns
+  printerStats, printJob and serverInfo into a frame; KlipperDecoder
+  applies frames to the same structs of another KlipperApi, which needs
+  no init() and never touches the network:
+
+    // Gateway                                // Display
+    uint8_t frame[KAPI_CODEC_MAX_FRAME];      KlipperApi api;
+    size_t length = encoder.encode(api,       KlipperDecoder decoder;
+                      frame, sizeof(frame));  void onReceive(const uint8_t* data, int length) {
+    esp_now_send(peer, frame, length);          if (decoder.decode(data, length, api)) {
+                                                  redraw(decoder.changed());
+                                                }
+                                              }
+
+  A full frame carries every field and is at most KAPI_CODEC_MAX_FRAME
+  (248) bytes, so it fits one ESP-NOW packet. A delta frame carries only
+  the fields that changed since the frame before it, typically 10-30
+  bytes while printing. Every KAPI_CODEC_KEYFRAME frames, and whenever
+  asked with reset(), a full frame goes out again, so a display that
+  joined late or lost a delta catches up.
+
+  Frame layout, all numbers unsigned LEB128 varints:
+
+    type       1 byte, KAPI_CODEC_FULL or KAPI_CODEC_DELTA
+    sequence   varint, one more with every frame
+    base       varint, delta only: sequence - the sequence it applies to
+    fields     varint bitmap of the fields that follow, in bit order
+    values     varint per number, signed ones zigzag encoded; strings are
+               a length byte and the bytes, without terminator
+
+  Temperatures travel in 0.1 °C, positions in 0.01 mm, heater power as
+  0-255 and progress in 0.01 %, so changes smaller than that do not make
+  a delta. State strings are rebuilt from the state bytes; a state
+  KlipperAPI does not know arrives as "".
+
+  Enabled with KAPI_ENABLE_CODEC (see KlipperConfig.h).
+*/
+
+#ifndef KlipperCodec_h
+#define KlipperCodec_h
+
+#include <Arduino.h>
+#include "KlipperAPI.h"
+
+#if KAPI_ENABLE_CODEC
+
+#ifndef KAPI_CODEC_KEYFRAME
+#define KAPI_CODEC_KEYFRAME     30     // Frames between full frames, 0 for only the first
+#endif
+
+#define KAPI_CODEC_MAX_FRAME    248    // Longest possible frame in bytes
+#define KAPI_CODEC_FULL         0xB1   // First byte of a full frame
+#define KAPI_CODEC_DELTA        0xB2   // First byte of a delta frame
+
+// Field groups for setGroups()
+#define KAPI_CODEC_STATUS       0x01   // printerStats
+#define KAPI_CODEC_JOB          0x02   // printJob
+#define KAPI_CODEC_SERVER       0x04   // serverInfo
+#define KAPI_CODEC_ALL          0x07
+
+#define KAPI_CODEC_NUMBERS      22     // Numeric fields, bits 0-21
+#define KAPI_CODEC_TEXTS        4      // String fields, bits 22-25
+
+class KlipperEncoder {
+public:
+  KlipperEncoder();
+
+  // Frame of what changed since the last frame, or a full frame when one
+  // is due. Returns its length, 0 if it does not fit in size. A frame
+  // with no changes is still written (a few bytes) and keeps receivers
+  // in step.
+  size_t encode(const KlipperApi& api, uint8_t* buffer, size_t size);
+  size_t encodeFull(const KlipperApi& api, uint8_t* buffer, size_t size);
+
+  // KAPI_CODEC_* groups to send, all compiled in ones by default
+  void setGroups(uint8_t groups);
+  void setKeyframeInterval(uint16_t frames) { _keyframe = frames; }
+  // Make the next frame a full one, e.g. when a display joins
+  void reset() { _started = false; }
+  uint32_t sequence() const { return _sequence; }
+
+  uint32_t fullCount = 0;            // Full frames written
+  uint32_t deltaCount = 0;           // Delta frames written
+
+private:
+  size_t write(const KlipperApi& api, bool full, uint8_t* buffer, size_t size);
+
+  uint32_t _numbers[KAPI_CODEC_NUMBERS];  // As last sent
+  char _filename[64];
+  char _klipperVersion[32];
+  char _moonrakerVersion[32];
+  char _hostname[32];
+  uint32_t _sequence;
+  uint16_t _sinceFull;
+  uint16_t _keyframe;
+  uint8_t _groups;
+  bool _started;
+};
+
+class KlipperDecoder {
+public:
+  KlipperDecoder();
+
+  // Apply a frame to api's printerStats, printJob and serverInfo. false
+  // if it is malformed, or a delta that does not follow the last frame
+  // applied, in which case nothing changes until the next full frame.
+  bool decode(const uint8_t* frame, size_t length, KlipperApi& api);
+
+  // KAPI_CHANGED_* flags of the last frame applied
+  uint16_t changed() const { return _changed; }
+  // A full frame was applied and no delta was missed since
+  bool synced() const { return _synced; }
+  uint32_t sequence() const { return _sequence; }
+  void reset() { _synced = false; }
+
+  uint32_t frameCount = 0;           // Frames applied
+  uint32_t gapCount = 0;             // Deltas dropped because one before them was missed
+  uint32_t errorCount = 0;           // Malformed frames
+
+private:
+  uint32_t _sequence;
+  uint16_t _changed;
+  bool _synced;
+};
+
+#endif
+
+#endif
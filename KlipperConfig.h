@@ -0,0 +1,180 @@
+/*
+  KlipperConfig.h - Compile time configuration for KlipperAPI
+
+  Every feature below can be switched off to save flash and RAM on small
+  boards. Set the macros to 0 with build flags, for example in PlatformIO:
+
+    build_flags = -DKAPI_ENABLE_SUBSCRIPTION=0 -DKAPI_ENABLE_GCODE_QUEUE=0
+
+  or with arduino-cli:
+
+    --build-property "compiler.cpp.extra_flags=-DKAPI_ENABLE_ASYNC=0"
+
+  Defines in a sketch do not reach the library's own .cpp files in the
+  Arduino build, so they must be passed as flags (or edited in here).
+  Buffer sizes in KlipperAPI.h and KlipperHttp.h can be overridden the same
+  way; AVR boards get smaller defaults below.
+*/
+
+#ifndef KlipperConfig_h
+#define KlipperConfig_h
+
+// Print job data: printJob, getPrintJob(), KAPI_REFRESH_JOB
+#ifndef KAPI_ENABLE_PRINT_JOB
+#define KAPI_ENABLE_PRINT_JOB 1
+#endif
+
+// Server data: serverInfo, getServerInfo(), versions in getPrinterInfo()
+#ifndef KAPI_ENABLE_SERVER_INFO
+#define KAPI_ENABLE_SERVER_INFO 1
+#endif
+
+// Motion limits: motionLimits, getMotionLimits(), KAPI_REFRESH_MOTION
+#ifndef KAPI_ENABLE_MOTION
+#define KAPI_ENABLE_MOTION 1
+#endif
+
+// Print, temperature, movement, G-code and restart commands.
+// emergencyStop() is always available.
+#ifndef KAPI_ENABLE_CONTROL
+#define KAPI_ENABLE_CONTROL 1
+#endif
+
+// String returning request methods (sendGetToMoonraker() and friends)
+#ifndef KAPI_ENABLE_STRING_API
+#define KAPI_ENABLE_STRING_API 1
+#endif
+
+// Non-blocking begin*() requests and poll()
+#ifndef KAPI_ENABLE_ASYNC
+#if defined(__AVR__)
+#define KAPI_ENABLE_ASYNC 0
+#else
+#define KAPI_ENABLE_ASYNC 1
+#endif
+#endif
+
+// Batching G-code queue, needs KAPI_ENABLE_CONTROL and KAPI_ENABLE_ASYNC;
+// off by default when either of them is
+#ifndef KAPI_ENABLE_GCODE_QUEUE
+#if defined(__AVR__)
+#define KAPI_ENABLE_GCODE_QUEUE 0
+#else
+#define KAPI_ENABLE_GCODE_QUEUE (KAPI_ENABLE_CONTROL && KAPI_ENABLE_ASYNC)
+#endif
+#endif
+
+// Websocket status subscription
+#ifndef KAPI_ENABLE_SUBSCRIPTION
+#if defined(__AVR__)
+#define KAPI_ENABLE_SUBSCRIPTION 0
+#else
+#define KAPI_ENABLE_SUBSCRIPTION 1
+#endif
+#endif
+
+// Heater, fan and sensor discovery: discoverObjects(), refreshObjects()
+#ifndef KAPI_ENABLE_OBJECTS
+#if defined(__AVR__)
+#define KAPI_ENABLE_OBJECTS 0
+#else
+#define KAPI_ENABLE_OBJECTS 1
+#endif
+#endif
+
+// G-code file listing: openFileList(), nextFile(), listRecentFiles()
+#ifndef KAPI_ENABLE_FILES
+#if defined(__AVR__)
+#define KAPI_ENABLE_FILES 0
+#else
+#define KAPI_ENABLE_FILES 1
+#endif
+#endif
+
+// File upload: uploadFile(), beginUploadFile()
+#ifndef KAPI_ENABLE_UPLOAD
+#if defined(__AVR__)
+#define KAPI_ENABLE_UPLOAD 0
+#else
+#define KAPI_ENABLE_UPLOAD 1
+#endif
+#endif
+
+// Adaptive polling: update() refreshes each data group at its own rate
+#ifndef KAPI_ENABLE_SCHEDULER
+#define KAPI_ENABLE_SCHEDULER 1
+#endif
+
+// Circuit breaker that fails requests fast while the printer is unreachable,
+// see KlipperHealth.h
+#ifndef KAPI_ENABLE_HEALTH
+#define KAPI_ENABLE_HEALTH 1
+#endif
+
+// Several calls in one JSON-RPC request: refreshBatch(), jobQueue, lastJob
+#ifndef KAPI_ENABLE_BATCH
+#if defined(__AVR__)
+#define KAPI_ENABLE_BATCH 0
+#else
+#define KAPI_ENABLE_BATCH 1
+#endif
+#endif
+
+// Binary status frames for forwarding to other boards, see KlipperCodec.h
+#ifndef KAPI_ENABLE_CODEC
+#if defined(__AVR__)
+#define KAPI_ENABLE_CODEC 0
+#else
+#define KAPI_ENABLE_CODEC 1
+#endif
+#endif
+
+// Polling on a background task with lock-free snapshots, see
+// KlipperWorker.h. Needs FreeRTOS on two cores or std::thread, so only on
+// the ESP32 and in host builds.
+#ifndef KAPI_ENABLE_WORKER
+#if defined(ESP32) || defined(__linux__) || defined(__APPLE__)
+#define KAPI_ENABLE_WORKER 1
+#else
+#define KAPI_ENABLE_WORKER 0
+#endif
+#endif
+
+// Per endpoint request counters and latencies, see KlipperMetrics.h.
+// Off by default; costs nothing unless enabled.
+#ifndef KAPI_ENABLE_METRICS
+#define KAPI_ENABLE_METRICS 0
+#endif
+
+#if KAPI_ENABLE_GCODE_QUEUE && !(KAPI_ENABLE_CONTROL && KAPI_ENABLE_ASYNC)
+#error "KAPI_ENABLE_GCODE_QUEUE needs KAPI_ENABLE_CONTROL and KAPI_ENABLE_ASYNC"
+#endif
+
+// Smaller buffers for boards with a few KB of RAM
+#if defined(__AVR__)
+#ifndef JSONDOCUMENT_SIZE
+#define JSONDOCUMENT_SIZE 512
+#endif
+#ifndef POSTDATA_SIZE
+#define POSTDATA_SIZE 96
+#endif
+#ifndef KAPI_WRITE_BUFFER_SIZE
+#define KAPI_WRITE_BUFFER_SIZE 64
+#endif
+#ifndef KAPI_JSON_POOL_MAX
+#define KAPI_JSON_POOL_MAX 512       // Do not grow the response document
+#endif
+// Longest query URL the enabled features build: refresh() of everything,
+// or a file path URL encoded
+#ifndef KAPI_QUERY_SIZE
+#if KAPI_ENABLE_MOTION && KAPI_ENABLE_PRINT_JOB
+#define KAPI_QUERY_SIZE 324
+#elif KAPI_ENABLE_MOTION || KAPI_ENABLE_PRINT_JOB || KAPI_ENABLE_FILES
+#define KAPI_QUERY_SIZE 256
+#else
+#define KAPI_QUERY_SIZE 180
+#endif
+#endif
+#endif
+
+#endif
@@ -0,0 +1,109 @@
+/*
+  KlipperHealth.cpp - Printer reachability tracking for KlipperAPI
+*/
+
+#include "KlipperHealth.h"
+
+#if KAPI_ENABLE_HEALTH
+
+KlipperHealth::KlipperHealth() : _seed(0) {
+  configure(KAPI_BREAKER_THRESHOLD, KAPI_BACKOFF_MIN, KAPI_BACKOFF_MAX);
+  reset();
+}
+
+void KlipperHealth::configure(uint8_t threshold, unsigned long minBackoff, unsigned long maxBackoff) {
+  _threshold = threshold > 0 ? threshold : 1;
+  _minBackoff = minBackoff > 0 ? minBackoff : 1;
+  _maxBackoff = maxBackoff > _minBackoff ? maxBackoff : _minBackoff;
+}
+
+void KlipperHealth::reset() {
+  _state = KAPI_HEALTH_CLOSED;
+  _failures = 0;
+  _trips = 0;
+  _backoff = 0;
+  _openedAt = 0;
+}
+
+uint8_t KlipperHealth::state() const {
+  if (_state == KAPI_HEALTH_OPEN && millis() - _openedAt >= _backoff) {
+    return KAPI_HEALTH_HALF_OPEN;
+  }
+  return _state;
+}
+
+unsigned long KlipperHealth::retryIn() const {
+  if (_state != KAPI_HEALTH_OPEN) {
+    return 0;
+  }
+  unsigned long elapsed = millis() - _openedAt;
+  return elapsed < _backoff ? _backoff - elapsed : 0;
+}
+
+// Only one request is in flight at a time, so half open needs no separate
+// probe: whatever goes out first is it
+bool KlipperHealth::allow() {
+  if (_state != KAPI_HEALTH_OPEN) {
+    return true;
+  }
+  if (millis() - _openedAt < _backoff) {
+    rejectCount++;
+    return false;
+  }
+  _state = KAPI_HEALTH_HALF_OPEN;
+  return true;
+}
+
+void KlipperHealth::success() {
+  _state = KAPI_HEALTH_CLOSED;
+  _failures = 0;
+  _trips = 0;
+}
+
+// A forced request failing while open leaves the backoff as it is
+bool KlipperHealth::failure() {
+  failureCount++;
+  if (_failures < 255) {
+    _failures++;
+  }
+
+  if (_state == KAPI_HEALTH_HALF_OPEN ||
+      (_state == KAPI_HEALTH_CLOSED && _failures >= _threshold)) {
+    open();
+    return true;
+  }
+  return false;
+}
+
+// Double the backoff with every opening, then pick it from its upper half
+// so displays watching the same printer do not retry in step
+void KlipperHealth::open() {
+  unsigned long wait = _minBackoff;
+  for (uint8_t i = 0; i < _trips && wait < _maxBackoff; i++) {
+    wait *= 2;
+  }
+  if (wait > _maxBackoff) {
+    wait = _maxBackoff;
+  }
+
+  _backoff = wait - nextRandom() % (wait / 2 + 1);
+  _openedAt = millis();
+  _state = KAPI_HEALTH_OPEN;
+  if (_trips < 255) {
+    _trips++;
+  }
+  tripCount++;
+}
+
+// xorshift32, seeded from the time of the first opening
+uint32_t KlipperHealth::nextRandom() {
+  if (_seed == 0) {
+    _seed = micros() | 1;
+  }
+  _seed ^= _seed << 13;
+  _seed ^= _seed >> 17;
+  _seed ^= _seed << 5;
+  return _seed;
+}
+
+#endif
@@ -0,0 +1,98 @@
+/*
+  KlipperHealth.h - Printer reachability tracking for KlipperAPI
+
+  A powered off printer makes every request wait for the connect to fail,
+  and then for KAPI_TIMEOUT. KlipperHealth is a circuit breaker in front of
+  the requests:
+
+    closed     requests go out; KAPI_BREAKER_THRESHOLD failures in a row
+               open the breaker
+    open       requests fail at once, without touching the network, until
+               the backoff has passed
+    half open  the backoff has passed; the next request decides. Success
+               closes the breaker, failure opens it again with twice the
+               backoff, up to KAPI_BACKOFF_MAX
+
+  Only transport failures count: no connection, no response or a response
+  head that did not arrive in time. An HTTP error status means Moonraker
+  answered. Commands that change the printer (emergencyStop(), pausePrint(),
+  sendGcode() ...) are always sent and only report their outcome.
+
+    if (api.health.state() == KAPI_HEALTH_OPEN) {
+      showOffline(api.health.retryIn());
+    }
+
+  Enabled with KAPI_ENABLE_HEALTH (see KlipperConfig.h).
+*/
+
+#ifndef KlipperHealth_h
+#define KlipperHealth_h
+
+#include <Arduino.h>
+#include "KlipperConfig.h"
+
+#if KAPI_ENABLE_HEALTH
+
+#ifndef KAPI_BREAKER_THRESHOLD
+#define KAPI_BREAKER_THRESHOLD  3      // Failures in a row that open the breaker
+#endif
+#ifndef KAPI_BACKOFF_MIN
+#define KAPI_BACKOFF_MIN        2000   // ms the breaker stays open the first time
+#endif
+#ifndef KAPI_BACKOFF_MAX
+#define KAPI_BACKOFF_MAX        60000  // Longest backoff in ms
+#endif
+
+// Breaker states
+#define KAPI_HEALTH_CLOSED      0
+#define KAPI_HEALTH_OPEN        1
+#define KAPI_HEALTH_HALF_OPEN   2
+
+class KlipperHealth {
+public:
+  KlipperHealth();
+
+  // threshold failures in a row open the breaker, for minBackoff ms the
+  // first time and doubling up to maxBackoff
+  void configure(uint8_t threshold, unsigned long minBackoff, unsigned long maxBackoff);
+  // Close the breaker, e.g. after the printer was switched on
+  void reset();
+
+  uint8_t state() const;
+  bool reachable() const { return _state == KAPI_HEALTH_CLOSED; }
+  // ms until requests are let through again, 0 if they are now
+  unsigned long retryIn() const;
+  // Failures since the last success
+  uint8_t failures() const { return _failures; }
+  // Current backoff in ms, with jitter, 0 while closed
+  unsigned long backoff() const { return _state == KAPI_HEALTH_CLOSED ? 0 : _backoff; }
+
+  // Request hooks used by KlipperApi. allow() is asked before a request
+  // and moves an expired backoff to half open; failure() returns true if
+  // it opened the breaker.
+  bool allow();
+  void success();
+  bool failure();
+
+  uint32_t failureCount = 0;         // Transport failures
+  uint32_t rejectCount = 0;          // Requests failed fast while open
+  uint32_t tripCount = 0;            // Times the breaker opened
+
+private:
+  void open();
+  uint32_t nextRandom();
+
+  uint8_t _state;
+  uint8_t _failures;
+  uint8_t _trips;                    // Openings since the last success
+  uint8_t _threshold;
+  unsigned long _minBackoff;
+  unsigned long _maxBackoff;
+  unsigned long _backoff;
+  unsigned long _openedAt;
+  uint32_t _seed;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,179 @@
+/*
+  KlipperHistory.cpp - Fixed memory telemetry history for KlipperAPI
+*/
+
+#include "KlipperHistory.h"
+
+// Degrees to the tenths stored in a sample, clamped to int16_t
+static int16_t toTenths(float value) {
+  float tenths = value * 10.0f;
+  if (tenths > 32767.0f) return 32767;
+  if (tenths < -32768.0f) return -32768;
+  return (int16_t)(tenths < 0 ? tenths - 0.5f : tenths + 0.5f);
+}
+
+KlipperHistoryBase::KlipperHistoryBase(KlipperSample* recent, uint16_t recentSize,
+                                       KlipperSample* older, uint16_t olderSize, uint8_t factor) {
+  _recent = recent;
+  _recentSize = recentSize;
+  _older = older;
+  _olderSize = olderSize;
+  _factor = (factor < 2) ? 2 : factor;
+  clear();
+}
+
+void KlipperHistoryBase::clear() {
+  _recentStart = 0;
+  _recentCount = 0;
+  _olderStart = 0;
+  _olderCount = 0;
+  memset(&_pending, 0, sizeof(_pending));
+  resetStats(extruderStats);
+  resetStats(bedStats);
+}
+
+void KlipperHistoryBase::add(const KlipperApi& api) {
+  KlipperSample sample;
+  sample.time = millis();
+  sample.extruderTemp = toTenths(api.printerStats.extruder.current);
+  sample.extruderTarget = toTenths(api.printerStats.extruder.target);
+  sample.bedTemp = toTenths(api.printerStats.heatedBed.current);
+  sample.bedTarget = toTenths(api.printerStats.heatedBed.target);
+  sample.extruderPower = (uint8_t)constrain(api.printerStats.extruder.power, 0, 255);
+  sample.bedPower = (uint8_t)constrain(api.printerStats.heatedBed.power, 0, 255);
+#if KAPI_ENABLE_PRINT_JOB
+  sample.progress = (uint16_t)(constrain(api.printJob.progress, 0.0f, 1.0f) * 10000 + 0.5f);
+#else
+  sample.progress = 0;
+#endif
+  sample.readings = 1;
+  add(sample);
+}
+
+// Newest sample goes into the recent ring; when it is full the oldest
+// recent sample moves into the bucket being filled
+void KlipperHistoryBase::add(const KlipperSample& sample) {
+  updateStats(extruderStats, sample.extruderTemp);
+  updateStats(bedStats, sample.bedTemp);
+
+  if (_recentCount == _recentSize) {
+    addToBucket(_recent[_recentStart]);
+    _recentStart = (_recentStart + 1) % _recentSize;
+    _recentCount--;
+  }
+
+  KlipperSample& slot = _recent[(_recentStart + _recentCount) % _recentSize];
+  slot = sample;
+  slot.readings = 1;
+  _recentCount++;
+}
+
+// Sum a sample into the pending bucket, storing it as an older sample
+// once it holds _factor readings
+void KlipperHistoryBase::addToBucket(const KlipperSample& sample) {
+  if (_olderSize == 0) {
+    return;
+  }
+
+  if (_pending.readings == 0) {
+    _pending.time = sample.time;
+  }
+  _pending.extruderTemp += sample.extruderTemp;
+  _pending.extruderTarget += sample.extruderTarget;
+  _pending.bedTemp += sample.bedTemp;
+  _pending.bedTarget += sample.bedTarget;
+  _pending.progress += sample.progress;
+  _pending.extruderPower += sample.extruderPower;
+  _pending.bedPower += sample.bedPower;
+  _pending.readings++;
+
+  if (_pending.readings < _factor) {
+    return;
+  }
+
+  if (_olderCount == _olderSize) {
+    _olderStart = (_olderStart + 1) % _olderSize;
+    _olderCount--;
+  }
+  _older[(_olderStart + _olderCount) % _olderSize] = bucketAverage();
+  _olderCount++;
+  memset(&_pending, 0, sizeof(_pending));
+}
+
+// Average of the readings in the pending bucket
+KlipperSample KlipperHistoryBase::bucketAverage() const {
+  KlipperSample sample;
+  int32_t n = _pending.readings;
+  sample.time = _pending.time;
+  sample.extruderTemp = (int16_t)(_pending.extruderTemp / n);
+  sample.extruderTarget = (int16_t)(_pending.extruderTarget / n);
+  sample.bedTemp = (int16_t)(_pending.bedTemp / n);
+  sample.bedTarget = (int16_t)(_pending.bedTarget / n);
+  sample.progress = (uint16_t)(_pending.progress / n);
+  sample.extruderPower = (uint8_t)(_pending.extruderPower / n);
+  sample.bedPower = (uint8_t)(_pending.bedPower / n);
+  sample.readings = _pending.readings;
+  return sample;
+}
+
+// Older buckets, then the bucket being filled, then the recent samples
+uint16_t KlipperHistoryBase::size() const {
+  return _olderCount + (_pending.readings > 0 ? 1 : 0) + _recentCount;
+}
+
+KlipperSample KlipperHistoryBase::operator[](uint16_t index) const {
+  if (index < _olderCount) {
+    return _older[(_olderStart + index) % _olderSize];
+  }
+  index -= _olderCount;
+
+  if (_pending.readings > 0) {
+    if (index == 0) {
+      return bucketAverage();
+    }
+    index--;
+  }
+
+  if (index < _recentCount) {
+    return _recent[(_recentStart + index) % _recentSize];
+  }
+
+  KlipperSample empty;
+  memset(&empty, 0, sizeof(empty));
+  return empty;
+}
+
+KlipperSample KlipperHistoryBase::latest() const {
+  uint16_t count = size();
+  return (*this)[count > 0 ? count - 1 : 0];
+}
+
+uint32_t KlipperHistoryBase::span() const {
+  uint16_t count = size();
+  if (count < 2) {
+    return 0;
+  }
+  return (*this)[count - 1].time - (*this)[0].time;
+}
+
+// Incremental mean, so no sum can overflow however long it runs
+void KlipperHistoryBase::updateStats(KlipperHistoryStats& stats, int16_t value) {
+  float degrees = value / 10.0f;
+  stats.count++;
+  if (stats.count == 1) {
+    stats.minimum = degrees;
+    stats.maximum = degrees;
+    stats.average = degrees;
+    return;
+  }
+  if (degrees < stats.minimum) stats.minimum = degrees;
+  if (degrees > stats.maximum) stats.maximum = degrees;
+  stats.average += (degrees - stats.average) / stats.count;
+}
+
+void KlipperHistoryBase::resetStats(KlipperHistoryStats& stats) {
+  stats.minimum = 0;
+  stats.maximum = 0;
+  stats.average = 0;
+  stats.count = 0;
+}
@@ -0,0 +1,140 @@
+/*
+  KlipperHistory.h - Fixed memory telemetry history for KlipperAPI
+
+  Keeps temperature and progress samples for plotting without any heap.
+  The newest samples are kept as recorded; older ones are averaged into
+  coarser buckets, round robin database style, so a small buffer still
+  covers a long time:
+
+    KlipperHistory<60, 48, 10> history;  // 60 recent samples, then 48
+                                         // buckets of 10 samples each
+    history.add(api);                    // after each getPrinterStatistics()
+
+    for (KlipperSample sample : history) {
+      plot(sample.time, sample.extruderTemp / 10.0);
+    }
+
+  All storage is part of the object, its size is fixed by the template
+  arguments where it is declared.
+*/
+
+#ifndef KlipperHistory_h
+#define KlipperHistory_h
+
+#include <Arduino.h>
+#include "KlipperAPI.h"
+
+// One sample, either a single reading or the average of a bucket.
+// Temperatures are stored in tenths of a degree to keep samples small.
+typedef struct {
+  uint32_t time;            // millis() of the first reading
+  int16_t extruderTemp;     // 0.1 °C
+  int16_t extruderTarget;   // 0.1 °C
+  int16_t bedTemp;          // 0.1 °C
+  int16_t bedTarget;        // 0.1 °C
+  uint16_t progress;        // 0.01 %, 0-10000
+  uint8_t extruderPower;    // 0-255
+  uint8_t bedPower;         // 0-255
+  uint16_t readings;        // Readings averaged into this sample
+} KlipperSample;
+
+// Running statistics over every reading since clear(), including the
+// ones already averaged into buckets
+typedef struct {
+  float minimum;
+  float maximum;
+  float average;
+  uint32_t count;
+} KlipperHistoryStats;
+
+// Storage independent part of the history, see KlipperHistory below
+class KlipperHistoryBase {
+public:
+  // Walks the samples from oldest to newest
+  class Iterator {
+  public:
+    Iterator(const KlipperHistoryBase* history, uint16_t index) : _history(history), _index(index) {}
+    KlipperSample operator*() const { return (*_history)[_index]; }
+    Iterator& operator++() { _index++; return *this; }
+    bool operator!=(const Iterator& other) const { return _index != other._index; }
+
+  private:
+    const KlipperHistoryBase* _history;
+    uint16_t _index;
+  };
+
+  // Record the current printer status
+  void add(const KlipperApi& api);
+  // Record a reading; its readings field is ignored
+  void add(const KlipperSample& sample);
+  void clear();
+
+  // Samples available, 0 is the oldest
+  uint16_t size() const;
+  KlipperSample operator[](uint16_t index) const;
+  KlipperSample latest() const;
+  // Milliseconds between the oldest and the newest sample
+  uint32_t span() const;
+
+  Iterator begin() const { return Iterator(this, 0); }
+  Iterator end() const { return Iterator(this, size()); }
+
+  KlipperHistoryStats extruderStats;
+  KlipperHistoryStats bedStats;
+
+protected:
+  KlipperHistoryBase(KlipperSample* recent, uint16_t recentSize,
+                     KlipperSample* older, uint16_t olderSize, uint8_t factor);
+
+private:
+  KlipperHistoryBase(const KlipperHistoryBase&);
+  KlipperHistoryBase& operator=(const KlipperHistoryBase&);
+
+  // Sums of the readings waiting to become the next older bucket
+  typedef struct {
+    uint32_t time;
+    int32_t extruderTemp;
+    int32_t extruderTarget;
+    int32_t bedTemp;
+    int32_t bedTarget;
+    uint32_t progress;
+    uint16_t extruderPower;
+    uint16_t bedPower;
+    uint16_t readings;
+  } PendingBucket;
+
+  void addToBucket(const KlipperSample& sample);
+  KlipperSample bucketAverage() const;
+  void updateStats(KlipperHistoryStats& stats, int16_t value);
+  static void resetStats(KlipperHistoryStats& stats);
+
+  KlipperSample* _recent;
+  uint16_t _recentSize;
+  uint16_t _recentStart;
+  uint16_t _recentCount;
+
+  KlipperSample* _older;
+  uint16_t _olderSize;
+  uint16_t _olderStart;
+  uint16_t _olderCount;
+
+  uint8_t _factor;
+  PendingBucket _pending;
+};
+
+// History with RecentSize samples at full resolution followed by
+// OlderSize buckets, each averaging Factor samples. With OlderSize 0
+// samples leaving the recent part are dropped.
+template <uint16_t RecentSize, uint16_t OlderSize = 0, uint8_t Factor = 10>
+class KlipperHistory : public KlipperHistoryBase {
+  static_assert(RecentSize > 0, "KlipperHistory needs at least one recent sample");
+  static_assert(Factor > 0, "KlipperHistory needs a bucket factor of at least 1");
+
+public:
+  KlipperHistory() : KlipperHistoryBase(_samples, RecentSize, _samples + RecentSize, OlderSize, Factor) {}
+
+private:
+  KlipperSample _samples[RecentSize + OlderSize];
+};
+
+#endif
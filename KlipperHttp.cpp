@@ -0,0 +1,661 @@
+/*
+  KlipperHttp.cpp - HTTP helpers used by KlipperAPI
+*/
+
+#include "KlipperHttp.h"
+
+KlipperResponseHead::KlipperResponseHead() {
+  reset();
+}
+
+void KlipperResponseHead::reset() {
+  statusCode = 0;
+  contentLength = -1;
+  chunked = false;
+  connectionClose = false;
+  _lineLength = 0;
+  _bytesRead = 0;
+  _statusLine = true;
+}
+
+bool KlipperResponseHead::feed(char c) {
+  _bytesRead++;
+  if (c == '\r') {
+    return false;
+  }
+  
+  if (c != '\n') {
+    // Long lines are cut; only their start matters for the headers we read
+    if (_lineLength < sizeof(_line) - 1) {
+      _line[_lineLength++] = c;
+    }
+    return false;
+  }
+  
+  if (_lineLength == 0 && !_statusLine) {
+    return true;
+  }
+  
+  _line[_lineLength] = '\0';
+  parseLine();
+  _lineLength = 0;
+  return false;
+}
+
+void KlipperResponseHead::parseLine() {
+  if (_statusLine) {
+    // "HTTP/1.1 200 OK"
+    const char* code = strchr(_line, ' ');
+    statusCode = (code != nullptr) ? atoi(code + 1) : 0;
+    _statusLine = false;
+    return;
+  }
+  
+  // Header values are compared in lower case
+  char* value = strchr(_line, ':');
+  if (value == nullptr) {
+    return;
+  }
+  for (char* p = value; *p; p++) {
+    *p = tolower(*p);
+  }
+  
+  if (strncasecmp(_line, "content-length:", 15) == 0) {
+    contentLength = atol(value + 1);
+  } else if (strncasecmp(_line, "transfer-encoding:", 18) == 0) {
+    chunked = (strstr(value, "chunked") != nullptr);
+  } else if (strncasecmp(_line, "connection:", 11) == 0) {
+    connectionClose = (strstr(value, "close") != nullptr);
+  }
+}
+
+KlipperBodyStream::KlipperBodyStream() {
+  _client = nullptr;
+  _replay = nullptr;
+  _replayLeft = 0;
+  _remaining = 0;
+  _timeoutMs = 0;
+  _bytesRead = 0;
+  _chunked = false;
+  _lastChunk = false;
+  _chunkCount = 0;
+  setTimeout(0); // read() already waits, Stream::timedRead must not wait again
+}
+
+void KlipperBodyStream::begin(Client* client, long contentLength, unsigned long timeoutMs) {
+  _client = client;
+  _replay = nullptr;
+  _replayLeft = 0;
+  _remaining = contentLength;
+  _timeoutMs = timeoutMs;
+  _bytesRead = 0;
+  _chunked = false;
+  _lastChunk = false;
+  _chunkCount = 0;
+}
+
+void KlipperBodyStream::begin(Client* client, const KlipperResponseHead& head, unsigned long timeoutMs) {
+  // Content-Length is meaningless next to chunked encoding (RFC 7230 3.3.3)
+  begin(client, head.chunked ? 0 : head.contentLength, timeoutMs);
+  _chunked = head.chunked;
+}
+
+void KlipperBodyStream::replay(const char* data, size_t length) {
+  _replay = data;
+  _replayLeft = length;
+}
+
+void KlipperBodyStream::end() {
+  _client = nullptr;
+  _replayLeft = 0;
+  _remaining = 0;
+  _chunked = false;
+}
+
+// The client's bytes, after any that are replayed
+int KlipperBodyStream::sourceAvailable() {
+  return _replayLeft > 0 ? (int)_replayLeft : _client->available();
+}
+
+int KlipperBodyStream::sourceRead() {
+  if (_replayLeft > 0) {
+    _replayLeft--;
+    return (uint8_t)*_replay++;
+  }
+  return _client->read();
+}
+
+int KlipperBodyStream::sourcePeek() {
+  return _replayLeft > 0 ? (uint8_t)*_replay : _client->peek();
+}
+
+// Wait until a byte is available, the server closes or the timeout expires
+bool KlipperBodyStream::waitForData() {
+  if (_client == nullptr || _remaining == 0) {
+    return false;
+  }
+  
+  unsigned long start = millis();
+  while (!sourceAvailable()) {
+    if (!_client->connected() || millis() - start >= _timeoutMs) {
+      return false;
+    }
+    delay(1);
+  }
+  return true;
+}
+
+// Read one CRLF terminated line of chunk framing, -1 on timeout or close
+int KlipperBodyStream::readLine(char* line, size_t size) {
+  size_t length = 0;
+  unsigned long start = millis();
+  
+  while (true) {
+    int c = sourceRead();
+    if (c < 0) {
+      if (!_client->connected() || millis() - start >= _timeoutMs) {
+        return -1;
+      }
+      delay(1);
+      continue;
+    }
+    
+    if (c == '\n') {
+      line[length] = '\0';
+      return (int)length;
+    }
+    if (c != '\r' && length < size - 1) {
+      line[length++] = (char)c;
+    }
+  }
+}
+
+// Move to the next chunk: "<hex size>[;ext]\r\n<data>\r\n". The final
+// zero sized chunk is followed by optional trailers and an empty line.
+bool KlipperBodyStream::nextChunk() {
+  if (_client == nullptr || _lastChunk) {
+    return false;
+  }
+  
+  char line[KAPI_CHUNK_LINE_SIZE];
+  
+  // CRLF closing the previous chunk's data
+  if (_chunkCount > 0 && readLine(line, sizeof(line)) != 0) {
+    _client = nullptr; // Framing lost, complete() stays false
+    return false;
+  }
+  
+  if (readLine(line, sizeof(line)) <= 0) {
+    _client = nullptr;
+    return false;
+  }
+  
+  char* end;
+  long size = strtol(line, &end, 16);
+  if (end == line || size < 0) {
+    _client = nullptr;
+    return false;
+  }
+  _chunkCount++;
+  
+  if (size == 0) {
+    int length;
+    while ((length = readLine(line, sizeof(line))) > 0) {
+    }
+    if (length == 0) {
+      _lastChunk = true;
+    } else {
+      _client = nullptr;
+    }
+    return false;
+  }
+  
+  _remaining = size;
+  return true;
+}
+
+int KlipperBodyStream::available() {
+  if (_client == nullptr || _remaining == 0) {
+    return 0;
+  }
+  
+  int avail = sourceAvailable();
+  if (_remaining > 0 && avail > _remaining) {
+    avail = (int)_remaining;
+  }
+  return avail;
+}
+
+int KlipperBodyStream::read() {
+  if (_chunked && _remaining == 0 && !nextChunk()) {
+    return -1;
+  }
+  
+  if (!waitForData()) {
+    return -1;
+  }
+  
+  int c = sourceRead();
+  if (c >= 0) {
+    _bytesRead++;
+    if (_remaining > 0) _remaining--;
+  }
+  return c;
+}
+
+int KlipperBodyStream::peek() {
+  if (_chunked && _remaining == 0 && !nextChunk()) {
+    return -1;
+  }
+  
+  if (!waitForData()) {
+    return -1;
+  }
+  return sourcePeek();
+}
+
+bool KlipperBodyStream::drain() {
+  while (read() >= 0) {
+  }
+  return complete();
+}
+
+#if KAPI_ENABLE_ASYNC
+enum {
+  CHUNK_SIZE,            // Hex size line
+  CHUNK_EXTENSION,       // ;name=value after the size
+  CHUNK_DATA,
+  CHUNK_DATA_END,        // CRLF after the data
+  CHUNK_TRAILER          // Trailer lines after the last chunk, up to an empty one
+};
+
+KlipperBodyBuffer::KlipperBodyBuffer() {
+  _client = nullptr;
+  _length = 0;
+  _contentLength = -1;
+  _chunkLeft = 0;
+  _chunkState = CHUNK_SIZE;
+  _chunked = false;
+  _lineEmpty = true;
+  _complete = false;
+}
+
+void KlipperBodyBuffer::begin(Client* client, const KlipperResponseHead& head) {
+  _client = client;
+  _length = 0;
+  _contentLength = head.chunked ? -1 : head.contentLength;
+  _chunked = head.chunked;
+  _chunkLeft = 0;
+  _chunkState = CHUNK_SIZE;
+  _lineEmpty = true;
+  _complete = (_contentLength == 0);
+}
+
+bool KlipperBodyBuffer::collect() {
+  bool progress = false;
+  while (!_complete && !full()) {
+    int available = _client->available();
+    if (available <= 0) {
+      break;
+    }
+    
+    size_t size = sizeof(_buffer) - _length;
+    if ((size_t)available < size) size = available;
+    if (_contentLength >= 0 && remaining() < (long)size) size = remaining();
+    int count = _client->read((uint8_t*)_buffer + _length, size);
+    if (count <= 0) {
+      break;
+    }
+    
+    if (_chunked) {
+      scanChunked(_buffer + _length, count);
+    }
+    _length += count;
+    progress = true;
+    if (_contentLength >= 0 && remaining() == 0) {
+      _complete = true;
+    }
+  }
+  
+  // A body without framing ends when the server closes
+  if (!_complete && !_chunked && _contentLength < 0 && _client->available() <= 0 && !_client->connected()) {
+    _complete = true;
+  }
+  return progress;
+}
+
+// Follow the chunk framing only to find the end of the body; the data
+// itself is decoded later by KlipperBodyStream
+void KlipperBodyBuffer::scanChunked(const char* data, size_t length) {
+  for (size_t i = 0; i < length && !_complete; i++) {
+    char c = data[i];
+    switch (_chunkState) {
+      case CHUNK_DATA: {
+        size_t skip = (size_t)_chunkLeft < length - i ? (size_t)_chunkLeft : length - i;
+        _chunkLeft -= skip;
+        i += skip - 1;
+        if (_chunkLeft == 0) {
+          _chunkState = CHUNK_DATA_END;
+        }
+        break;
+      }
+      case CHUNK_DATA_END:
+        if (c == '\n') {
+          _chunkState = CHUNK_SIZE;
+        }
+        break;
+      case CHUNK_SIZE:
+        if (isxdigit((unsigned char)c)) {
+          _chunkLeft = _chunkLeft * 16 + (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+          break;
+        }
+        if (c == ';') {
+          _chunkState = CHUNK_EXTENSION;
+          break;
+        }
+        // fall through
+      case CHUNK_EXTENSION:
+        if (c == '\n') {
+          _chunkState = _chunkLeft > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+          _lineEmpty = true;
+        }
+        break;
+      case CHUNK_TRAILER:
+        if (c == '\n') {
+          _complete = _lineEmpty;
+          _lineEmpty = true;
+        } else if (c != '\r') {
+          _lineEmpty = false;
+        }
+        break;
+    }
+  }
+}
+#endif
+
+KlipperRequestWriter::KlipperRequestWriter(Client* client) {
+  _client = client;
+  _length = 0;
+  _written = 0;
+  _ok = true;
+  _allocated = false;
+  _heapMark = KAPI_HEAP_FREE();
+}
+
+void KlipperRequestWriter::print(const char* str) {
+  if (str != nullptr) {
+    write(str, strlen(str));
+  }
+}
+
+void KlipperRequestWriter::print(char c) {
+  if (_length == sizeof(_buffer)) {
+    flush();
+  }
+  _buffer[_length++] = c;
+}
+
+void KlipperRequestWriter::print(uint32_t value) {
+  char digits[10];
+  uint8_t count = 0;
+  do {
+    digits[count++] = '0' + (value % 10);
+    value /= 10;
+  } while (value > 0);
+  
+  while (count > 0) {
+    print(digits[--count]);
+  }
+}
+
+void KlipperRequestWriter::write(const char* data, size_t length) {
+  while (length > 0) {
+    if (_length == sizeof(_buffer)) {
+      flush();
+    }
+    
+    size_t chunk = sizeof(_buffer) - _length;
+    if (chunk > length) chunk = length;
+    memcpy(_buffer + _length, data, chunk);
+    _length += chunk;
+    data += chunk;
+    length -= chunk;
+  }
+}
+
+#if KAPI_ENABLE_UPLOAD
+size_t KlipperRequestWriter::writeFrom(Stream& in, size_t length) {
+  size_t copied = 0;
+  while (copied < length && _ok) {
+    if (_length == sizeof(_buffer)) {
+      flush();
+    }
+    
+    size_t chunk = sizeof(_buffer) - _length;
+    if (chunk > length - copied) chunk = length - copied;
+    size_t read = in.readBytes(_buffer + _length, chunk);
+    _length += read;
+    copied += read;
+    if (read < chunk) {
+      break;
+    }
+  }
+  return copied;
+}
+#endif
+
+void KlipperRequestWriter::printJsonEscaped(const char* data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    char c = data[i];
+    switch (c) {
+      case '"':  print("\\\""); break;
+      case '\\': print("\\\\"); break;
+      case '\n': print("\\n"); break;
+      case '\r': print("\\r"); break;
+      case '\t': print("\\t"); break;
+      default:
+        if ((uint8_t)c < 0x20) {
+          static const char hex[] = "0123456789abcdef";
+          print("\\u00");
+          print(hex[(c >> 4) & 0x0F]);
+          print(hex[c & 0x0F]);
+        } else {
+          print(c);
+        }
+    }
+  }
+}
+
+uint32_t KlipperRequestWriter::jsonEscapedLength(const char* data, size_t length) {
+  uint32_t escaped = 0;
+  for (size_t i = 0; i < length; i++) {
+    char c = data[i];
+    if (c == '"' || c == '\\' || c == '\n' || c == '\r' || c == '\t') {
+      escaped += 2;
+    } else if ((uint8_t)c < 0x20) {
+      escaped += 6;
+    } else {
+      escaped += 1;
+    }
+  }
+  return escaped;
+}
+
+// Heap drops between client writes come from formatting, not the network stack
+void KlipperRequestWriter::checkHeap() {
+  if (KAPI_HEAP_FREE() < _heapMark) {
+    _allocated = true;
+  }
+}
+
+void KlipperRequestWriter::flush() {
+  checkHeap();
+  if (_length > 0) {
+    size_t sent = _client->write((const uint8_t*)_buffer, _length);
+    if (sent != _length) _ok = false;
+    _written += sent;
+    _length = 0;
+  }
+  _heapMark = KAPI_HEAP_FREE();
+}
+
+bool KlipperRequestWriter::finish() {
+  flush();
+  return _ok;
+}
+
+KlipperScriptBody::KlipperScriptBody(const char* script, size_t length) {
+  _script = script;
+  _scriptLength = length;
+  _commands = nullptr;
+  _count = 0;
+}
+
+KlipperScriptBody::KlipperScriptBody(const char* const* commands, uint8_t count) {
+  _script = nullptr;
+  _scriptLength = 0;
+  _commands = commands;
+  _count = count;
+}
+
+// {"script":"<escaped>"} is 13 bytes around the escaped script
+uint32_t KlipperScriptBody::length() {
+  uint32_t length = 13;
+  if (_commands == nullptr) {
+    return length + KlipperRequestWriter::jsonEscapedLength(_script, _scriptLength);
+  }
+  
+  for (uint8_t i = 0; i < _count; i++) {
+    if (i > 0) length += 2; // Escaped newline
+    length += KlipperRequestWriter::jsonEscapedLength(_commands[i], strlen(_commands[i]));
+  }
+  return length;
+}
+
+void KlipperScriptBody::writeTo(KlipperRequestWriter& out) {
+  out.print("{\"script\":\"");
+  if (_commands == nullptr) {
+    out.printJsonEscaped(_script, _scriptLength);
+  } else {
+    for (uint8_t i = 0; i < _count; i++) {
+      if (i > 0) out.print("\\n");
+      out.printJsonEscaped(_commands[i], strlen(_commands[i]));
+    }
+  }
+  out.print("\"}");
+}
+
+#if KAPI_ENABLE_UPLOAD
+// Fixed boundary; a file would have to contain this line to break the form
+#define UPLOAD_BOUNDARY "KlipperAPI-Upload-5f0c7e2a9b41d386"
+
+static const char uploadEpilogue[] = "\r\n--" UPLOAD_BOUNDARY "--\r\n";
+
+// Write a piece of the body, or only count it when out is nullptr
+static uint32_t bodyPart(KlipperRequestWriter* out, const char* text, size_t length) {
+  if (out != nullptr) {
+    out->write(text, length);
+  }
+  return length;
+}
+
+static uint32_t bodyPart(KlipperRequestWriter* out, const char* text) {
+  return bodyPart(out, text, strlen(text));
+}
+
+KlipperUploadBody::KlipperUploadBody() {
+  memset(&progress, 0, sizeof(progress));
+  _file = nullptr;
+  _filename = "";
+  _pathLength = 0;
+  _size = 0;
+  _startTime = 0;
+  _callback = nullptr;
+  _print = false;
+  _incremental = false;
+  _failed = false;
+}
+
+bool KlipperUploadBody::begin(Stream* file, const char* filename, uint32_t size, bool print) {
+  while (*filename == '/') filename++;
+  if (*filename == '\0' || filename[strlen(filename) - 1] == '/' || strpbrk(filename, "\"\r\n") != nullptr) {
+    return false;
+  }
+  
+  const char* slash = strrchr(filename, '/');
+  _pathLength = (slash != nullptr) ? (size_t)(slash - filename) : 0;
+  _file = file;
+  _filename = filename;
+  _size = size;
+  _print = print;
+  _failed = false;
+  memset(&progress, 0, sizeof(progress));
+  progress.total = size;
+  return true;
+}
+
+const char* KlipperUploadBody::contentType() {
+  return "multipart/form-data; boundary=" UPLOAD_BOUNDARY;
+}
+
+uint32_t KlipperUploadBody::length() {
+  return writePreamble(nullptr) + _size + (sizeof(uploadEpilogue) - 1);
+}
+
+// Form fields up to the start of the file data. Moonraker takes the
+// directory as a separate "path" field.
+uint32_t KlipperUploadBody::writePreamble(KlipperRequestWriter* out) {
+  uint32_t length = bodyPart(out, "--" UPLOAD_BOUNDARY "\r\n"
+                                  "Content-Disposition: form-data; name=\"root\"\r\n\r\ngcodes\r\n");
+  if (_pathLength > 0) {
+    length += bodyPart(out, "--" UPLOAD_BOUNDARY "\r\n"
+                            "Content-Disposition: form-data; name=\"path\"\r\n\r\n");
+    length += bodyPart(out, _filename, _pathLength);
+    length += bodyPart(out, "\r\n");
+  }
+  if (_print) {
+    length += bodyPart(out, "--" UPLOAD_BOUNDARY "\r\n"
+                            "Content-Disposition: form-data; name=\"print\"\r\n\r\ntrue\r\n");
+  }
+  length += bodyPart(out, "--" UPLOAD_BOUNDARY "\r\n"
+                          "Content-Disposition: form-data; name=\"file\"; filename=\"");
+  length += bodyPart(out, _pathLength > 0 ? _filename + _pathLength + 1 : _filename);
+  length += bodyPart(out, "\"\r\nContent-Type: application/octet-stream\r\n\r\n");
+  return length;
+}
+
+void KlipperUploadBody::writeTo(KlipperRequestWriter& out) {
+  _startTime = millis();
+  writePreamble(&out);
+  if (_incremental) {
+    return;
+  }
+  while (!writeChunk(out)) {
+  }
+}
+
+bool KlipperUploadBody::writeChunk(KlipperRequestWriter& out) {
+  uint32_t left = _size - progress.sent;
+  uint32_t chunk = (left < KAPI_UPLOAD_CHUNK_SIZE) ? left : KAPI_UPLOAD_CHUNK_SIZE;
+  size_t copied = out.writeFrom(*_file, chunk);
+  
+  progress.sent += copied;
+  progress.elapsed = millis() - _startTime;
+  if (progress.elapsed > 0) {
+    progress.bytesPerSecond = (uint32_t)((uint64_t)progress.sent * 1000 / progress.elapsed);
+  }
+  if (_callback != nullptr) {
+    _callback(progress);
+  }
+  
+  if (copied < chunk) {
+    _failed = true;
+    return true;
+  }
+  if (progress.sent == _size) {
+    out.write(uploadEpilogue, sizeof(uploadEpilogue) - 1);
+    return true;
+  }
+  return false;
+}
+#endif
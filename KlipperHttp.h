@@ -0,0 +1,282 @@
+/*
+  KlipperHttp.h - HTTP helpers used by KlipperAPI
+
+  Small building blocks for talking HTTP/1.1 to Moonraker over an Arduino
+  Client without buffering whole responses in RAM.
+*/
+
+#ifndef KlipperHttp_h
+#define KlipperHttp_h
+
+#include <Arduino.h>
+#include <Client.h>
+#include "KlipperConfig.h"
+
+#ifndef KAPI_WRITE_BUFFER_SIZE
+#define KAPI_WRITE_BUFFER_SIZE 256   // Stack buffer for outgoing requests
+#endif
+#define KAPI_HEADER_LINE_SIZE  64    // Longest response header line kept for parsing
+#define KAPI_CHUNK_LINE_SIZE   20    // Chunk size line of a chunked body
+#ifndef KAPI_UPLOAD_CHUNK_SIZE
+#define KAPI_UPLOAD_CHUNK_SIZE 2048  // File bytes written per upload step
+#endif
+#ifndef KAPI_ASYNC_BODY_SIZE
+#define KAPI_ASYNC_BODY_SIZE   1536  // Response body a non-blocking request collects before parsing
+#endif
+
+// Free heap probe used to check that request building does not allocate.
+// Host builds can define their own before including the library.
+#ifndef KAPI_HEAP_FREE
+#if defined(ESP8266) || defined(ESP32)
+#define KAPI_HEAP_FREE() ((uint32_t)ESP.getFreeHeap())
+#else
+#define KAPI_HEAP_FREE() ((uint32_t)0)
+#endif
+#endif
+
+// Writes a request to the client in pieces through a fixed stack buffer.
+//
+// Request line, headers and body are appended piece by piece and sent in
+// buffer sized chunks, so building a request needs no String and no heap.
+// The free heap is sampled between client writes; any drop while pieces
+// were being formatted marks the request as allocating.
+class KlipperRequestWriter {
+public:
+  explicit KlipperRequestWriter(Client* client);
+
+  void print(const char* str);
+  void print(char c);
+  void print(uint32_t value);
+  void write(const char* data, size_t length);
+  // Write data as the inside of a JSON string, escaping as it goes
+  void printJsonEscaped(const char* data, size_t length);
+  static uint32_t jsonEscapedLength(const char* data, size_t length);
+#if KAPI_ENABLE_UPLOAD
+  // Read up to length bytes from in straight into the buffer, returns
+  // how many the stream delivered
+  size_t writeFrom(Stream& in, size_t length);
+#endif
+
+  // Send what is still buffered, returns false if the client refused bytes
+  bool finish();
+
+  uint32_t bytesWritten() const { return _written; }
+  bool allocated() const { return _allocated; }
+
+private:
+  void flush();
+  void checkHeap();
+
+  Client *_client;
+  char _buffer[KAPI_WRITE_BUFFER_SIZE];
+  size_t _length;
+  uint32_t _written;
+  uint32_t _heapMark;
+  bool _ok;
+  bool _allocated;
+};
+
+// Request body produced while the request is written, for bodies that are
+// never held in one buffer. length() must match what writeTo() produces.
+class KlipperBodySource {
+public:
+  virtual ~KlipperBodySource() {}
+  virtual uint32_t length() = 0;
+  virtual void writeTo(KlipperRequestWriter& out) = 0;
+  virtual const char* contentType() { return "application/json"; }
+};
+
+// {"script":"..."} body for /printer/gcode/script. Commands are escaped
+// while they are written, so scripts of any length need no POST buffer.
+class KlipperScriptBody : public KlipperBodySource {
+public:
+  // One script; newlines inside separate commands
+  KlipperScriptBody(const char* script, size_t length);
+  // Several commands, joined by newlines
+  KlipperScriptBody(const char* const* commands, uint8_t count);
+
+  uint32_t length() override;
+  void writeTo(KlipperRequestWriter& out) override;
+
+private:
+  const char* _script;
+  size_t _scriptLength;
+  const char* const* _commands;
+  uint8_t _count;
+};
+
+#if KAPI_ENABLE_UPLOAD
+// Progress of a file upload
+typedef struct {
+  uint32_t sent;                 // File bytes written so far
+  uint32_t total;                // File size
+  uint32_t elapsed;              // ms since the upload started
+  uint32_t bytesPerSecond;       // Measured throughput
+} KlipperUploadProgress;
+
+typedef void (*KlipperUploadCallback)(const KlipperUploadProgress& progress);
+
+// multipart/form-data body for /server/files/upload. The file is read from
+// its Stream through the request writer's buffer, KAPI_UPLOAD_CHUNK_SIZE
+// bytes per writeChunk(), so RAM use does not depend on the file size.
+class KlipperUploadBody : public KlipperBodySource {
+public:
+  KlipperUploadBody();
+
+  // filename may start with directories below the gcodes root and must
+  // outlive the upload. False if it cannot go into a form field.
+  bool begin(Stream* file, const char* filename, uint32_t size, bool print);
+  // writeTo() stops after the form fields; writeChunk() sends the rest
+  void setIncremental(bool incremental) { _incremental = incremental; }
+  void setCallback(KlipperUploadCallback callback) { _callback = callback; }
+
+  uint32_t length() override;
+  void writeTo(KlipperRequestWriter& out) override;
+  const char* contentType() override;
+
+  // Write the next chunk, and the closing boundary after the last one.
+  // Returns true when the body is complete or the file ended early.
+  bool writeChunk(KlipperRequestWriter& out);
+  // The file delivered fewer than size bytes
+  bool failed() const { return _failed; }
+
+  KlipperUploadProgress progress;
+
+private:
+  uint32_t writePreamble(KlipperRequestWriter* out);
+
+  Stream* _file;
+  const char* _filename;
+  size_t _pathLength;            // Directory part of _filename, without the last '/'
+  uint32_t _size;
+  unsigned long _startTime;
+  KlipperUploadCallback _callback;
+  bool _print;
+  bool _incremental;
+  bool _failed;
+};
+#endif
+
+// Incremental parser for an HTTP response head.
+//
+// Bytes are fed one at a time as they arrive, so a caller can read whatever
+// the client has available without blocking and continue on the next call.
+// Only the status code and the headers needed for framing are kept.
+class KlipperResponseHead {
+public:
+  KlipperResponseHead();
+
+  void reset();
+  // Feed one byte, returns true once the blank line ending the head was read
+  bool feed(char c);
+  // True once any part of the status line was received
+  bool started() const { return !_statusLine || _lineLength > 0; }
+  // Bytes fed since reset(), including line endings
+  uint16_t bytesRead() const { return _bytesRead; }
+
+  int statusCode;
+  long contentLength;      // -1 when the response has no Content-Length
+  bool chunked;            // Transfer-Encoding: chunked
+  bool connectionClose;    // Server sent "Connection: close"
+
+private:
+  void parseLine();
+
+  char _line[KAPI_HEADER_LINE_SIZE];
+  uint8_t _lineLength;
+  uint16_t _bytesRead;
+  bool _statusLine;
+};
+
+// Response body as a Stream.
+//
+// The JSON parser reads straight from this stream, so a response never has
+// to be copied into a String first. The body is framed by Content-Length or
+// by chunked transfer encoding, which is decoded on the fly; without either
+// it runs until the server closes. Reads wait up to the configured timeout
+// for the next byte and report end of stream once the body is consumed, which
+// leaves a kept-alive connection positioned at the next response.
+class KlipperBodyStream : public Stream {
+public:
+  KlipperBodyStream();
+
+  // Start a body of contentLength bytes; -1 reads until the server closes
+  void begin(Client* client, long contentLength, unsigned long timeoutMs);
+  // Start the body described by a parsed response head
+  void begin(Client* client, const KlipperResponseHead& head, unsigned long timeoutMs);
+  // Serve bytes already taken off the client before reading it again
+  void replay(const char* data, size_t length);
+  void end();
+
+  // Stream interface
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t write(uint8_t) override { return 0; }
+  void flush() override {}
+
+  // Discard whatever is left of the body, returns true if fully consumed
+  bool drain();
+
+  // True once a framed body has been read to the end
+  bool complete() const { return _chunked ? _lastChunk : _remaining == 0; }
+  uint32_t bytesRead() const { return _bytesRead; }
+
+private:
+  bool waitForData();
+  bool nextChunk();
+  int readLine(char* line, size_t size);
+  int sourceAvailable();
+  int sourceRead();
+  int sourcePeek();
+
+  Client *_client;
+  const char* _replay;       // Bytes served before the client's
+  size_t _replayLeft;
+  long _remaining;           // Body or current chunk bytes left
+  unsigned long _timeoutMs;
+  uint32_t _bytesRead;
+  bool _chunked;
+  bool _lastChunk;
+  uint16_t _chunkCount;
+};
+
+#if KAPI_ENABLE_ASYNC
+// Response body collected for a non-blocking request.
+//
+// collect() takes whatever the client already has, without waiting, and
+// follows the framing far enough to know when the body is complete; it is
+// called once per poll(). KlipperBodyStream then replays the bytes before
+// reading the client, so the parse does not wait for the network unless
+// the body is larger than the buffer.
+class KlipperBodyBuffer {
+public:
+  KlipperBodyBuffer();
+
+  void begin(Client* client, const KlipperResponseHead& head);
+  // Take what the client has; returns true if any bytes arrived
+  bool collect();
+  bool complete() const { return _complete; }
+  bool full() const { return _length == sizeof(_buffer); }
+  // Body bytes not collected yet, -1 unless framed by Content-Length
+  long remaining() const { return _contentLength >= 0 ? _contentLength - _length : -1; }
+
+  const char* data() const { return _buffer; }
+  uint16_t length() const { return _length; }
+
+private:
+  void scanChunked(const char* data, size_t length);
+
+  Client* _client;
+  char _buffer[KAPI_ASYNC_BODY_SIZE];
+  uint16_t _length;
+  long _contentLength;             // -1 when not framed by Content-Length
+  long _chunkLeft;                 // Size, then data bytes left, of the current chunk
+  uint8_t _chunkState;
+  bool _chunked;
+  bool _lineEmpty;                 // Nothing yet on the current trailer line
+  bool _complete;
+};
+#endif
+
+#endif
@@ -0,0 +1,74 @@
+/*
+  KlipperJsonPool.cpp - Reusable JSON document for KlipperAPI
+*/
+
+#include "KlipperJsonPool.h"
+
+void* KlipperPoolAllocator::allocate(size_t size) {
+  if (size == 0) {
+    return nullptr;
+  }
+  if (_pool->_buffer != nullptr) {
+    return size <= _pool->_bufferSize ? _pool->_buffer : nullptr;
+  }
+  _pool->growCount++;
+  return malloc(size);
+}
+
+void KlipperPoolAllocator::deallocate(void* pointer) {
+  if (pointer != _pool->_buffer) {
+    free(pointer);
+  }
+}
+
+// Only used by shrinkToFit() and garbageCollect(), which the library does
+// not call; a supplied buffer cannot move
+void* KlipperPoolAllocator::reallocate(void* pointer, size_t size) {
+  if (pointer == _pool->_buffer) {
+    return size <= _pool->_bufferSize ? pointer : nullptr;
+  }
+  return realloc(pointer, size);
+}
+
+// Nothing is allocated until the first acquire(). Capacities are kept a
+// multiple of a pointer, as ArduinoJson pads them.
+KlipperJsonPool::KlipperJsonPool(size_t capacity, size_t maxCapacity)
+  : _doc(0, KlipperPoolAllocator(this)),
+    _wanted((capacity + sizeof(void*) - 1) & ~(sizeof(void*) - 1)),
+    _maxCapacity(maxCapacity & ~(sizeof(void*) - 1)) {
+}
+
+void KlipperJsonPool::setBuffer(void* buffer, size_t size) {
+  // Release the old buffer before the new one is handed out
+  _doc = BasicJsonDocument<KlipperPoolAllocator>(0, KlipperPoolAllocator(this));
+  _buffer = buffer;
+  _bufferSize = size & ~(sizeof(void*) - 1);
+  _wanted = buffer != nullptr ? _bufferSize : _wanted;
+}
+
+JsonDocument& KlipperJsonPool::acquire() {
+  if (_doc.capacity() != _wanted) {
+    // Free first so the heap never holds the old and new buffer at once
+    _doc = BasicJsonDocument<KlipperPoolAllocator>(0, KlipperPoolAllocator(this));
+    _doc = BasicJsonDocument<KlipperPoolAllocator>(_wanted, KlipperPoolAllocator(this));
+    if (_doc.capacity() == 0) {
+      // Out of memory; try the same size again next time
+      return _doc;
+    }
+  }
+  _doc.clear();
+  return _doc;
+}
+
+void KlipperJsonPool::release() {
+  if (_doc.memoryUsage() > peakUsage) {
+    peakUsage = _doc.memoryUsage();
+  }
+
+  if (_doc.overflowed()) {
+    overflowCount++;
+    if (_buffer == nullptr && _wanted < _maxCapacity) {
+      _wanted = (_wanted * 2 < _maxCapacity) ? _wanted * 2 : _maxCapacity;
+    }
+  }
+}
@@ -0,0 +1,74 @@
+/*
+  KlipperJsonPool.h - Reusable JSON document for KlipperAPI
+
+  Every response is parsed into the same document instead of a fresh
+  DynamicJsonDocument, so polling does not malloc/free a large block per
+  request and fragment the heap over long uptimes. The buffer behind it is
+  allocated on first use, or supplied by the sketch:
+
+    static uint32_t jsonBuffer[512];             // 2 KB, word aligned
+    api.jsonPool.setBuffer(jsonBuffer, sizeof(jsonBuffer));
+
+  A heap buffer starts at JSONDOCUMENT_SIZE and doubles, up to
+  KAPI_JSON_POOL_MAX, after a response did not fit; the library then
+  sends the request again into the larger buffer. A supplied buffer is
+  never grown. overflowCount tells whether capacity needs tuning.
+*/
+
+#ifndef KlipperJsonPool_h
+#define KlipperJsonPool_h
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "KlipperConfig.h"
+
+class KlipperJsonPool;
+
+// Lets a BasicJsonDocument use the pool's buffer
+struct KlipperPoolAllocator {
+  KlipperPoolAllocator(KlipperJsonPool* pool) : _pool(pool) {}
+  void* allocate(size_t size);
+  void deallocate(void* pointer);
+  void* reallocate(void* pointer, size_t size);
+
+  KlipperJsonPool* _pool;
+};
+
+class KlipperJsonPool {
+public:
+  KlipperJsonPool(size_t capacity, size_t maxCapacity);
+
+  // Parse into a caller owned buffer from now on. It must be aligned for a
+  // pointer and outlive the pool; nullptr goes back to the heap.
+  void setBuffer(void* buffer, size_t size);
+
+  // The cleared document for one parse. Its content stays readable until
+  // the next acquire(), so results must be used before another request.
+  JsonDocument& acquire();
+  // Record the parse that used the document; one that overflowed grows
+  // the next acquire() if the buffer is on the heap
+  void release();
+  // The last parse ran out of memory and the next acquire() offers more,
+  // so repeating its request can succeed
+  bool outgrown() const { return _doc.overflowed() && _wanted > _doc.capacity(); }
+
+  size_t capacity() const { return _doc.capacity(); }
+
+  uint32_t overflowCount = 0;    // Parses that ran out of document memory
+  uint32_t growCount = 0;        // Heap buffer (re)allocations
+  size_t peakUsage = 0;          // Largest memoryUsage() after a parse
+
+private:
+  friend struct KlipperPoolAllocator;
+
+  KlipperJsonPool(const KlipperJsonPool&);
+  KlipperJsonPool& operator=(const KlipperJsonPool&);
+
+  BasicJsonDocument<KlipperPoolAllocator> _doc;
+  void* _buffer = nullptr;       // Supplied buffer, nullptr for the heap
+  size_t _bufferSize = 0;
+  size_t _wanted;                // Capacity the next acquire() provides
+  size_t _maxCapacity;
+};
+
+#endif
@@ -0,0 +1,205 @@
+/*
+  KlipperMetrics.cpp - Per endpoint request metrics for KlipperAPI
+*/
+
+#include "KlipperMetrics.h"
+
+#if KAPI_ENABLE_METRICS
+
+// Counters exported by printPrometheus()
+#define COUNTER_REQUESTS       0
+#define COUNTER_ERRORS         1
+#define COUNTER_TIMEOUTS       2
+#define COUNTER_BYTES_SENT     3
+#define COUNTER_BYTES_RECEIVED 4
+
+static const char* const phaseNames[KAPI_PHASE_COUNT] = { "connect", "first_byte", "body", "parse" };
+
+KlipperMetrics::KlipperMetrics() {
+  reset();
+}
+
+void KlipperMetrics::reset() {
+  memset(_endpoints, 0, sizeof(_endpoints));
+  _count = 0;
+  _current = -1;
+  _running = 0;
+  _error = false;
+  _timeout = false;
+}
+
+const KlipperEndpointMetrics* KlipperMetrics::find(const char* path) const {
+  for (uint8_t i = 0; i < _count; i++) {
+    if (strcmp(_endpoints[i].path, path) == 0) {
+      return &_endpoints[i];
+    }
+  }
+  return nullptr;
+}
+
+uint32_t KlipperMetrics::mean(const KlipperLatency& latency) {
+  return latency.count > 0 ? (uint32_t)(latency.total / latency.count) : 0;
+}
+
+// Slot of the endpoint's path, claiming a free one the first time. Query
+// strings are left out so every object query shares one slot.
+int8_t KlipperMetrics::slotFor(const char* endpoint) {
+  size_t length = strcspn(endpoint, "?");
+  if (length >= KAPI_METRICS_PATH_SIZE) {
+    length = KAPI_METRICS_PATH_SIZE - 1;
+  }
+
+  for (uint8_t i = 0; i < _count; i++) {
+    if (strncmp(_endpoints[i].path, endpoint, length) == 0 && _endpoints[i].path[length] == '\0') {
+      return i;
+    }
+  }
+
+  if (_count == KAPI_METRICS_ENDPOINTS - 1) {
+    strcpy(_endpoints[_count].path, "other");
+    _count++;
+  }
+  if (_count == KAPI_METRICS_ENDPOINTS) {
+    return KAPI_METRICS_ENDPOINTS - 1;
+  }
+
+  memcpy(_endpoints[_count].path, endpoint, length);
+  _endpoints[_count].path[length] = '\0';
+  return _count++;
+}
+
+// A request that is begun again (a resend after reconnecting) keeps
+// counting as the same request
+void KlipperMetrics::beginRequest(const char* endpoint) {
+  _current = slotFor(endpoint);
+  _running = 0;
+  _error = false;
+  _timeout = false;
+}
+
+void KlipperMetrics::startPhase(uint8_t phase) {
+  _phaseStart[phase] = micros();
+  _running |= (1 << phase);
+}
+
+void KlipperMetrics::endPhase(uint8_t phase) {
+  if (_current < 0 || !(_running & (1 << phase))) {
+    return;
+  }
+  _running &= ~(1 << phase);
+
+  uint32_t elapsed = micros() - _phaseStart[phase];
+  KlipperLatency& latency = _endpoints[_current].phases[phase];
+  if (latency.count == 0 || elapsed < latency.minimum) latency.minimum = elapsed;
+  if (elapsed > latency.maximum) latency.maximum = elapsed;
+  latency.total += elapsed;
+  latency.count++;
+}
+
+void KlipperMetrics::addBytes(uint32_t sent, uint32_t received) {
+  if (_current < 0) {
+    return;
+  }
+  _endpoints[_current].bytesSent += sent;
+  _endpoints[_current].bytesReceived += received;
+}
+
+// Count the request once; phases still running are dropped
+void KlipperMetrics::finishRequest() {
+  if (_current < 0) {
+    return;
+  }
+
+  KlipperEndpointMetrics& endpoint = _endpoints[_current];
+  endpoint.requests++;
+  if (_error || _timeout) endpoint.errors++;
+  if (_timeout) endpoint.timeouts++;
+
+  _current = -1;
+  _running = 0;
+}
+
+void KlipperMetrics::printPrometheus(Print& out, const char* prefix) const {
+  printCounter(out, prefix, "requests_total", "Requests sent to Moonraker", COUNTER_REQUESTS);
+  printCounter(out, prefix, "errors_total", "Requests that failed, including timeouts", COUNTER_ERRORS);
+  printCounter(out, prefix, "timeouts_total", "Requests that timed out", COUNTER_TIMEOUTS);
+  printCounter(out, prefix, "sent_bytes_total", "Request bytes written", COUNTER_BYTES_SENT);
+  printCounter(out, prefix, "received_bytes_total", "Response bytes read", COUNTER_BYTES_RECEIVED);
+  printLatency(out, prefix);
+}
+
+void KlipperMetrics::printCounter(Print& out, const char* prefix, const char* name, const char* help, uint8_t field) const {
+  out.print("# HELP "); out.print(prefix); out.print('_'); out.print(name); out.print(' '); out.println(help);
+  out.print("# TYPE "); out.print(prefix); out.print('_'); out.print(name); out.println(" counter");
+
+  for (uint8_t i = 0; i < _count; i++) {
+    const KlipperEndpointMetrics& endpoint = _endpoints[i];
+    uint32_t value = 0;
+    switch (field) {
+      case COUNTER_REQUESTS: value = endpoint.requests; break;
+      case COUNTER_ERRORS: value = endpoint.errors; break;
+      case COUNTER_TIMEOUTS: value = endpoint.timeouts; break;
+      case COUNTER_BYTES_SENT: value = endpoint.bytesSent; break;
+      case COUNTER_BYTES_RECEIVED: value = endpoint.bytesReceived; break;
+    }
+    out.print(prefix); out.print('_'); out.print(name);
+    printLabels(out, endpoint.path, nullptr);
+    out.println(value);
+  }
+}
+
+// Phase latencies as a summary without quantiles, plus min/max/mean gauges
+void KlipperMetrics::printLatency(Print& out, const char* prefix) const {
+  static const char* const gauges[] = { "min", "max", "mean" };
+
+  out.print("# HELP "); out.print(prefix); out.println("_latency_seconds Time spent per request phase");
+  out.print("# TYPE "); out.print(prefix); out.println("_latency_seconds summary");
+  for (uint8_t i = 0; i < _count; i++) {
+    for (uint8_t phase = 0; phase < KAPI_PHASE_COUNT; phase++) {
+      const KlipperLatency& latency = _endpoints[i].phases[phase];
+      if (latency.count == 0) continue;
+      out.print(prefix); out.print("_latency_seconds_sum");
+      printLabels(out, _endpoints[i].path, phaseNames[phase]);
+      printSeconds(out, latency.total);
+      out.println();
+      out.print(prefix); out.print("_latency_seconds_count");
+      printLabels(out, _endpoints[i].path, phaseNames[phase]);
+      out.println(latency.count);
+    }
+  }
+
+  for (uint8_t g = 0; g < 3; g++) {
+    out.print("# TYPE "); out.print(prefix); out.print("_latency_"); out.print(gauges[g]); out.println("_seconds gauge");
+    for (uint8_t i = 0; i < _count; i++) {
+      for (uint8_t phase = 0; phase < KAPI_PHASE_COUNT; phase++) {
+        const KlipperLatency& latency = _endpoints[i].phases[phase];
+        if (latency.count == 0) continue;
+        out.print(prefix); out.print("_latency_"); out.print(gauges[g]); out.print("_seconds");
+        printLabels(out, _endpoints[i].path, phaseNames[phase]);
+        printSeconds(out, g == 0 ? latency.minimum : (g == 1 ? latency.maximum : mean(latency)));
+        out.println();
+      }
+    }
+  }
+}
+
+// {endpoint="/printer/info",phase="connect"} followed by a space
+void KlipperMetrics::printLabels(Print& out, const char* path, const char* phase) {
+  out.print("{endpoint=\"");
+  out.print(path);
+  if (phase != nullptr) {
+    out.print("\",phase=\"");
+    out.print(phase);
+  }
+  out.print("\"} ");
+}
+
+// Microseconds as decimal seconds without going through float
+void KlipperMetrics::printSeconds(Print& out, uint64_t micros) {
+  char fraction[8];
+  snprintf(fraction, sizeof(fraction), ".%06lu", (unsigned long)(micros % 1000000));
+  out.print((unsigned long)(micros / 1000000));
+  out.print(fraction);
+}
+
+#endif
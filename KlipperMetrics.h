@@ -0,0 +1,107 @@
+/*
+  KlipperMetrics.h - Per endpoint request metrics for KlipperAPI
+
+  Counts requests, errors, timeouts and bytes for every Moonraker endpoint
+  and keeps min/max/mean latency of each request phase:
+
+    connect     opening a new TCP connection (not sampled on reuse)
+    first_byte  from writing the request to the first response byte
+    body        from the end of the response head until the response is done
+    parse       deserializeJson(); the parser reads the body straight off the
+                connection, so this includes waiting for body bytes
+
+  Enabled with KAPI_ENABLE_METRICS=1 (see KlipperConfig.h). When disabled
+  the class does not exist and the hooks in KlipperAPI.cpp compile to
+  nothing. printPrometheus() writes the Prometheus text format:
+
+    api.metrics.printPrometheus(server.client());
+*/
+
+#ifndef KlipperMetrics_h
+#define KlipperMetrics_h
+
+#include <Arduino.h>
+#include "KlipperConfig.h"
+
+#if KAPI_ENABLE_METRICS
+
+#define KAPI_METRICS(statement) statement
+
+#ifndef KAPI_METRICS_ENDPOINTS
+#define KAPI_METRICS_ENDPOINTS  10   // Endpoints tracked, the last slot collects the rest as "other"
+#endif
+#define KAPI_METRICS_PATH_SIZE  32   // Endpoint path kept, without query string
+
+// Request phases
+#define KAPI_PHASE_CONNECT     0
+#define KAPI_PHASE_FIRST_BYTE  1
+#define KAPI_PHASE_BODY        2
+#define KAPI_PHASE_PARSE       3
+#define KAPI_PHASE_COUNT       4
+
+// Latency of one phase in microseconds
+typedef struct {
+  uint32_t count;
+  uint32_t minimum;
+  uint32_t maximum;
+  uint64_t total;
+} KlipperLatency;
+
+typedef struct {
+  char path[KAPI_METRICS_PATH_SIZE];
+  uint32_t requests;
+  uint32_t errors;             // Failed requests, including timeouts
+  uint32_t timeouts;
+  uint32_t bytesSent;
+  uint32_t bytesReceived;
+  KlipperLatency phases[KAPI_PHASE_COUNT];
+} KlipperEndpointMetrics;
+
+class KlipperMetrics {
+public:
+  KlipperMetrics();
+
+  void reset();
+  uint8_t size() const { return _count; }
+  const KlipperEndpointMetrics& operator[](uint8_t index) const { return _endpoints[index]; }
+  // Metrics of an endpoint path, nullptr if it was never requested
+  const KlipperEndpointMetrics* find(const char* path) const;
+  // Mean of a phase in microseconds, 0 without samples
+  static uint32_t mean(const KlipperLatency& latency);
+
+  // Prometheus text exposition format, metric names start with prefix
+  void printPrometheus(Print& out, const char* prefix = "klipperapi") const;
+
+  // Request hooks used by KlipperApi. Each request is begun once and
+  // finished once; phases may overlap.
+  void beginRequest(const char* endpoint);
+  void startPhase(uint8_t phase);
+  void endPhase(uint8_t phase);
+  void addBytes(uint32_t sent, uint32_t received);
+  void markError() { _error = true; }
+  void markTimeout() { _timeout = true; }
+  void finishRequest();
+
+private:
+  int8_t slotFor(const char* endpoint);
+  void printCounter(Print& out, const char* prefix, const char* name, const char* help, uint8_t field) const;
+  void printLatency(Print& out, const char* prefix) const;
+  static void printLabels(Print& out, const char* path, const char* phase);
+  static void printSeconds(Print& out, uint64_t micros);
+
+  KlipperEndpointMetrics _endpoints[KAPI_METRICS_ENDPOINTS];
+  uint8_t _count;
+  int8_t _current;                 // Slot of the request in progress, -1 if none
+  uint8_t _running;                // Bit per phase being timed
+  bool _error;
+  bool _timeout;
+  uint32_t _phaseStart[KAPI_PHASE_COUNT];
+};
+
+#else
+
+#define KAPI_METRICS(statement)
+
+#endif
+
+#endif
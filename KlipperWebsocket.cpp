@@ -0,0 +1,220 @@
+/*
+  KlipperWebsocket.cpp - Minimal websocket client used by KlipperAPI
+*/
+
+#include "KlipperWebsocket.h"
+
+// Frame opcodes
+#define WS_OP_TEXT         0x1
+#define WS_OP_CLOSE        0x8
+#define WS_OP_PING         0x9
+#define WS_OP_PONG         0xA
+
+static const char base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+KlipperWebsocket::KlipperWebsocket() {
+  _client = nullptr;
+  _timeoutMs = 0;
+  _open = false;
+}
+
+bool KlipperWebsocket::begin(Client* client, const char* path, const char* hostHeader,
+                             const char* apiKeyHeader, unsigned long timeoutMs) {
+  _client = client;
+  _timeoutMs = timeoutMs;
+  _open = false;
+
+  // Random 16 byte nonce, base64 encoded. The server's Sec-WebSocket-Accept
+  // answer is not verified, that would need SHA-1 for little benefit here.
+  const uint8_t nonceSize = 16;
+  uint8_t nonce[nonceSize];
+  for (uint8_t i = 0; i < nonceSize; i++) {
+    nonce[i] = (uint8_t)random(256);
+  }
+
+  char key[25];
+  uint8_t out = 0;
+  for (uint8_t i = 0; i < nonceSize; i += 3) {
+    uint32_t triple = (uint32_t)nonce[i] << 16;
+    if (i + 1 < nonceSize) triple |= (uint32_t)nonce[i + 1] << 8;
+    if (i + 2 < nonceSize) triple |= nonce[i + 2];
+    key[out++] = base64Chars[(triple >> 18) & 0x3F];
+    key[out++] = base64Chars[(triple >> 12) & 0x3F];
+    key[out++] = (i + 1 < nonceSize) ? base64Chars[(triple >> 6) & 0x3F] : '=';
+    key[out++] = (i + 2 < nonceSize) ? base64Chars[triple & 0x3F] : '=';
+  }
+  key[out] = '\0';
+
+  KlipperRequestWriter request(_client);
+  request.print("GET ");
+  request.print(path);
+  request.print(" HTTP/1.1\r\n");
+  request.print(hostHeader);
+  request.print("Upgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: ");
+  request.print(key);
+  request.print("\r\n");
+  if (apiKeyHeader != nullptr) {
+    request.print(apiKeyHeader);
+  }
+  request.print("\r\n");
+  if (!request.finish()) {
+    return false;
+  }
+
+  // Read the response head; only the status code matters
+  KlipperResponseHead head;
+  unsigned long start = millis();
+
+  while (millis() - start < _timeoutMs) {
+    int c = _client->read();
+    if (c < 0) {
+      if (!_client->connected()) return false;
+      delay(1);
+      continue;
+    }
+
+    if (head.feed((char)c)) {
+      _open = (head.statusCode == 101);
+      return _open;
+    }
+  }
+
+  return false;
+}
+
+void KlipperWebsocket::close() {
+  if (_open) {
+    sendFrame(WS_OP_CLOSE, nullptr, 0);
+  }
+  _open = false;
+  _payload.end();
+  if (_client != nullptr) {
+    _client->stop();
+  }
+}
+
+bool KlipperWebsocket::connected() {
+  if (_open && !_client->connected()) {
+    _open = false;
+  }
+  return _open;
+}
+
+bool KlipperWebsocket::sendText(const char* text, size_t length) {
+  return sendFrame(WS_OP_TEXT, (const uint8_t*)text, length);
+}
+
+// Client to server frames must be masked with a random key
+bool KlipperWebsocket::sendFrame(uint8_t opcode, const uint8_t* data, size_t length) {
+  if (_client == nullptr) {
+    return false;
+  }
+
+  KlipperRequestWriter frame(_client);
+  frame.print((char)(0x80 | opcode)); // FIN + opcode
+
+  if (length < 126) {
+    frame.print((char)(0x80 | length));
+  } else if (length <= 0xFFFF) {
+    frame.print((char)(0x80 | 126));
+    frame.print((char)(length >> 8));
+    frame.print((char)(length & 0xFF));
+  } else {
+    frame.print((char)(0x80 | 127));
+    for (int8_t shift = 56; shift >= 0; shift -= 8) {
+      frame.print((char)(((uint64_t)length >> shift) & 0xFF));
+    }
+  }
+
+  uint8_t mask[4];
+  for (uint8_t i = 0; i < 4; i++) {
+    mask[i] = (uint8_t)random(256);
+    frame.print((char)mask[i]);
+  }
+
+  for (size_t i = 0; i < length; i++) {
+    frame.print((char)(data[i] ^ mask[i & 3]));
+  }
+
+  return frame.finish();
+}
+
+// Read exactly length bytes, waiting up to the timeout for each
+bool KlipperWebsocket::readExact(uint8_t* buffer, size_t length) {
+  unsigned long start = millis();
+  size_t received = 0;
+  while (received < length) {
+    int c = _client->read();
+    if (c < 0) {
+      if (!_client->connected() || millis() - start >= _timeoutMs) {
+        _open = false;
+        return false;
+      }
+      delay(1);
+      continue;
+    }
+    buffer[received++] = (uint8_t)c;
+  }
+  return true;
+}
+
+bool KlipperWebsocket::nextMessage() {
+  while (connected() && _client->available() >= 2) {
+    uint8_t header[2];
+    if (!readExact(header, 2)) return false;
+
+    bool fin = header[0] & 0x80;
+    uint8_t opcode = header[0] & 0x0F;
+    bool masked = header[1] & 0x80;
+    uint64_t length = header[1] & 0x7F;
+
+    if (length == 126) {
+      uint8_t ext[2];
+      if (!readExact(ext, 2)) return false;
+      length = ((uint16_t)ext[0] << 8) | ext[1];
+    } else if (length == 127) {
+      uint8_t ext[8];
+      if (!readExact(ext, 8)) return false;
+      length = 0;
+      for (uint8_t i = 0; i < 8; i++) length = (length << 8) | ext[i];
+    }
+
+    uint8_t mask[4] = {0, 0, 0, 0};
+    if (masked && !readExact(mask, 4)) return false; // Servers do not mask, but be tolerant
+
+    if (opcode >= WS_OP_CLOSE) {
+      // Control frames are short and handled right here
+      uint8_t control[KAPI_WS_CONTROL_SIZE];
+      size_t controlLength = (length < sizeof(control)) ? (size_t)length : sizeof(control);
+      if (!readExact(control, controlLength)) return false;
+      for (size_t i = 0; i < controlLength; i++) control[i] ^= mask[i & 3];
+
+      if (opcode == WS_OP_PING) {
+        sendFrame(WS_OP_PONG, control, controlLength);
+      } else if (opcode == WS_OP_CLOSE) {
+        sendFrame(WS_OP_CLOSE, control, controlLength < 2 ? controlLength : 2);
+        _open = false;
+        _client->stop();
+        return false;
+      }
+      continue;
+    }
+
+    _payload.begin(_client, (long)length, _timeoutMs);
+    if (opcode == WS_OP_TEXT && fin && !masked) {
+      return true;
+    }
+
+    // Moonraker sends each message in a single frame; anything else is skipped
+    _payload.drain();
+    _payload.end();
+  }
+  return false;
+}
+
+void KlipperWebsocket::endMessage() {
+  if (!_payload.drain()) {
+    _open = false; // Lost sync with the frame stream
+  }
+  _payload.end();
+}
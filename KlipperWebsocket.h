@@ -0,0 +1,48 @@
+/*
+  KlipperWebsocket.h - Minimal websocket client used by KlipperAPI
+
+  Implements just enough of RFC 6455 to talk JSON-RPC with Moonraker's
+  /websocket endpoint over an Arduino Client: the HTTP upgrade, masked text
+  frames towards the server and unfragmented text frames from the server.
+*/
+
+#ifndef KlipperWebsocket_h
+#define KlipperWebsocket_h
+
+#include <Arduino.h>
+#include <Client.h>
+#include "KlipperHttp.h"
+
+#define KAPI_WS_CONTROL_SIZE 125   // Largest control frame payload (RFC 6455)
+
+class KlipperWebsocket {
+public:
+  KlipperWebsocket();
+
+  // Upgrade an already connected client to a websocket on path
+  bool begin(Client* client, const char* path, const char* hostHeader,
+             const char* apiKeyHeader, unsigned long timeoutMs);
+  void close();
+  bool connected();
+
+  // Send one masked text frame
+  bool sendText(const char* text, size_t length);
+
+  // Returns true when a text message is ready to be read from payload().
+  // Does not block when no frame has started to arrive. Control frames
+  // are answered internally.
+  bool nextMessage();
+  KlipperBodyStream& payload() { return _payload; }
+  void endMessage();
+
+private:
+  bool readExact(uint8_t* buffer, size_t length);
+  bool sendFrame(uint8_t opcode, const uint8_t* data, size_t length);
+
+  Client *_client;
+  KlipperBodyStream _payload;
+  unsigned long _timeoutMs;
+  bool _open;
+};
+
+#endif
@@ -0,0 +1,238 @@
+/*
+  KlipperWorker.cpp - Background polling for KlipperAPI
+*/
+
+#include "KlipperWorker.h"
+
+#if KAPI_ENABLE_WORKER
+
+#define KAPI_WORKER_SLICE       10     // ms the worker sleeps between checks while waiting
+
+KlipperWorker::KlipperWorker(KlipperApi& api)
+  : _api(api), _interval(KAPI_WORKER_INTERVAL), _sequence(0), _running(false), _stopping(false),
+    _wake(false), _queueHead(0), _queueCount(0), _refreshes(0), _publishes(0), _readRetries(0), _jobs(0) {
+  memset(_buffers, 0, sizeof(_buffers));
+#if defined(ESP32)
+  _task = nullptr;
+  portMUX_INITIALIZE(&_queueLock);
+  _taskDone.store(false);
+#endif
+}
+
+KlipperWorker::~KlipperWorker() {
+  end();
+}
+
+bool KlipperWorker::begin(unsigned long intervalMs, int core) {
+  if (_running.load()) {
+    return false;
+  }
+  _interval = intervalMs > 0 ? intervalMs : 1;
+  _stopping.store(false);
+  _running.store(true);
+
+#if defined(ESP32)
+  _taskDone.store(false);
+  BaseType_t created;
+  if (portNUM_PROCESSORS > 1 && core >= 0) {
+    created = xTaskCreatePinnedToCore(taskEntry, "KlipperWorker", KAPI_WORKER_STACK, this,
+                                      KAPI_WORKER_PRIORITY, &_task, core);
+  } else {
+    created = xTaskCreate(taskEntry, "KlipperWorker", KAPI_WORKER_STACK, this, KAPI_WORKER_PRIORITY, &_task);
+  }
+  if (created != pdPASS) {
+    _running.store(false);
+    return false;
+  }
+#else
+  (void)core;
+  _thread = std::thread(&KlipperWorker::run, this);
+#endif
+  return true;
+}
+
+// Must not be called from a job, which runs on the worker itself
+void KlipperWorker::end() {
+  if (!_running.load()) {
+    return;
+  }
+  _stopping.store(true);
+#if defined(ESP32)
+  while (!_taskDone.load()) {
+    delay(1);
+  }
+  _task = nullptr;
+#else
+  _thread.join();
+#endif
+  _running.store(false);
+}
+
+#if defined(ESP32)
+void KlipperWorker::taskEntry(void* worker) {
+  KlipperWorker* self = static_cast<KlipperWorker*>(worker);
+  self->run();
+  self->_taskDone.store(true);
+  vTaskDelete(nullptr);
+}
+#endif
+
+void KlipperWorker::run() {
+  while (!_stopping.load()) {
+    runJobs();
+
+    bool forced = _wake.exchange(false);
+    unsigned long wait = _interval;
+#if KAPI_ENABLE_SCHEDULER
+    if (forced || _api.updateDue() != 0) {
+      publish(forced ? _api.refresh() : _api.update() != 0);
+      _refreshes.fetch_add(1);
+    }
+    unsigned long next = _api.nextUpdateIn();
+    if (next < wait) {
+      wait = next;
+    }
+#else
+    (void)forced;
+    publish(_api.refresh());
+    _refreshes.fetch_add(1);
+#endif
+
+    // Sleep in slices, so end(), wake(), post() and pushed status updates
+    // are seen in time
+    unsigned long started = millis();
+    while (!_stopping.load() && !_wake.load() && millis() - started < wait) {
+#if KAPI_ENABLE_SUBSCRIPTION
+      if (_api.isSubscribed()) {
+        uint32_t updates = _api.statusUpdateCount;
+        _api.handleSubscription();
+        if (_api.statusUpdateCount != updates) {
+          publish(true);
+        }
+      }
+#endif
+      lockJobs();
+      bool jobs = _queueCount > 0;
+      unlockJobs();
+      if (jobs) {
+        break;
+      }
+      delay(KAPI_WORKER_SLICE);
+    }
+  }
+}
+
+// Run the jobs waiting now; jobs posted meanwhile wait for the next round
+void KlipperWorker::runJobs() {
+  lockJobs();
+  uint8_t count = _queueCount;
+  unlockJobs();
+
+  for (uint8_t i = 0; i < count; i++) {
+    lockJobs();
+    KlipperWorkerJob job = _queue[_queueHead].job;
+    void* context = _queue[_queueHead].context;
+    _queueHead = (_queueHead + 1) % KAPI_WORKER_QUEUE;
+    _queueCount--;
+    unlockJobs();
+
+    job(_api, context);
+    _jobs.fetch_add(1);
+  }
+  if (count > 0) {
+    // A command may have changed what the api holds
+    publish(true);
+  }
+}
+
+bool KlipperWorker::post(KlipperWorkerJob job, void* context) {
+  if (job == nullptr) {
+    return false;
+  }
+  lockJobs();
+  bool queued = _queueCount < KAPI_WORKER_QUEUE;
+  if (queued) {
+    uint8_t slot = (_queueHead + _queueCount) % KAPI_WORKER_QUEUE;
+    _queue[slot].job = job;
+    _queue[slot].context = context;
+    _queueCount++;
+  }
+  unlockJobs();
+  return queued;
+}
+
+// Only the worker writes the buffers, so it can compare against the
+// current one without any synchronisation
+void KlipperWorker::publish(bool online) {
+  uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+  const KlipperSnapshot& current = _buffers[(sequence >> 1) & 1];
+  bool changed = (sequence == 0 || current.online != online ||
+                  memcmp(&current.printerStats, &_api.printerStats, sizeof(PrinterStatistics)) != 0);
+#if KAPI_ENABLE_PRINT_JOB
+  changed = changed || memcmp(&current.printJob, &_api.printJob, sizeof(PrintJobInfo)) != 0;
+#endif
+  if (!changed) {
+    return;
+  }
+
+  // Odd while the other buffer is written; readers keep using this one
+  _sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  KlipperSnapshot& next = _buffers[((sequence >> 1) + 1) & 1];
+  memcpy(&next.printerStats, &_api.printerStats, sizeof(PrinterStatistics));
+#if KAPI_ENABLE_PRINT_JOB
+  memcpy(&next.printJob, &_api.printJob, sizeof(PrintJobInfo));
+#endif
+  next.online = online;
+  next.updatedAt = millis();
+  next.generation = (sequence >> 1) + 1;
+
+  _sequence.store(sequence + 2, std::memory_order_release);
+  _publishes.fetch_add(1);
+}
+
+// A buffer read at sequence s is next written once the sequence reaches
+// (s rounded down to even) + 3. Anything below that means the copy is
+// whole; otherwise the worker lapped the reader and it tries again.
+uint32_t KlipperWorker::read(KlipperSnapshot& snapshot) const {
+  for (;;) {
+    uint32_t start = _sequence.load(std::memory_order_acquire);
+    memcpy(&snapshot, &_buffers[(start >> 1) & 1], sizeof(KlipperSnapshot));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (_sequence.load(std::memory_order_relaxed) - (start & ~1u) < 3) {
+      return snapshot.generation;
+    }
+    _readRetries.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+bool KlipperWorker::readIfChanged(KlipperSnapshot& snapshot, uint32_t& seen) const {
+  if (generation() == seen) {
+    return false;
+  }
+  seen = read(snapshot);
+  return true;
+}
+
+uint32_t KlipperWorker::generation() const {
+  return _sequence.load(std::memory_order_acquire) >> 1;
+}
+
+void KlipperWorker::lockJobs() {
+#if defined(ESP32)
+  portENTER_CRITICAL(&_queueLock);
+#else
+  _queueLock.lock();
+#endif
+}
+
+void KlipperWorker::unlockJobs() {
+#if defined(ESP32)
+  portEXIT_CRITICAL(&_queueLock);
+#else
+  _queueLock.unlock();
+#endif
+}
+
+#endif
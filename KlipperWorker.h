@@ -0,0 +1,166 @@
+/*
+  KlipperWorker.h - Background polling for KlipperAPI
+
+  Runs all Moonraker I/O of one KlipperApi on its own task, so the loop()
+  that drives a display or a web server never waits for the network. On
+  the ESP32 that is a FreeRTOS task, by default on core 0 next to WiFi,
+  while loop() runs on core 1. Host builds use a std::thread.
+
+  The worker refreshes printerStats and printJob (with update() when
+  KAPI_ENABLE_SCHEDULER is on) and publishes a copy whenever they changed.
+  Other tasks read that copy, not the api's structs, which the worker
+  writes in place:
+
+    KlipperWorker worker(api);
+    worker.begin();
+
+    KlipperSnapshot snapshot;
+    uint32_t seen = 0;
+    void loop() {
+      if (worker.readIfChanged(snapshot, seen)) {
+        draw(snapshot.printerStats);   // Only when something changed
+      }
+    }
+
+  Reading never locks and never blocks the worker. Two buffers behind a
+  sequence counter (a seqlock): the worker fills the buffer readers are
+  not using and then flips the counter; a reader copies the current
+  buffer and checks the counter afterwards, retrying in the rare case the
+  worker went through both buffers meanwhile.
+
+  Once begin() has returned the worker owns the KlipperApi. Commands from
+  other tasks go through post(), which runs them on the worker between
+  refreshes; callbacks set on the api are called from the worker as well.
+
+  Enabled with KAPI_ENABLE_WORKER (see KlipperConfig.h), on the ESP32 and
+  in host builds.
+*/
+
+#ifndef KlipperWorker_h
+#define KlipperWorker_h
+
+#include <Arduino.h>
+#include "KlipperAPI.h"
+
+#if KAPI_ENABLE_WORKER
+
+#include <atomic>
+
+#if defined(ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <mutex>
+#include <thread>
+#endif
+
+#ifndef KAPI_WORKER_INTERVAL
+#define KAPI_WORKER_INTERVAL    1000   // ms between refreshes, or the longest wait for update()
+#endif
+#ifndef KAPI_WORKER_QUEUE
+#define KAPI_WORKER_QUEUE       4      // Jobs post() can hold
+#endif
+#ifndef KAPI_WORKER_STACK
+#define KAPI_WORKER_STACK       8192   // ESP32 task stack in bytes
+#endif
+#ifndef KAPI_WORKER_PRIORITY
+#define KAPI_WORKER_PRIORITY    1      // ESP32 task priority, the same as loop()
+#endif
+#ifndef KAPI_WORKER_CORE
+#define KAPI_WORKER_CORE        0      // ESP32 core; loop() runs on core 1
+#endif
+
+// What readers get: the api's data at one point in time
+typedef struct {
+  PrinterStatistics printerStats;
+#if KAPI_ENABLE_PRINT_JOB
+  PrintJobInfo printJob;
+#endif
+  bool online;                       // The last refresh succeeded
+  uint32_t updatedAt;                // millis() when the data last changed
+  uint32_t generation;               // Counts changes, 0 before the first refresh
+} KlipperSnapshot;
+
+// Work for the worker's api, see post()
+typedef void (*KlipperWorkerJob)(KlipperApi& api, void* context);
+
+class KlipperWorker {
+public:
+  explicit KlipperWorker(KlipperApi& api);
+  ~KlipperWorker();
+
+  // Start polling every intervalMs. false if already running or the task
+  // could not be created.
+  bool begin(unsigned long intervalMs = KAPI_WORKER_INTERVAL, int core = KAPI_WORKER_CORE);
+  // Stop and wait for the request in flight to finish. Not from a job.
+  void end();
+  bool running() const { return _running.load(); }
+
+  // Copy the latest snapshot; returns its generation. Safe from any task.
+  uint32_t read(KlipperSnapshot& snapshot) const;
+  // Copy only if the generation differs from seen, which is updated
+  bool readIfChanged(KlipperSnapshot& snapshot, uint32_t& seen) const;
+  uint32_t generation() const;
+
+  // Run job(api, context) on the worker before its next refresh, e.g. to
+  // send G-code. false if KAPI_WORKER_QUEUE jobs are already waiting.
+  bool post(KlipperWorkerJob job, void* context = nullptr);
+  // Refresh now instead of at the next interval
+  void wake() { _wake.store(true); }
+
+  // Statistics
+  uint32_t refreshCount() const { return _refreshes.load(); }
+  uint32_t publishCount() const { return _publishes.load(); }
+  uint32_t readRetryCount() const { return _readRetries.load(); }
+  uint32_t jobCount() const { return _jobs.load(); }
+
+private:
+  KlipperWorker(const KlipperWorker&);
+  KlipperWorker& operator=(const KlipperWorker&);
+
+#if defined(ESP32)
+  static void taskEntry(void* worker);
+#endif
+  void run();
+  void runJobs();
+  void publish(bool online);
+  void lockJobs();
+  void unlockJobs();
+
+  KlipperApi& _api;
+  unsigned long _interval;
+
+  // Even while the worker is idle, odd while it fills the other buffer.
+  // The current buffer is (_sequence / 2) % 2.
+  std::atomic<uint32_t> _sequence;
+  KlipperSnapshot _buffers[2];
+
+  std::atomic<bool> _running;
+  std::atomic<bool> _stopping;
+  std::atomic<bool> _wake;
+
+  struct {
+    KlipperWorkerJob job;
+    void* context;
+  } _queue[KAPI_WORKER_QUEUE];
+  uint8_t _queueHead;
+  uint8_t _queueCount;
+
+  std::atomic<uint32_t> _refreshes;
+  std::atomic<uint32_t> _publishes;
+  mutable std::atomic<uint32_t> _readRetries;
+  std::atomic<uint32_t> _jobs;
+
+#if defined(ESP32)
+  TaskHandle_t _task;
+  portMUX_TYPE _queueLock;
+  std::atomic<bool> _taskDone;
+#else
+  std::thread _thread;
+  std::mutex _queueLock;
+#endif
+};
+
+#endif
+
+#endif
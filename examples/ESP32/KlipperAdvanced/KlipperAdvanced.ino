@@ -33,10 +33,7 @@ WiFiClient client;
 WebServer server(80);
 KlipperApi api;
 
-// Monitoring intervals
-unsigned long fast_update_interval = 5000;   // 5 seconds for active printing
-unsigned long slow_update_interval = 30000;  // 30 seconds for idle
-unsigned long last_update = 0;
+// Printer state seen on the last update
 bool is_printing = false;
 
 // Temperature monitoring
@@ -79,13 +76,12 @@ void loop() {
   // Handle web server requests
   server.handleClient();
   
-  // Determine update interval based on printer state
-  unsigned long current_interval = is_printing ? fast_update_interval : slow_update_interval;
-  
-  // Update printer status
-  if (millis() - last_update > current_interval || last_update == 0) {
+  // The library decides what to poll: temperatures fast while heating,
+  // position while printing, job progress as fast as it moves, and
+  // little at all while the printer is idle. nextUpdateIn() also waits
+  // out the backoff while the printer is unreachable.
+  if (api.nextUpdateIn() == 0) {
     updatePrinterStatus();
-    last_update = millis();
   }
   
   // Safety checks if printing
@@ -144,8 +140,8 @@ void updatePrinterStatus() {
   
   bool status_ok = true;
   
-  // Get comprehensive printer statistics
-  if (api.getPrinterStatistics()) {
+  // Refresh whatever is due in one query
+  if (api.update()) {
     printer_connected = true;
     
     // Update printing status
@@ -161,19 +157,20 @@ void updatePrinterStatus() {
       }
     }
     
-    // Get print job details if printing
-    if (is_printing) {
-      api.getPrintJob();
-    }
-    
     // Display current status
     displayStatus();
     
   } else {
     printer_connected = false;
     status_ok = false;
-    last_error = "Failed to get printer statistics";
+    last_error = "Failed to update printer status";
     Serial.println("❌ " + last_error);
+    if (api.health.state() == KAPI_HEALTH_OPEN) {
+      // Requests fail at once until then instead of blocking loop()
+      Serial.print("Printer unreachable, next try in ");
+      Serial.print(api.health.retryIn());
+      Serial.println(" ms");
+    }
   }
   
   // Show connection status
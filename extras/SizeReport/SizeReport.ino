@@ -0,0 +1,129 @@
+/*******************************************************************
+ *  KlipperAPI size report sketch
+ *
+ *  Touches every feature that is enabled in KlipperConfig.h so the
+ *  linker keeps it. Built by extras/size_report.sh once per feature
+ *  switch; it is not meant to be run.
+ *******************************************************************/
+
+#include <KlipperAPI.h>
+#include <KlipperCodec.h>
+#include <KlipperWorker.h>
+#include <SPI.h>
+#include <Ethernet.h>
+
+EthernetClient client;
+KlipperApi api;
+
+#if KAPI_ENABLE_SUBSCRIPTION
+EthernetClient wsClient;
+#endif
+
+#if KAPI_ENABLE_WORKER
+KlipperWorker worker(api);
+KlipperSnapshot snapshot;
+uint32_t seen = 0;
+#endif
+
+#if KAPI_ENABLE_CODEC
+KlipperEncoder encoder;
+KlipperDecoder decoder;
+KlipperApi display;
+uint8_t frame[KAPI_CODEC_MAX_FRAME];
+#endif
+
+void setup() {
+  api.init(client, IPAddress(192, 168, 1, 100), 7125);
+
+  api.getPrinterInfo();
+  api.getPrinterStatistics();
+  api.refresh();
+#if KAPI_ENABLE_BATCH
+  api.refreshBatch();
+#endif
+  api.emergencyStop();
+#if KAPI_ENABLE_SERVER_INFO
+  api.getServerInfo();
+#endif
+#if KAPI_ENABLE_PRINT_JOB
+  api.getPrintJob();
+#endif
+#if KAPI_ENABLE_MOTION
+  api.getMotionLimits();
+#endif
+#if KAPI_ENABLE_CONTROL
+  api.startPrint("test.gcode");
+  api.pausePrint();
+  api.resumePrint();
+  api.cancelPrint();
+  api.setExtruderTemperature(200);
+  api.setBedTemperature(60);
+  api.setFanSpeed(100);
+  api.homeAll();
+  api.moveRelative(1, 0, 0, 0);
+  api.sendGcode("M115");
+  api.restartFirmware();
+#endif
+#if KAPI_ENABLE_STRING_API
+  api.sendGetToMoonraker("/server/info");
+#endif
+#if KAPI_ENABLE_ASYNC
+  api.beginRefresh();
+#endif
+#if KAPI_ENABLE_GCODE_QUEUE
+  api.queueGcode("G1 X1");
+  api.flushGcode();
+#endif
+#if KAPI_ENABLE_SUBSCRIPTION
+  api.subscribeStatus(wsClient);
+#endif
+#if KAPI_ENABLE_OBJECTS
+  api.discoverObjects();
+  api.refreshObjects();
+  api.findObject("heater_generic chamber");
+#endif
+#if KAPI_ENABLE_FILES
+  KlipperFileInfo files[4];
+  api.listRecentFiles(files, 4);
+#if KAPI_ENABLE_CONTROL
+  api.startPrint(files[0]);
+#endif
+#endif
+#if KAPI_ENABLE_UPLOAD
+  api.uploadFile(Serial, "test.gcode", 1024);
+#endif
+#if KAPI_ENABLE_METRICS
+  api.metrics.printPrometheus(Serial);
+#endif
+#if KAPI_ENABLE_HEALTH
+  Serial.println(api.health.retryIn());
+#endif
+#if KAPI_ENABLE_WORKER
+  worker.begin();
+  worker.post([](KlipperApi& api, void*) { api.emergencyStop(); });
+#endif
+}
+
+void loop() {
+  api.prewarm();
+#if KAPI_ENABLE_SCHEDULER
+  api.update();
+#endif
+#if KAPI_ENABLE_ASYNC
+  api.poll();
+#endif
+#if KAPI_ENABLE_SUBSCRIPTION
+  api.handleSubscription();
+#endif
+#if KAPI_ENABLE_WORKER
+  if (worker.readIfChanged(snapshot, seen)) {
+    Serial.println(snapshot.printerStats.extruder.current);
+  }
+#endif
+#if KAPI_ENABLE_CODEC
+  size_t length = encoder.encode(api, frame, sizeof(frame));
+  if (decoder.decode(frame, length, display)) {
+    Serial.println(decoder.changed());
+  }
+#endif
+}
@@ -0,0 +1,76 @@
+/*
+  HostHeap.cpp - Counting malloc for host builds (glibc)
+*/
+
+#include "HostHeap.h"
+#include <malloc.h>
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+}
+
+static HostHeapStats stats;
+
+// Pretend heap, so KAPI_HEAP_FREE() drops whenever anything allocates
+static const uint32_t hostHeapSize = 0x40000000;
+
+static void allocated(void* ptr, size_t requested) {
+  if (ptr == nullptr) {
+    return;
+  }
+  stats.allocations++;
+  stats.bytes += requested;
+  stats.current += malloc_usable_size(ptr);
+  if (stats.current > stats.peak) {
+    stats.peak = stats.current;
+  }
+}
+
+static void released(void* ptr) {
+  if (ptr != nullptr) {
+    stats.current -= malloc_usable_size(ptr);
+  }
+}
+
+extern "C" void* malloc(size_t size) {
+  void* ptr = __libc_malloc(size);
+  allocated(ptr, size);
+  return ptr;
+}
+
+extern "C" void* calloc(size_t count, size_t size) {
+  void* ptr = __libc_calloc(count, size);
+  allocated(ptr, count * size);
+  return ptr;
+}
+
+extern "C" void* realloc(void* ptr, size_t size) {
+  released(ptr);
+  void* moved = __libc_realloc(ptr, size);
+  if (moved == nullptr && size > 0) {
+    stats.current += malloc_usable_size(ptr); // Old block is still ours
+    return nullptr;
+  }
+  allocated(moved, size);
+  return moved;
+}
+
+extern "C" void free(void* ptr) {
+  released(ptr);
+  __libc_free(ptr);
+}
+
+HostHeapStats hostHeapStats() {
+  return stats;
+}
+
+void hostHeapResetPeak() {
+  stats.peak = stats.current;
+}
+
+uint32_t hostHeapFree() {
+  return hostHeapSize - (uint32_t)stats.current;
+}
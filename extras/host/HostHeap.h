@@ -0,0 +1,25 @@
+/*
+  HostHeap.h - Heap accounting for host builds
+
+  HostHeap.cpp replaces malloc()/free() for the whole program, so every
+  allocation made by the library, ArduinoJson, String or operator new is
+  counted. Only meant for single threaded benchmarks.
+*/
+
+#ifndef KAPI_HOST_HEAP_H
+#define KAPI_HOST_HEAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+  uint64_t allocations;   // malloc/calloc/realloc calls since start
+  uint64_t bytes;         // Bytes requested by them
+  size_t current;         // Bytes in use now
+  size_t peak;            // Most bytes in use since hostHeapResetPeak()
+} HostHeapStats;
+
+HostHeapStats hostHeapStats();
+void hostHeapResetPeak();
+
+#endif
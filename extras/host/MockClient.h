@@ -0,0 +1,194 @@
+/*
+  MockClient.h - Scriptable in-memory Client for host builds
+
+  Replays canned Moonraker responses: each complete HTTP request written
+  to the client is answered with the next queued reply. Replies point at
+  caller owned text and the buffers keep their capacity, so once warmed up
+  the mock itself does not allocate and heap counts belong to the library.
+*/
+
+#ifndef KAPI_HOST_MOCK_CLIENT_H
+#define KAPI_HOST_MOCK_CLIENT_H
+
+#include "Client.h"
+#include <string>
+
+#define MOCK_MAX_REPLIES   16
+#define MOCK_BUFFER_SIZE   16384   // Initial capacity of the send and receive buffers
+
+class MockClient : public Client {
+public:
+  MockClient() {
+    _tx.reserve(MOCK_BUFFER_SIZE);
+    _rx.reserve(MOCK_BUFFER_SIZE);
+    _lastRequest.reserve(MOCK_BUFFER_SIZE);
+  }
+
+  // Queue a complete HTTP response. raw must stay valid until it is served.
+  bool queueReply(const char* raw, bool closeAfter = false) {
+    return queue(raw, strlen(raw), 0, closeAfter);
+  }
+
+  // Queue a JSON body; the status line and Content-Length are added when served
+  bool queueJson(const char* body, int status = 200, bool closeAfter = false) {
+    return queue(body, strlen(body), status, closeAfter);
+  }
+
+  // Append bytes to the receive side of the open connection (websocket frames)
+  void pushRaw(const char* data, size_t length) {
+    compactRx();
+    _rx.append(data, length);
+  }
+
+  // The server drops the connection, as an idle keep-alive timeout would
+  void serverClose() { _open = false; _rx.clear(); _rxPos = 0; }
+  void failNextConnects(int count) { _failConnects = count; }
+  // Deliver at most this many bytes per available()/read() burst, 0 for all
+  void setFragment(size_t bytes) { _fragment = bytes; }
+
+  // Last complete request written, including its body
+  const std::string& lastRequest() const { return _lastRequest; }
+  // Bytes written that do not form a complete HTTP request (websocket frames)
+  const std::string& pendingTx() const { return _tx; }
+  size_t pendingReplies() const { return _replyCount; }
+
+  int connect(IPAddress, uint16_t) override { return doConnect(); }
+  int connect(const char*, uint16_t) override { return doConnect(); }
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buf, size_t size) override {
+    if (!_open) return 0;
+    _tx.append((const char*)buf, size);
+    bytesSent += size;
+    writeCalls++;
+    answerRequests();
+    return size;
+  }
+  using Print::write;
+
+  int available() override {
+    size_t count = _rx.size() - _rxPos;
+    if (_fragment && count > _fragment) count = _fragment;
+    return (int)count;
+  }
+  int read() override {
+    if (_rxPos >= _rx.size()) return -1;
+    bytesReceived++;
+    return (uint8_t)_rx[_rxPos++];
+  }
+  int read(uint8_t* buf, size_t size) override {
+    size_t count = (size_t)available();
+    if (count > size) count = size;
+    memcpy(buf, _rx.data() + _rxPos, count);
+    _rxPos += count;
+    bytesReceived += count;
+    return (int)count;
+  }
+  int peek() override { return _rxPos < _rx.size() ? (uint8_t)_rx[_rxPos] : -1; }
+  void flush() override {}
+  void stop() override { _open = false; _rx.clear(); _rxPos = 0; _tx.clear(); }
+  uint8_t connected() override { return _open || _rxPos < _rx.size(); }
+  operator bool() override { return connected(); }
+
+  // Totals since construction
+  uint32_t connects = 0;
+  uint32_t requests = 0;
+  uint64_t bytesSent = 0;
+  uint64_t bytesReceived = 0;
+  uint64_t writeCalls = 0;
+
+private:
+  typedef struct {
+    const char* data;
+    size_t length;
+    int status;        // 0 when data is a complete response
+    bool closeAfter;
+  } Reply;
+
+  bool queue(const char* data, size_t length, int status, bool closeAfter) {
+    if (_replyCount == MOCK_MAX_REPLIES) return false;
+    Reply& reply = _replies[(_replyStart + _replyCount) % MOCK_MAX_REPLIES];
+    reply.data = data;
+    reply.length = length;
+    reply.status = status;
+    reply.closeAfter = closeAfter;
+    _replyCount++;
+    return true;
+  }
+
+  int doConnect() {
+    if (_failConnects > 0) {
+      _failConnects--;
+      return 0;
+    }
+    _open = true;
+    _rx.clear();
+    _rxPos = 0;
+    _tx.clear();
+    connects++;
+    return 1;
+  }
+
+  // Drop bytes already read so the receive buffer does not grow
+  void compactRx() {
+    if (_rxPos >= _rx.size()) {
+      _rx.clear();
+      _rxPos = 0;
+    }
+  }
+
+  // Content-Length of the request head in _tx[0, headLength)
+  size_t requestBodyLength(size_t headLength) {
+    static const char name[] = "\ncontent-length:";
+    const size_t nameLength = sizeof(name) - 1;
+    for (size_t i = 0; i + nameLength <= headLength; i++) {
+      if (strncasecmp(_tx.data() + i, name, nameLength) == 0) {
+        return (size_t)strtoul(_tx.data() + i + nameLength, nullptr, 10);
+      }
+    }
+    return 0;
+  }
+
+  // Serve one reply for every complete request in the send buffer
+  void answerRequests() {
+    for (;;) {
+      size_t end = _tx.find("\r\n\r\n");
+      if (end == std::string::npos) return;
+      size_t total = end + 4 + requestBodyLength(end);
+      if (_tx.size() < total) return;
+
+      _lastRequest.assign(_tx, 0, total);
+      _tx.erase(0, total);
+      requests++;
+      if (_replyCount == 0) continue;
+
+      Reply reply = _replies[_replyStart];
+      _replyStart = (_replyStart + 1) % MOCK_MAX_REPLIES;
+      _replyCount--;
+
+      compactRx();
+      if (reply.status != 0) {
+        char head[128];
+        int length = snprintf(head, sizeof(head),
+                              "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\nContent-Length: %u\r\n\r\n",
+                              reply.status, reply.status == 200 ? "OK" : "Error", (unsigned)reply.length);
+        _rx.append(head, length);
+      }
+      _rx.append(reply.data, reply.length);
+      if (reply.closeAfter) _open = false;
+    }
+  }
+
+  Reply _replies[MOCK_MAX_REPLIES];
+  uint8_t _replyStart = 0;
+  uint8_t _replyCount = 0;
+  std::string _tx;
+  std::string _rx;
+  std::string _lastRequest;
+  size_t _rxPos = 0;
+  bool _open = false;
+  int _failConnects = 0;
+  size_t _fragment = 0;
+};
+
+#endif
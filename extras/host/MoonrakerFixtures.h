@@ -0,0 +1,57 @@
+/*
+  MoonrakerFixtures.h - Recorded Moonraker responses for host builds
+
+  Bodies as returned by Moonraker 0.8 / Klipper v0.12 for the endpoints the
+  library uses, trimmed of machine specific paths. Object queries carry
+  exactly the attributes the library asks for.
+*/
+
+#ifndef KAPI_HOST_MOONRAKER_FIXTURES_H
+#define KAPI_HOST_MOONRAKER_FIXTURES_H
+
+// GET /printer/info
+static const char fixturePrinterInfo[] = R"json({"result":{"state":"ready","state_message":"Printer is ready","hostname":"voron","klipper_path":"/home/pi/klipper","python_path":"/home/pi/klippy-env/bin/python","log_file":"/home/pi/printer_data/logs/klippy.log","config_file":"/home/pi/printer_data/config/printer.cfg","software_version":"v0.12.0-85-gd785b396","cpu_info":"4 core ARMv7 Processor rev 4 (v7l)","app":"Klipper"}})json";
+
+// GET /server/info
+static const char fixtureServerInfo[] = R"json({"result":{"klippy_connected":true,"klippy_state":"ready","components":["secrets","template","klippy_connection","jsonrpc","internal_transport","application","websockets","database","dbus_manager","file_manager","klippy_apis","machine","data_store","shell_command","proc_stats","job_state","job_queue","history","authorization","announcements","webcam","extensions","update_manager"],"failed_components":[],"registered_directories":["config","logs","gcodes","config_examples","docs"],"warnings":[],"websocket_count":2,"moonraker_version":"v0.8.0-209-g5836eab","missing_klippy_requirements":[],"api_version":[1,4,0],"api_version_string":"1.4.0"}})json";
+
+// GET /printer/objects/query for getPrinterStatistics()
+static const char fixturePrinterStatistics[] = R"json({"result":{"eventtime":578243.57824499,"status":{"extruder":{"temperature":209.87,"target":210.0,"power":0.4517},"heater_bed":{"temperature":59.98,"target":60.0,"power":0.2318},"toolhead":{"position":[118.25,97.5,2.4,1024.87713],"homed_axes":"xyz"},"print_stats":{"state":"printing"},"gcode_move":{"speed_factor":1.0,"extrude_factor":1.0}}}})json";
+
+// GET /printer/objects/query for getPrintJob()
+static const char fixturePrintJob[] = R"json({"result":{"eventtime":578243.61255413,"status":{"print_stats":{"state":"printing","filename":"benchy_0.2mm_PLA_MK4_1h4m.gcode","print_duration":1843.2291,"total_duration":1901.7738},"virtual_sdcard":{"progress":0.4731,"file_size":4823913}}}})json";
+
+// GET /printer/objects/query for getMotionLimits(). configfile.settings
+// carries every printer.cfg section; only [printer] is kept by the filter.
+static const char fixtureMotionLimits[] = R"json({"result":{"eventtime":578243.6502,"status":{"configfile":{"settings":{"mcu":{"serial":"/dev/serial/by-id/usb-Klipper_stm32f446xx_2B0032000851353532383931-if00","baud":250000,"restart_method":"command"},"printer":{"kinematics":"corexy","max_velocity":300.0,"max_accel":3000.0,"max_z_velocity":15.0,"max_z_accel":350.0,"square_corner_velocity":5.0,"minimum_cruise_ratio":0.5},"stepper_x":{"step_pin":"PF13","dir_pin":"PF12","enable_pin":"!PF14","rotation_distance":40.0,"microsteps":32,"full_steps_per_rotation":200,"endstop_pin":"^PG6","position_min":0.0,"position_endstop":235.0,"position_max":235.0,"homing_speed":50.0},"stepper_y":{"step_pin":"PG0","dir_pin":"PG1","enable_pin":"!PF15","rotation_distance":40.0,"microsteps":32,"full_steps_per_rotation":200,"endstop_pin":"^PG9","position_min":0.0,"position_endstop":235.0,"position_max":235.0,"homing_speed":50.0},"stepper_z":{"step_pin":"PF11","dir_pin":"!PG3","enable_pin":"!PG5","rotation_distance":8.0,"microsteps":32,"endstop_pin":"probe:z_virtual_endstop","position_min":-2.0,"position_max":250.0,"homing_speed":8.0},"extruder":{"step_pin":"PF9","dir_pin":"PF10","enable_pin":"!PG2","rotation_distance":22.6789511,"gear_ratio":[[50.0,10.0]],"microsteps":16,"nozzle_diameter":0.4,"filament_diameter":1.75,"heater_pin":"PA2","sensor_type":"PT1000","sensor_pin":"PF4","control":"pid","pid_kp":26.213,"pid_ki":1.304,"pid_kd":131.721,"min_temp":10.0,"max_temp":300.0},"heater_bed":{"heater_pin":"PA1","sensor_type":"Generic 3950","sensor_pin":"PF3","control":"pid","pid_kp":54.027,"pid_ki":0.77,"pid_kd":948.182,"min_temp":0.0,"max_temp":120.0}}},"toolhead":{"max_velocity":300.0,"max_accel":3000.0,"square_corner_velocity":5.0,"axis_minimum":[0.0,0.0,-2.0,0.0],"axis_maximum":[235.0,235.0,250.0,0.0]}}}})json";
+
+// GET /printer/objects/query for refresh(KAPI_REFRESH_ALL)
+static const char fixtureRefreshAll[] = R"json({"result":{"eventtime":578243.70121,"status":{"extruder":{"temperature":209.87,"target":210.0,"power":0.4517},"heater_bed":{"temperature":59.98,"target":60.0,"power":0.2318},"toolhead":{"position":[118.25,97.5,2.4,1024.87713],"homed_axes":"xyz","max_velocity":300.0,"max_accel":3000.0,"square_corner_velocity":5.0,"axis_minimum":[0.0,0.0,-2.0,0.0],"axis_maximum":[235.0,235.0,250.0,0.0]},"print_stats":{"state":"printing","filename":"benchy_0.2mm_PLA_MK4_1h4m.gcode","print_duration":1843.2291,"total_duration":1901.7738},"gcode_move":{"speed_factor":1.0,"extrude_factor":1.0},"virtual_sdcard":{"progress":0.4731,"file_size":4823913}}}})json";
+
+// GET /server/files/directory?path=gcodes&extended=true, six sliced files
+static const char fixtureFileList[] = R"json({"result":{"dirs":[{"modified":1716990000.12,"size":4096,"permissions":"rw","dirname":"calibration"},{"modified":1716000000.5,"size":4096,"permissions":"rw","dirname":".thumbs"}],"files":[{"path":"benchy_0.2mm_PLA_MK4_1h4m.gcode","modified":1717000000.000,"size":2000000,"permissions":"rw","filename":"benchy_0.2mm_PLA_MK4_1h4m.gcode","print_start_time":null,"job_id":null,"slicer":"PrusaSlicer","slicer_version":"2.7.1","layer_height":0.2,"first_layer_height":0.2,"object_height":48.0,"filament_total":3856.2,"estimated_time":3840,"thumbnails":[{"width":32,"height":32,"size":1845,"relative_path":".thumbs/benchy_0.2mm_PLA_MK4_1h4m-32x32.png"},{"width":300,"height":300,"size":23016,"relative_path":".thumbs/benchy_0.2mm_PLA_MK4_1h4m-300x300.png"}],"first_layer_bed_temp":60.0,"first_layer_extr_temp":215.0,"gcode_start_byte":56021,"gcode_end_byte":4815302,"filament_name":"Generic PLA","filament_type":"PLA","filament_weight_total":11.5},{"path":"calibration_cube_0.2mm_PETG_22m.gcode","modified":1717086400.370,"size":2731113,"permissions":"rw","filename":"calibration_cube_0.2mm_PETG_22m.gcode","print_start_time":null,"job_id":null,"slicer":"PrusaSlicer","slicer_version":"2.7.1","layer_height":0.2,"first_layer_height":0.2,"object_height":48.0,"filament_total":3856.2,"estimated_time":1320,"thumbnails":[{"width":32,"height":32,"size":1845,"relative_path":".thumbs/calibration_cube_0.2mm_PETG_22m-32x32.png"},{"width":300,"height":300,"size":23016,"relative_path":".thumbs/calibration_cube_0.2mm_PETG_22m-300x300.png"}],"first_layer_bed_temp":60.0,"first_layer_extr_temp":215.0,"gcode_start_byte":56021,"gcode_end_byte":4815302,"filament_name":"Generic PLA","filament_type":"PLA","filament_weight_total":11.5},{"path":"voron_cube_0.2mm_ABS_48m.gcode","modified":1717172800.740,"size":3462226,"permissions":"rw","filename":"voron_cube_0.2mm_ABS_48m.gcode","print_start_time":null,"job_id":null,"slicer":"PrusaSlicer","slicer_version":"2.7.1","layer_height":0.2,"first_layer_height":0.2,"object_height":48.0,"filament_total":3856.2,"estimated_time":2880,"thumbnails":[{"width":32,"height":32,"size":1845,"relative_path":".thumbs/voron_cube_0.2mm_ABS_48m-32x32.png"},{"width":300,"height":300,"size":23016,"relative_path":".thumbs/voron_cube_0.2mm_ABS_48m-300x300.png"}],"first_layer_bed_temp":60.0,"first_layer_extr_temp":215.0,"gcode_start_byte":56021,"gcode_end_byte":4815302,"filament_name":"Generic PLA","filament_type":"PLA","filament_weight_total":11.5},{"path":"spool_holder_0.25mm_PLA_3h12m.gcode","modified":1717259201.110,"size":4193339,"permissions":"rw","filename":"spool_holder_0.25mm_PLA_3h12m.gcode","print_start_time":null,"job_id":null,"slicer":"PrusaSlicer","slicer_version":"2.7.1","layer_height":0.2,"first_layer_height":0.2,"object_height":48.0,"filament_total":3856.2,"estimated_time":11520,"thumbnails":[{"width":32,"height":32,"size":1845,"relative_path":".thumbs/spool_holder_0.25mm_PLA_3h12m-32x32.png"},{"width":300,"height":300,"size":23016,"relative_path":".thumbs/spool_holder_0.25mm_PLA_3h12m-300x300.png"}],"first_layer_bed_temp":60.0,"first_layer_extr_temp":215.0,"gcode_start_byte":56021,"gcode_end_byte":4815302,"filament_name":"Generic PLA","filament_type":"PLA","filament_weight_total":11.5},{"path":"cable_chain_link_0.2mm_PETG_2h5m.gcode","modified":1717345601.480,"size":4924452,"permissions":"rw","filename":"cable_chain_link_0.2mm_PETG_2h5m.gcode","print_start_time":null,"job_id":null,"slicer":"PrusaSlicer","slicer_version":"2.7.1","layer_height":0.2,"first_layer_height":0.2,"object_height":48.0,"filament_total":3856.2,"estimated_time":7500,"thumbnails":[{"width":32,"height":32,"size":1845,"relative_path":".thumbs/cable_chain_link_0.2mm_PETG_2h5m-32x32.png"},{"width":300,"height":300,"size":23016,"relative_path":".thumbs/cable_chain_link_0.2mm_PETG_2h5m-300x300.png"}],"first_layer_bed_temp":60.0,"first_layer_extr_temp":215.0,"gcode_start_byte":56021,"gcode_end_byte":4815302,"filament_name":"Generic PLA","filament_type":"PLA","filament_weight_total":11.5},{"path":"fan_duct_0.2mm_ABS_1h31m.gcode","modified":1717432001.850,"size":5655565,"permissions":"rw","filename":"fan_duct_0.2mm_ABS_1h31m.gcode","print_start_time":null,"job_id":null,"slicer":"PrusaSlicer","slicer_version":"2.7.1","layer_height":0.2,"first_layer_height":0.2,"object_height":48.0,"filament_total":3856.2,"estimated_time":5460,"thumbnails":[{"width":32,"height":32,"size":1845,"relative_path":".thumbs/fan_duct_0.2mm_ABS_1h31m-32x32.png"},{"width":300,"height":300,"size":23016,"relative_path":".thumbs/fan_duct_0.2mm_ABS_1h31m-300x300.png"}],"first_layer_bed_temp":60.0,"first_layer_extr_temp":215.0,"gcode_start_byte":56021,"gcode_end_byte":4815302,"filament_name":"Generic PLA","filament_type":"PLA","filament_weight_total":11.5}],"disk_usage":{"total":30745001984,"used":9132867584,"free":20326797312},"root_info":{"name":"gcodes","permissions":"rw"}}})json";
+
+// GET /printer/objects/list of a Voron with a chamber heater and sensors
+static const char fixtureObjectList[] = R"json({"result":{"objects":["webhooks","configfile","mcu","mcu EBBCan","heaters","gcode_move","print_stats","virtual_sdcard","pause_resume","display_status","gcode_macro PRINT_START","gcode_macro PRINT_END","gcode_macro CANCEL_PRINT","gcode_macro PAUSE","gcode_macro RESUME","exclude_object","firmware_retraction","bed_mesh","probe","quad_gantry_level","stepper_enable","tmc2209 stepper_x","tmc2209 stepper_y","tmc2209 stepper_z","tmc2209 stepper_z1","tmc2209 stepper_z2","tmc2209 stepper_z3","tmc2209 extruder","heater_bed","temperature_sensor raspberry_pi","temperature_sensor octopus","temperature_sensor EBBCan","heater_generic chamber","temperature_fan exhaust","fan","heater_fan hotend_fan","controller_fan controller_fan","fan_generic nevermore","filament_switch_sensor runout","output_pin caselight","idle_timeout","motion_report","query_endstops","system_stats","manual_probe","toolhead","extruder"]}})json";
+
+// POST /printer/objects/query for the objects discovered from fixtureObjectList
+static const char fixtureObjectQuery[] = R"json({"result":{"eventtime":578251.1032,"status":{"extruder":{"temperature":209.91,"target":210.0,"power":0.4483},"heater_bed":{"temperature":60.02,"target":60.0,"power":0.2211},"temperature_sensor raspberry_pi":{"temperature":48.69},"temperature_sensor octopus":{"temperature":41.2},"temperature_sensor EBBCan":{"temperature":52.93},"heater_generic chamber":{"temperature":44.81,"target":45.0,"power":0.8125},"temperature_fan exhaust":{"temperature":44.5,"target":40.0,"speed":0.6},"fan":{"speed":1.0},"heater_fan hotend_fan":{"speed":1.0},"controller_fan controller_fan":{"speed":0.5},"fan_generic nevermore":{"speed":0.8}}}})json";
+
+// POST /server/files/upload, answered with 201 Created
+static const char fixtureUploadCreated[] = R"json({"result":{"item":{"path":"benchy_0.2mm_PLA_MK4_1h4m.gcode","root":"gcodes","modified":1717520000.41,"size":262144,"permissions":"rw"},"print_started":false,"print_queued":false,"action":"create_file"}})json";
+
+// POST /server/jsonrpc batch of printer.objects.query (refresh mask), printer.info
+// and server.info
+static const char fixtureBatchRefresh[] = R"json([{"jsonrpc":"2.0","result":{"eventtime":578243.70121,"status":{"extruder":{"temperature":209.87,"target":210.0,"power":0.4517},"heater_bed":{"temperature":59.98,"target":60.0,"power":0.2318},"toolhead":{"position":[118.25,97.5,2.4,1024.87713],"homed_axes":"xyz","max_velocity":300.0,"max_accel":3000.0,"square_corner_velocity":5.0,"axis_minimum":[0.0,0.0,-2.0,0.0],"axis_maximum":[235.0,235.0,250.0,0.0]},"print_stats":{"state":"printing","filename":"benchy_0.2mm_PLA_MK4_1h4m.gcode","print_duration":1843.2291,"total_duration":1901.7738},"gcode_move":{"speed_factor":1.0,"extrude_factor":1.0},"virtual_sdcard":{"progress":0.4731,"file_size":4823913}}},"id":1},{"jsonrpc":"2.0","result":{"state":"ready","state_message":"Printer is ready","hostname":"voron","klipper_path":"/home/pi/klipper","python_path":"/home/pi/klippy-env/bin/python","log_file":"/home/pi/printer_data/logs/klippy.log","config_file":"/home/pi/printer_data/config/printer.cfg","software_version":"v0.12.0-85-gd785b396","cpu_info":"4 core ARMv7 Processor rev 4 (v7l)","app":"Klipper"},"id":2},{"jsonrpc":"2.0","result":{"klippy_connected":true,"klippy_state":"ready","components":["secrets","template","klippy_connection","jsonrpc","internal_transport","application","websockets","database","dbus_manager","file_manager","klippy_apis","machine","data_store","shell_command","proc_stats","job_state","job_queue","history","authorization","announcements","webcam","extensions","update_manager"],"failed_components":[],"registered_directories":["config","logs","gcodes","config_examples","docs"],"warnings":[],"websocket_count":2,"moonraker_version":"v0.8.0-209-g5836eab","missing_klippy_requirements":[],"api_version":[1,4,0],"api_version_string":"1.4.0"},"id":4}])json";
+
+// POST /server/jsonrpc batch of printer.objects.query (refresh mask), printer.info,
+// server.info, server.job_queue.status and server.history.list (limit 1)
+static const char fixtureBatch[] = R"json([{"jsonrpc":"2.0","result":{"eventtime":578243.70121,"status":{"extruder":{"temperature":209.87,"target":210.0,"power":0.4517},"heater_bed":{"temperature":59.98,"target":60.0,"power":0.2318},"toolhead":{"position":[118.25,97.5,2.4,1024.87713],"homed_axes":"xyz","max_velocity":300.0,"max_accel":3000.0,"square_corner_velocity":5.0,"axis_minimum":[0.0,0.0,-2.0,0.0],"axis_maximum":[235.0,235.0,250.0,0.0]},"print_stats":{"state":"printing","filename":"benchy_0.2mm_PLA_MK4_1h4m.gcode","print_duration":1843.2291,"total_duration":1901.7738},"gcode_move":{"speed_factor":1.0,"extrude_factor":1.0},"virtual_sdcard":{"progress":0.4731,"file_size":4823913}}},"id":1},{"jsonrpc":"2.0","result":{"state":"ready","state_message":"Printer is ready","hostname":"voron","klipper_path":"/home/pi/klipper","python_path":"/home/pi/klippy-env/bin/python","log_file":"/home/pi/printer_data/logs/klippy.log","config_file":"/home/pi/printer_data/config/printer.cfg","software_version":"v0.12.0-85-gd785b396","cpu_info":"4 core ARMv7 Processor rev 4 (v7l)","app":"Klipper"},"id":2},{"jsonrpc":"2.0","result":{"klippy_connected":true,"klippy_state":"ready","components":["secrets","template","klippy_connection","jsonrpc","internal_transport","application","websockets","database","dbus_manager","file_manager","klippy_apis","machine","data_store","shell_command","proc_stats","job_state","job_queue","history","authorization","announcements","webcam","extensions","update_manager"],"failed_components":[],"registered_directories":["config","logs","gcodes","config_examples","docs"],"warnings":[],"websocket_count":2,"moonraker_version":"v0.8.0-209-g5836eab","missing_klippy_requirements":[],"api_version":[1,4,0],"api_version_string":"1.4.0"},"id":4},{"jsonrpc":"2.0","result":{"queued_jobs":[{"filename":"voron_cube_0.2mm_ABS_48m.gcode","job_id":"0000000066D99C90","time_added":1717520000.112,"time_in_queue":21.89},{"filename":"fan_duct_0.2mm_ABS_1h31m.gcode","job_id":"0000000066D99D2A","time_added":1717520154.007,"time_in_queue":0.36}],"queue_state":"ready"},"id":8},{"jsonrpc":"2.0","result":{"count":27,"jobs":[{"job_id":"000012","user":"_TRUSTED_USER_","filename":"benchy_0.2mm_PLA_MK4_1h4m.gcode","exists":true,"status":"in_progress","start_time":1717518098.412,"end_time":null,"print_duration":1843.2291,"total_duration":1901.7738,"filament_used":1024.87713,"metadata":{"size":4823913,"modified":1717000000.0,"slicer":"PrusaSlicer","slicer_version":"2.7.1","layer_height":0.2,"first_layer_height":0.2,"object_height":48.0,"filament_total":3856.2,"estimated_time":3840,"filament_name":"Generic PLA","filament_type":"PLA"},"auxiliary_data":[]}]},"id":16}])json";
+
+// POST /printer/gcode/script, /printer/print/*, /printer/restart, ...
+static const char fixtureOk[] = R"json({"result":"ok"})json";
+
+// notify_status_update pushed over the websocket while printing
+static const char fixtureStatusUpdate[] = R"json({"jsonrpc":"2.0","method":"notify_status_update","params":[{"extruder":{"temperature":210.02,"power":0.4421},"heater_bed":{"temperature":60.01},"toolhead":{"position":[121.4,99.05,2.4,1026.1132]},"print_stats":{"print_duration":1844.2291},"virtual_sdcard":{"progress":0.4733}},578244.61]})json";
+
+#endif
@@ -0,0 +1,1289 @@
+/*
+  MoonrakerSim.cpp - Local Moonraker stand-in for host builds
+*/
+
+#include "MoonrakerSim.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#define SIM_MAX_HEAD        8192
+#define SIM_MAX_BODY        (64 * 1024 * 1024)
+#define SIM_AMBIENT         22.0
+#define SIM_JOB_SECONDS     600.0     // Length of every simulated print
+#define SIM_FILE_SIZE       4823913
+
+static const char* const websocketGuid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// JSON writing
+
+static std::string jsonString(const std::string& text) {
+  std::string out = "\"";
+  for (unsigned char c : text) {
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (c < 0x20) {
+          char escaped[8];
+          snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+          out += escaped;
+        } else {
+          out += (char)c;
+        }
+    }
+  }
+  return out + "\"";
+}
+
+static std::string jsonNumber(double value, int decimals) {
+  char text[32];
+  snprintf(text, sizeof(text), "%.*f", decimals, value);
+  return text;
+}
+
+static std::string jsonArray(const double* values, int count, int decimals) {
+  std::string out = "[";
+  for (int i = 0; i < count; i++) {
+    if (i > 0) out += ',';
+    out += jsonNumber(values[i], decimals);
+  }
+  return out + "]";
+}
+
+// JSON reading, enough for request bodies and JSON-RPC calls
+
+typedef struct SimValue {
+  enum { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT } type = NUL;
+  std::string key;                     // Member name inside an object
+  std::string text;                    // String value, or the number as written
+  std::vector<SimValue> items;         // Array items or object members
+
+  const SimValue* get(const char* name) const {
+    if (type != OBJECT) return nullptr;
+    for (const SimValue& member : items) {
+      if (member.key == name) return &member;
+    }
+    return nullptr;
+  }
+} SimValue;
+
+static void skipSpace(const char*& p, const char* end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+}
+
+static bool parseString(const char*& p, const char* end, std::string& out) {
+  if (p >= end || *p != '"') return false;
+  p++;
+  while (p < end && *p != '"') {
+    char c = *p++;
+    if (c == '\\' && p < end) {
+      char e = *p++;
+      switch (e) {
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'u':
+          if (end - p >= 4) {
+            unsigned code = (unsigned)strtoul(std::string(p, 4).c_str(), nullptr, 16);
+            p += 4;
+            if (code < 0x80) {
+              out += (char)code;
+            } else if (code < 0x800) {
+              out += (char)(0xC0 | (code >> 6));
+              out += (char)(0x80 | (code & 0x3F));
+            } else {
+              out += (char)(0xE0 | (code >> 12));
+              out += (char)(0x80 | ((code >> 6) & 0x3F));
+              out += (char)(0x80 | (code & 0x3F));
+            }
+          }
+          break;
+        default: out += e;
+      }
+    } else {
+      out += c;
+    }
+  }
+  if (p >= end) return false;
+  p++;
+  return true;
+}
+
+static bool parseValue(const char*& p, const char* end, SimValue& out, int depth) {
+  skipSpace(p, end);
+  if (p >= end || depth > 32) return false;
+
+  if (*p == '{') {
+    out.type = SimValue::OBJECT;
+    p++;
+    skipSpace(p, end);
+    if (p < end && *p == '}') { p++; return true; }
+    for (;;) {
+      SimValue member;
+      skipSpace(p, end);
+      if (!parseString(p, end, member.key)) return false;
+      skipSpace(p, end);
+      if (p >= end || *p++ != ':') return false;
+      if (!parseValue(p, end, member, depth + 1)) return false;
+      out.items.push_back(member);
+      skipSpace(p, end);
+      if (p < end && *p == ',') { p++; continue; }
+      if (p < end && *p == '}') { p++; return true; }
+      return false;
+    }
+  }
+  if (*p == '[') {
+    out.type = SimValue::ARRAY;
+    p++;
+    skipSpace(p, end);
+    if (p < end && *p == ']') { p++; return true; }
+    for (;;) {
+      SimValue item;
+      if (!parseValue(p, end, item, depth + 1)) return false;
+      out.items.push_back(item);
+      skipSpace(p, end);
+      if (p < end && *p == ',') { p++; continue; }
+      if (p < end && *p == ']') { p++; return true; }
+      return false;
+    }
+  }
+  if (*p == '"') {
+    out.type = SimValue::STRING;
+    return parseString(p, end, out.text);
+  }
+
+  const char* start = p;
+  while (p < end && (isalnum((unsigned char)*p) || *p == '-' || *p == '+' || *p == '.')) p++;
+  out.text.assign(start, p - start);
+  if (out.text == "null") {
+    out.type = SimValue::NUL;
+  } else if (out.text == "true" || out.text == "false") {
+    out.type = SimValue::BOOLEAN;
+  } else if (!out.text.empty()) {
+    out.type = SimValue::NUMBER;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static bool parseJson(const std::string& text, SimValue& out) {
+  const char* p = text.data();
+  const char* end = p + text.size();
+  if (!parseValue(p, end, out, 0)) return false;
+  skipSpace(p, end);
+  return p == end;
+}
+
+// Selection from the "objects" member of a query or subscribe request
+static SimSelection selectionFrom(const SimValue* objects) {
+  SimSelection selection;
+  if (objects == nullptr || objects->type != SimValue::OBJECT) return selection;
+  for (const SimValue& member : objects->items) {
+    std::vector<std::string> attributes;
+    for (const SimValue& item : member.items) {
+      attributes.push_back(item.text);
+    }
+    selection.push_back(std::make_pair(member.key, attributes));
+  }
+  return selection;
+}
+
+static std::string urlDecode(const std::string& text) {
+  std::string out;
+  for (size_t i = 0; i < text.size(); i++) {
+    if (text[i] == '%' && i + 2 < text.size()) {
+      out += (char)strtoul(text.substr(i + 1, 2).c_str(), nullptr, 16);
+      i += 2;
+    } else if (text[i] == '+') {
+      out += ' ';
+    } else {
+      out += text[i];
+    }
+  }
+  return out;
+}
+
+// extruder=temperature,target&heater_bed&toolhead=position
+static SimSelection selectionFromQuery(const std::string& query) {
+  SimSelection selection;
+  size_t start = 0;
+  while (start < query.size()) {
+    size_t end = query.find('&', start);
+    if (end == std::string::npos) end = query.size();
+    std::string part = query.substr(start, end - start);
+    size_t equals = part.find('=');
+    std::vector<std::string> attributes;
+    if (equals != std::string::npos) {
+      std::string list = urlDecode(part.substr(equals + 1));
+      size_t from = 0;
+      while (from <= list.size()) {
+        size_t comma = list.find(',', from);
+        if (comma == std::string::npos) comma = list.size();
+        if (comma > from) attributes.push_back(list.substr(from, comma - from));
+        from = comma + 1;
+      }
+      part = part.substr(0, equals);
+    }
+    if (!part.empty()) {
+      selection.push_back(std::make_pair(urlDecode(part), attributes));
+    }
+    start = end + 1;
+  }
+  return selection;
+}
+
+// Value of name=... in a query string
+static std::string queryParameter(const std::string& query, const char* name) {
+  std::string key = std::string(name) + "=";
+  size_t start = 0;
+  while (start < query.size()) {
+    size_t end = query.find('&', start);
+    if (end == std::string::npos) end = query.size();
+    if (query.compare(start, key.size(), key) == 0) {
+      return urlDecode(query.substr(start + key.size(), end - start - key.size()));
+    }
+    start = end + 1;
+  }
+  return "";
+}
+
+// SHA-1 and base64 for Sec-WebSocket-Accept
+
+static std::string sha1(const std::string& message) {
+  uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+  std::string data = message;
+  uint64_t bits = (uint64_t)message.size() * 8;
+  data += (char)0x80;
+  while (data.size() % 64 != 56) data += (char)0;
+  for (int i = 7; i >= 0; i--) data += (char)(bits >> (i * 8));
+
+  for (size_t chunk = 0; chunk < data.size(); chunk += 64) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+      const unsigned char* b = (const unsigned char*)data.data() + chunk + i * 4;
+      w[i] = ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+    }
+    for (int i = 16; i < 80; i++) {
+      uint32_t v = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+      w[i] = (v << 1) | (v >> 31);
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+      uint32_t f, k;
+      if (i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+      else if (i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+      else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+      else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+      uint32_t t = ((a << 5) | (a >> 27)) + f + e + k + w[i];
+      e = d; d = c; c = (b << 30) | (b >> 2); b = a; a = t;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+  }
+
+  std::string digest;
+  for (int i = 0; i < 5; i++) {
+    for (int j = 3; j >= 0; j--) digest += (char)(h[i] >> (j * 8));
+  }
+  return digest;
+}
+
+static std::string base64(const std::string& data) {
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < data.size(); i += 3) {
+    uint32_t v = (uint8_t)data[i] << 16;
+    if (i + 1 < data.size()) v |= (uint8_t)data[i + 1] << 8;
+    if (i + 2 < data.size()) v |= (uint8_t)data[i + 2];
+    out += alphabet[(v >> 18) & 63];
+    out += alphabet[(v >> 12) & 63];
+    out += i + 1 < data.size() ? alphabet[(v >> 6) & 63] : '=';
+    out += i + 2 < data.size() ? alphabet[v & 63] : '=';
+  }
+  return out;
+}
+
+// The simulated printer. Every call is made with _printerLock held.
+
+typedef struct {
+  double temperature;
+  double target;
+  double power;
+  double tau;                          // Seconds to cover 63% of the way to target
+} SimHeater;
+
+class SimPrinter {
+public:
+  SimPrinter() : _started(std::chrono::steady_clock::now()), _updated(_started), _random(7125) {
+    _extruder = { SIM_AMBIENT, 0, 0, 6.0 };
+    _bed = { SIM_AMBIENT, 0, 0, 25.0 };
+    _chamber = { SIM_AMBIENT, 0, 0, 90.0 };
+  }
+
+  double eventTime() const { return 578000.0 + secondsSince(_started); }
+
+  // Move everything on to now
+  void advance() {
+    auto now = std::chrono::steady_clock::now();
+    double dt = std::chrono::duration<double>(now - _updated).count();
+    _updated = now;
+    heat(_extruder, dt);
+    heat(_bed, dt);
+    heat(_chamber, dt);
+    _exhaust = _chamber.temperature - 0.5;
+
+    if (_state == "printing") {
+      _printDuration += dt * _speedFactor;
+      _progress = _printDuration / SIM_JOB_SECONDS;
+      double t = _printDuration;
+      _position[0] = 117.5 + 60.0 * sin(t / 3.0);
+      _position[1] = 117.5 + 60.0 * cos(t / 5.0);
+      _position[2] = 0.2 + 0.2 * floor(t / 30.0);
+      _position[3] += dt * 2.0 * _extrudeFactor;
+      if (_progress >= 1.0) {
+        _progress = 1.0;
+        _state = "complete";
+        _extruder.target = 0;
+        _bed.target = 0;
+      }
+    }
+    if (_state == "printing" || _state == "paused") {
+      _totalDuration += dt;
+    }
+  }
+
+  // Every object with every attribute, values as JSON text
+  std::vector<std::pair<std::string, std::vector<std::pair<std::string, std::string> > > > objects() {
+    std::vector<std::pair<std::string, std::vector<std::pair<std::string, std::string> > > > all;
+    auto add = [&all](const char* name) -> std::vector<std::pair<std::string, std::string> >& {
+      all.push_back(std::make_pair(std::string(name), std::vector<std::pair<std::string, std::string> >()));
+      return all.back().second;
+    };
+    auto field = [](std::vector<std::pair<std::string, std::string> >& object, const char* name, const std::string& value) {
+      object.push_back(std::make_pair(std::string(name), value));
+    };
+    auto heater = [&](const char* name, const SimHeater& h) {
+      auto& object = add(name);
+      field(object, "temperature", jsonNumber(h.temperature, 2));
+      field(object, "target", jsonNumber(h.target, 1));
+      field(object, "power", jsonNumber(h.power, 4));
+    };
+
+    auto& webhooks = add("webhooks");
+    field(webhooks, "state", jsonString(_klippyState));
+    field(webhooks, "state_message", jsonString(_klippyState == "ready" ? "Printer is ready" : "Emergency stop"));
+
+    auto& configfile = add("configfile");
+    field(configfile, "settings",
+          "{\"printer\":{\"kinematics\":\"corexy\",\"max_velocity\":300.0,\"max_accel\":3000.0,"
+          "\"max_z_velocity\":15.0,\"max_z_accel\":350.0,\"square_corner_velocity\":5.0},"
+          "\"stepper_x\":{\"position_min\":0.0,\"position_max\":235.0},"
+          "\"stepper_y\":{\"position_min\":0.0,\"position_max\":235.0},"
+          "\"stepper_z\":{\"position_min\":-2.0,\"position_max\":250.0}}");
+
+    heater("extruder", _extruder);
+    all.back().second.push_back(std::make_pair(std::string("can_extrude"), std::string(_extruder.temperature > 170 ? "true" : "false")));
+    heater("heater_bed", _bed);
+    heater("heater_generic chamber", _chamber);
+
+    auto& pi = add("temperature_sensor raspberry_pi");
+    field(pi, "temperature", jsonNumber(48.7 + noise(0.3), 2));
+    auto& exhaust = add("temperature_fan exhaust");
+    field(exhaust, "temperature", jsonNumber(_exhaust, 2));
+    field(exhaust, "target", "40.0");
+    field(exhaust, "speed", jsonNumber(_exhaust > 40.0 ? 0.6 : 0.0, 2));
+    auto& fan = add("fan");
+    field(fan, "speed", jsonNumber(_fanSpeed, 2));
+    field(fan, "rpm", "null");
+    auto& hotendFan = add("heater_fan hotend_fan");
+    field(hotendFan, "speed", _extruder.temperature > 50 ? "1.0" : "0.0");
+    auto& nevermore = add("fan_generic nevermore");
+    field(nevermore, "speed", _state == "printing" ? "0.8" : "0.0");
+
+    static const double axisMinimum[4] = { 0.0, 0.0, -2.0, 0.0 };
+    static const double axisMaximum[4] = { 235.0, 235.0, 250.0, 0.0 };
+    auto& toolhead = add("toolhead");
+    field(toolhead, "position", jsonArray(_position, 4, 5));
+    field(toolhead, "homed_axes", jsonString(_homedAxes));
+    field(toolhead, "max_velocity", "300.0");
+    field(toolhead, "max_accel", "3000.0");
+    field(toolhead, "square_corner_velocity", "5.0");
+    field(toolhead, "axis_minimum", jsonArray(axisMinimum, 4, 1));
+    field(toolhead, "axis_maximum", jsonArray(axisMaximum, 4, 1));
+
+    auto& gcodeMove = add("gcode_move");
+    field(gcodeMove, "speed_factor", jsonNumber(_speedFactor, 2));
+    field(gcodeMove, "extrude_factor", jsonNumber(_extrudeFactor, 2));
+    field(gcodeMove, "absolute_coordinates", _relative ? "false" : "true");
+
+    auto& printStats = add("print_stats");
+    field(printStats, "filename", jsonString(_filename));
+    field(printStats, "total_duration", jsonNumber(_totalDuration, 4));
+    field(printStats, "print_duration", jsonNumber(_printDuration, 4));
+    field(printStats, "state", jsonString(_state));
+    field(printStats, "message", "\"\"");
+
+    auto& sdcard = add("virtual_sdcard");
+    field(sdcard, "progress", jsonNumber(_progress, 4));
+    field(sdcard, "is_active", _state == "printing" ? "true" : "false");
+    field(sdcard, "file_size", _filename.empty() ? "0" : std::to_string(SIM_FILE_SIZE));
+
+    auto& idle = add("idle_timeout");
+    field(idle, "state", _state == "printing" ? "\"Printing\"" : "\"Ready\"");
+    return all;
+  }
+
+  // Run a G-code script; false with message set for an unknown command
+  bool gcode(const std::string& script, std::string& message) {
+    size_t start = 0;
+    while (start < script.size()) {
+      size_t end = script.find('\n', start);
+      if (end == std::string::npos) end = script.size();
+      std::string line = script.substr(start, end - start);
+      start = end + 1;
+      size_t comment = line.find(';');
+      if (comment != std::string::npos) line.erase(comment);
+      if (!command(line, message)) return false;
+    }
+    return true;
+  }
+
+  bool startPrint(const std::string& filename, std::string& message) {
+    if (_state == "printing" || _state == "paused") {
+      message = "Printer is busy";
+      return false;
+    }
+    _filename = filename;
+    _state = "printing";
+    _jobStart = (double)time(nullptr);
+    _jobStartE = _position[3];
+    _printDuration = 0;
+    _totalDuration = 0;
+    _progress = 0;
+    _extruder.target = 210;
+    _bed.target = 60;
+    return true;
+  }
+
+  // PAUSE and RESUME in the wrong state only report it, like Klipper
+  void pause() { if (_state == "printing") _state = "paused"; }
+  void resume() { if (_state == "paused") _state = "printing"; }
+  void cancel() {
+    if (_state == "printing" || _state == "paused") {
+      _state = "cancelled";
+      _extruder.target = 0;
+      _bed.target = 0;
+    }
+  }
+  void emergencyStop() {
+    _klippyState = "shutdown";
+    _state = "error";
+    _extruder.target = _bed.target = _chamber.target = 0;
+  }
+  void restart() {
+    _klippyState = "ready";
+    _state = "standby";
+    _homedAxes = "";
+  }
+  bool ready() const { return _klippyState == "ready"; }
+
+  // The current or last job as a server.history.list entry, "" before the first
+  std::string historyJob() const {
+    if (_filename.empty()) return "";
+    std::string status = "in_progress";
+    if (_state == "complete") status = "completed";
+    else if (_state == "cancelled") status = "cancelled";
+    else if (_state == "error") status = "klippy_shutdown";
+    else if (_state == "standby") status = "interrupted";
+    bool done = status != "in_progress";
+    return "{\"job_id\":\"000001\",\"exists\":true,\"filename\":" + jsonString(_filename) +
+           ",\"status\":\"" + status + "\",\"start_time\":" + jsonNumber(_jobStart, 3) +
+           ",\"end_time\":" + (done ? jsonNumber(_jobStart + _totalDuration, 3) : std::string("null")) +
+           ",\"print_duration\":" + jsonNumber(_printDuration, 4) +
+           ",\"total_duration\":" + jsonNumber(_totalDuration, 4) +
+           ",\"filament_used\":" + jsonNumber(_position[3] - _jobStartE, 4) + ",\"metadata\":{}}";
+  }
+
+private:
+  void heat(SimHeater& heater, double dt) {
+    double goal = heater.target > 0 ? heater.target : SIM_AMBIENT;
+    heater.temperature += (goal - heater.temperature) * (1.0 - exp(-dt / heater.tau));
+    heater.temperature += noise(0.05);
+    double power = heater.target > 0 ? 0.25 + (heater.target - heater.temperature) / 20.0 : 0.0;
+    heater.power = power < 0 ? 0 : (power > 1 ? 1 : power);
+  }
+
+  double noise(double amplitude) {
+    return std::uniform_real_distribution<double>(-amplitude, amplitude)(_random);
+  }
+
+  // Value of a parameter such as S in "M104 S210", or TARGET= in extended G-code
+  static bool parameter(const std::string& line, const char* name, double& value) {
+    size_t length = strlen(name);
+    for (size_t i = 0; i + length <= line.size(); i++) {
+      bool boundary = (i == 0 || line[i - 1] == ' ');
+      if (boundary && strncasecmp(line.c_str() + i, name, length) == 0) {
+        const char* text = line.c_str() + i + length;
+        char* end;
+        value = strtod(text, &end);
+        return end != text;
+      }
+    }
+    return false;
+  }
+
+  bool command(std::string line, std::string& message) {
+    while (!line.empty() && (line[0] == ' ' || line[0] == '\t')) line.erase(0, 1);
+    if (line.empty()) return true;
+    std::string name = line.substr(0, line.find(' '));
+    for (char& c : name) c = (char)toupper((unsigned char)c);
+    double value;
+
+    if (name == "M104" || name == "M109") {
+      if (parameter(line, "S", value)) _extruder.target = value;
+    } else if (name == "M140" || name == "M190") {
+      if (parameter(line, "S", value)) _bed.target = value;
+    } else if (name == "M141" || name == "M191") {
+      if (parameter(line, "S", value)) _chamber.target = value;
+    } else if (name == "SET_HEATER_TEMPERATURE") {
+      if (!parameter(line, "TARGET=", value)) value = 0;
+      if (line.find("HEATER=extruder") != std::string::npos) _extruder.target = value;
+      else if (line.find("HEATER=heater_bed") != std::string::npos) _bed.target = value;
+      else if (line.find("HEATER=chamber") != std::string::npos) _chamber.target = value;
+    } else if (name == "M106") {
+      _fanSpeed = parameter(line, "S", value) ? value / 255.0 : 1.0;
+    } else if (name == "M107") {
+      _fanSpeed = 0;
+    } else if (name == "M220") {
+      if (parameter(line, "S", value)) _speedFactor = value / 100.0;
+    } else if (name == "M221") {
+      if (parameter(line, "S", value)) _extrudeFactor = value / 100.0;
+    } else if (name == "G28") {
+      bool any = false;
+      static const char axes[] = "XYZ";
+      for (int i = 0; i < 3; i++) {
+        char axis[2] = { axes[i], 0 };
+        if (line.find(axis) != std::string::npos && line.find(axis) > 2) {
+          any = true;
+          _position[i] = 0;
+          if (_homedAxes.find((char)tolower(axes[i])) == std::string::npos) _homedAxes += (char)tolower(axes[i]);
+        }
+      }
+      if (!any) {
+        _position[0] = _position[1] = _position[2] = 0;
+        _homedAxes = "xyz";
+      }
+    } else if (name == "G90") {
+      _relative = false;
+    } else if (name == "G91") {
+      _relative = true;
+    } else if (name == "G0" || name == "G1") {
+      static const char* const axes[] = { "X", "Y", "Z", "E" };
+      for (int i = 0; i < 4; i++) {
+        if (parameter(line, axes[i], value)) {
+          _position[i] = _relative ? _position[i] + value : value;
+        }
+      }
+    } else if (name == "M400" || name == "M84" || name == "M18" || name == "M117" ||
+               name == "G4" || name == "M83" || name == "M82" || name == "G92") {
+      // Accepted, nothing to simulate
+    } else {
+      message = "Unknown command:\"" + name + "\"";
+      return false;
+    }
+    return true;
+  }
+
+  std::chrono::steady_clock::time_point _started;
+  std::chrono::steady_clock::time_point _updated;
+  std::mt19937 _random;
+  SimHeater _extruder;
+  SimHeater _bed;
+  SimHeater _chamber;
+  double _exhaust = SIM_AMBIENT;
+  double _fanSpeed = 0;
+  double _position[4] = { 0, 0, 0, 0 };
+  bool _relative = false;
+  std::string _homedAxes;
+  double _speedFactor = 1.0;
+  double _extrudeFactor = 1.0;
+  std::string _klippyState = "ready";
+  std::string _state = "standby";
+  std::string _filename;
+  double _printDuration = 0;
+  double _totalDuration = 0;
+  double _progress = 0;
+  double _jobStart = 0;                // Unix time
+  double _jobStartE = 0;
+};
+
+// Server
+
+MoonrakerSim::MoonrakerSim(const MoonrakerSimOptions& options)
+  : _options(options), _printer(new SimPrinter()) {
+}
+
+MoonrakerSim::~MoonrakerSim() {
+  stop();
+  delete _printer;
+}
+
+bool MoonrakerSim::start(uint16_t port, bool any) {
+  _listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  if (_listenFd < 0) {
+    return false;
+  }
+  int one = 1;
+  setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(any ? INADDR_ANY : INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  if (bind(_listenFd, (sockaddr*)&address, length) < 0 || listen(_listenFd, 128) < 0 ||
+      getsockname(_listenFd, (sockaddr*)&address, &length) < 0) {
+    close(_listenFd);
+    _listenFd = -1;
+    return false;
+  }
+
+  _port = ntohs(address.sin_port);
+  _running = true;
+  _acceptThread = std::thread(&MoonrakerSim::acceptLoop, this);
+  return true;
+}
+
+// Shutting the sockets down wakes every thread blocked on them
+void MoonrakerSim::stop() {
+  if (!_running.exchange(false)) {
+    return;
+  }
+  shutdown(_listenFd, SHUT_RDWR);
+  _acceptThread.join();
+  close(_listenFd);
+  _listenFd = -1;
+
+  std::unique_lock<std::mutex> lock(_connectionLock);
+  for (int fd : _connectionFds) {
+    shutdown(fd, SHUT_RDWR);
+  }
+  _connectionsDone.wait(lock, [this] { return _active == 0; });
+}
+
+void MoonrakerSim::acceptLoop() {
+  while (_running) {
+    int fd = accept(_listenFd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      break;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    connections++;
+
+    std::lock_guard<std::mutex> lock(_connectionLock);
+    _connectionFds.insert(fd);
+    _active++;
+    std::thread(&MoonrakerSim::serve, this, fd).detach();
+  }
+}
+
+// Bytes from fd appended to input; false once the peer is gone
+static bool receive(int fd, std::string& input) {
+  char buffer[4096];
+  ssize_t n;
+  do {
+    n = recv(fd, buffer, sizeof(buffer), 0);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0) {
+    return false;
+  }
+  input.append(buffer, n);
+  return true;
+}
+
+static std::string headerValue(const std::string& head, const char* name) {
+  std::string key = std::string("\r\n") + name + ":";
+  for (size_t i = 0; i + key.size() <= head.size(); i++) {
+    if (strncasecmp(head.c_str() + i, key.c_str(), key.size()) == 0) {
+      size_t start = i + key.size();
+      size_t end = head.find("\r\n", start);
+      while (start < end && head[start] == ' ') start++;
+      return head.substr(start, end - start);
+    }
+  }
+  return "";
+}
+
+static const char* reason(int status) {
+  switch (status) {
+    case 101: return "Switching Protocols";
+    case 200: return "OK";
+    case 201: return "Created";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 503: return "Service Unavailable";
+  }
+  return "Error";
+}
+
+void MoonrakerSim::serve(int fd) {
+  std::string input;
+  bool open = true;
+
+  while (open && _running) {
+    size_t headEnd;
+    while ((headEnd = input.find("\r\n\r\n")) == std::string::npos) {
+      if (input.size() > SIM_MAX_HEAD || !receive(fd, input)) {
+        open = false;
+        break;
+      }
+    }
+    if (!open) break;
+
+    std::string head = input.substr(0, headEnd + 2);
+    size_t bodyLength = strtoul(headerValue(head, "Content-Length").c_str(), nullptr, 10);
+    if (bodyLength > SIM_MAX_BODY) break;
+    while (input.size() < headEnd + 4 + bodyLength) {
+      if (!receive(fd, input)) {
+        open = false;
+        break;
+      }
+    }
+    if (!open) break;
+
+    std::string body = input.substr(headEnd + 4, bodyLength);
+    input.erase(0, headEnd + 4 + bodyLength);
+    requests++;
+
+    size_t methodEnd = head.find(' ');
+    size_t targetEnd = head.find(' ', methodEnd + 1);
+    if (methodEnd == std::string::npos || targetEnd == std::string::npos) break;
+    std::string method = head.substr(0, methodEnd);
+    std::string target = head.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+
+    std::string key = headerValue(head, "Sec-WebSocket-Key");
+    if (target == "/websocket" && !key.empty()) {
+      serveWebsocket(fd, key, input);
+      break;
+    }
+
+    if (_options.dropRate > 0 && roll() < _options.dropRate) {
+      drops++;
+      break;
+    }
+    bool keepAlive = _options.keepAlive && strcasecmp(headerValue(head, "Connection").c_str(), "close") != 0;
+
+    delayResponse();
+    int status;
+    std::string result;
+    bool rpc = false;
+    if (_options.errorRate > 0 && roll() < _options.errorRate) {
+      errorsInjected++;
+      status = 503;
+      result = "Simulated failure";
+    } else if (method == "POST" && target == "/server/jsonrpc") {
+      status = 200;
+      result = jsonRpc(body);
+      rpc = true;
+    } else {
+      status = route(method, target, body, result);
+    }
+
+    // Filler goes first in the result so the client has to skip over it
+    std::string response;
+    if (rpc) {
+      response = result;
+    } else if (status == 200 || status == 201) {
+      if (_options.padding > 0 && !result.empty() && result[0] == '{') {
+        std::string filler = "{\"sim_padding\":\"" + std::string(_options.padding, 'x') + "\"";
+        result = filler + (result == "{}" ? "}" : "," + result.substr(1));
+      }
+      response = "{\"result\":" + result + "}";
+    } else {
+      response = "{\"error\":{\"code\":" + std::to_string(status) + ",\"message\":" + jsonString(result) + "}}";
+    }
+
+    std::string out = "HTTP/1.1 " + std::to_string(status) + " " + reason(status) + "\r\n"
+                      "Content-Type: application/json; charset=UTF-8\r\n";
+    if (_options.chunkSize > 0) {
+      out += "Transfer-Encoding: chunked\r\n";
+    } else {
+      out += "Content-Length: " + std::to_string(response.size()) + "\r\n";
+    }
+    out += keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    if (_options.chunkSize > 0) {
+      for (size_t i = 0; i < response.size(); i += _options.chunkSize) {
+        size_t length = std::min(_options.chunkSize, response.size() - i);
+        char size[16];
+        snprintf(size, sizeof(size), "%zx\r\n", length);
+        out += size;
+        out.append(response, i, length);
+        out += "\r\n";
+      }
+      out += "0\r\n\r\n";
+    } else {
+      out += response;
+    }
+
+    open = sendAll(fd, out) && keepAlive;
+  }
+
+  close(fd);
+  std::lock_guard<std::mutex> lock(_connectionLock);
+  _connectionFds.erase(fd);
+  if (--_active == 0) {
+    _connectionsDone.notify_all();
+  }
+}
+
+// Status of HTTP request target; result is the JSON result, or the error
+// message for any status other than 200/201
+int MoonrakerSim::route(const std::string& method, const std::string& target, const std::string& body,
+                        std::string& result) {
+  size_t question = target.find('?');
+  std::string path = target.substr(0, question);
+  std::string query = question == std::string::npos ? "" : target.substr(question + 1);
+  SimValue json;
+  if (!body.empty() && body[0] == '{' && !parseJson(body, json)) {
+    result = "Invalid JSON body";
+    return 400;
+  }
+
+  if (path == "/printer/objects/query") {
+    SimSelection selection = method == "POST" ? selectionFrom(json.get("objects")) : selectionFromQuery(query);
+    result = "{\"eventtime\":" + eventTime() + ",\"status\":" + status(selection, nullptr) + "}";
+    return 200;
+  }
+
+  std::lock_guard<std::mutex> lock(_printerLock);
+  SimPrinter& printer = *_printer;
+  printer.advance();
+
+  if (path == "/printer/info" && method == "GET") {
+    result = std::string("{\"state\":") + (printer.ready() ? "\"ready\"" : "\"shutdown\"") +
+             ",\"state_message\":" + (printer.ready() ? "\"Printer is ready\"" : "\"Emergency stop\"") +
+             ",\"hostname\":\"moonraker-sim\",\"software_version\":\"v0.12.0-sim\",\"cpu_info\":\"host\","
+             "\"klipper_path\":\"/home/pi/klipper\",\"python_path\":\"/home/pi/klippy-env/bin/python\","
+             "\"log_file\":\"/home/pi/printer_data/logs/klippy.log\","
+             "\"config_file\":\"/home/pi/printer_data/config/printer.cfg\"}";
+    return 200;
+  }
+  if (path == "/server/info" && method == "GET") {
+    result = std::string("{\"klippy_connected\":true,\"klippy_state\":") +
+             (printer.ready() ? "\"ready\"" : "\"shutdown\"") +
+             ",\"components\":[\"klippy_apis\",\"file_manager\",\"websockets\"],\"failed_components\":[],"
+             "\"registered_directories\":[\"config\",\"gcodes\"],\"warnings\":[],\"websocket_count\":0,"
+             "\"moonraker_version\":\"v0.8.0-sim\",\"api_version\":[1,4,0],\"api_version_string\":\"1.4.0\"}";
+    return 200;
+  }
+  if (path == "/server/job_queue/status" && method == "GET") {
+    result = "{\"queued_jobs\":[],\"queue_state\":\"ready\"}";
+    return 200;
+  }
+  if (path == "/server/history/list" && method == "GET") {
+    std::string job = printer.historyJob();
+    result = "{\"count\":" + std::string(job.empty() ? "0" : "1") + ",\"jobs\":[" + job + "]}";
+    return 200;
+  }
+  if (path == "/printer/objects/list" && method == "GET") {
+    result = "{\"objects\":[";
+    bool first = true;
+    for (const auto& object : printer.objects()) {
+      result += (first ? "" : ",") + jsonString(object.first);
+      first = false;
+    }
+    result += "]}";
+    return 200;
+  }
+  if (method != "POST") {
+    result = "Not Found";
+    return 404;
+  }
+
+  if (path == "/printer/gcode/script") {
+    const SimValue* script = json.get("script");
+    std::string text = script != nullptr ? script->text : queryParameter(query, "script");
+    if (!printer.gcode(text, result)) return 400;
+    result = "\"ok\"";
+    return 200;
+  }
+  if (path == "/printer/print/start") {
+    const SimValue* filename = json.get("filename");
+    std::string name = filename != nullptr ? filename->text : queryParameter(query, "filename");
+    if (!printer.startPrint(name, result)) return 400;
+    result = "\"ok\"";
+    return 200;
+  }
+  if (path == "/server/files/upload") {
+    // The file part's name and size are enough for the reply
+    size_t nameStart = body.find("filename=\"");
+    std::string name = "upload.gcode";
+    if (nameStart != std::string::npos) {
+      nameStart += 10;
+      name = body.substr(nameStart, body.find('"', nameStart) - nameStart);
+    }
+    bool print = body.find("name=\"print\"\r\n\r\ntrue") != std::string::npos;
+    result = "{\"item\":{\"path\":" + jsonString(name) + ",\"root\":\"gcodes\",\"size\":" +
+             std::to_string(body.size()) + "},\"print_started\":" + (print ? "true" : "false") +
+             ",\"print_queued\":false,\"action\":\"create_file\"}";
+    if (print) {
+      std::string message;
+      printer.startPrint(name, message);
+    }
+    return 201;
+  }
+
+  result = "\"ok\"";
+  if (path == "/printer/print/pause") {
+    printer.pause();
+  } else if (path == "/printer/print/resume") {
+    printer.resume();
+  } else if (path == "/printer/print/cancel") {
+    printer.cancel();
+  } else if (path == "/printer/emergency_stop") {
+    printer.emergencyStop();
+  } else if (path == "/printer/restart" || path == "/printer/firmware_restart") {
+    printer.restart();
+  } else if (path == "/machine/reboot") {
+    printer.restart();
+  } else {
+    result = "Not Found";
+    return 404;
+  }
+  return 200;
+}
+
+// Selected attributes as a JSON object. With sent, only values that
+// differ from it are included and sent is updated.
+std::string MoonrakerSim::status(const SimSelection& selection, SimSnapshot* sent) {
+  std::lock_guard<std::mutex> lock(_printerLock);
+  _printer->advance();
+  auto objects = _printer->objects();
+
+  std::string out = "{";
+  bool firstObject = true;
+  for (const auto& wanted : selection) {
+    for (const auto& object : objects) {
+      if (object.first != wanted.first) continue;
+
+      std::string fields;
+      for (const auto& field : object.second) {
+        bool selected = wanted.second.empty();
+        for (const std::string& attribute : wanted.second) {
+          selected = selected || attribute == field.first;
+        }
+        if (!selected) continue;
+        if (sent != nullptr) {
+          std::string& last = (*sent)[object.first + " " + field.first];
+          if (last == field.second) continue;
+          last = field.second;
+        }
+        fields += (fields.empty() ? "" : ",") + jsonString(field.first) + ":" + field.second;
+      }
+      if (sent != nullptr && fields.empty()) break;
+      out += (firstObject ? "" : ",") + jsonString(object.first) + ":{" + fields + "}";
+      firstObject = false;
+      break;
+    }
+  }
+  return out + "}";
+}
+
+// Printer clock in seconds, as Klipper's eventtime
+std::string MoonrakerSim::eventTime() {
+  std::lock_guard<std::mutex> lock(_printerLock);
+  return jsonNumber(_printer->eventTime(), 5);
+}
+
+// Server to client frames are never masked
+static std::string websocketFrame(uint8_t opcode, const std::string& payload) {
+  std::string frame(1, (char)(0x80 | opcode));
+  if (payload.size() < 126) {
+    frame += (char)payload.size();
+  } else if (payload.size() < 65536) {
+    frame += (char)126;
+    frame += (char)(payload.size() >> 8);
+    frame += (char)(payload.size() & 0xFF);
+  } else {
+    frame += (char)127;
+    for (int i = 7; i >= 0; i--) frame += (char)((uint64_t)payload.size() >> (i * 8));
+  }
+  return frame + payload;
+}
+
+void MoonrakerSim::serveWebsocket(int fd, const std::string& key, std::string& input) {
+  std::string accept = base64(sha1(key + websocketGuid));
+  if (!sendAll(fd, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                   "Sec-WebSocket-Accept: " + accept + "\r\n\r\n")) {
+    return;
+  }
+
+  SimSelection subscription;
+  SimSnapshot sent;
+  auto lastPush = std::chrono::steady_clock::now();
+
+  while (_running) {
+    // Whole frames first, then wait for more or for the next push
+    while (input.size() >= 2) {
+      const unsigned char* bytes = (const unsigned char*)input.data();
+      uint8_t opcode = bytes[0] & 0x0F;
+      bool masked = bytes[1] & 0x80;
+      uint64_t length = bytes[1] & 0x7F;
+      size_t offset = 2;
+      if (length == 126) {
+        if (input.size() < 4) break;
+        length = ((uint64_t)bytes[2] << 8) | bytes[3];
+        offset = 4;
+      } else if (length == 127) {
+        if (input.size() < 10) break;
+        length = 0;
+        for (int i = 0; i < 8; i++) length = (length << 8) | bytes[2 + i];
+        offset = 10;
+      }
+      size_t maskOffset = offset;
+      if (masked) offset += 4;
+      if (input.size() < offset + length) break;
+
+      std::string payload = input.substr(offset, length);
+      if (masked) {
+        for (size_t i = 0; i < payload.size(); i++) payload[i] ^= input[maskOffset + (i & 3)];
+      }
+      input.erase(0, offset + length);
+
+      if (opcode == 0x8) {
+        sendAll(fd, websocketFrame(0x8, payload.substr(0, 2)));
+        return;
+      }
+      if (opcode == 0x9) {
+        sendAll(fd, websocketFrame(0xA, payload));
+        continue;
+      }
+      if (opcode != 0x1) {
+        continue;
+      }
+
+      requests++;
+      std::string reply;
+      delayResponse();
+      if (call(payload, reply, subscription, sent) && !sendAll(fd, websocketFrame(0x1, reply))) {
+        return;
+      }
+    }
+
+    int wait = (int)_options.wsIntervalMs;
+    if (!subscription.empty()) {
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - lastPush);
+      wait = elapsed.count() >= wait ? 0 : wait - (int)elapsed.count();
+    }
+    pollfd readable = { fd, POLLIN, 0 };
+    int ready = poll(&readable, 1, wait);
+    if (ready > 0 && !receive(fd, input)) {
+      return;
+    }
+
+    if (!subscription.empty() && secondsSince(lastPush) * 1000 >= _options.wsIntervalMs) {
+      lastPush = std::chrono::steady_clock::now();
+      std::string changes = status(subscription, &sent);
+      if (changes != "{}") {
+        pushes++;
+        if (!sendAll(fd, websocketFrame(0x1, "{\"jsonrpc\":\"2.0\",\"method\":\"notify_status_update\",\"params\":[" +
+                                                 changes + "," + eventTime() + "]}"))) {
+          return;
+        }
+      }
+    }
+  }
+}
+
+// Body of a POST to /server/jsonrpc: one call, or an array of calls
+// answered by an array of replies in the same order
+std::string MoonrakerSim::jsonRpc(const std::string& body) {
+  SimSelection subscription;
+  SimSnapshot sent;
+  SimValue request;
+  std::string reply;
+  if (!parseJson(body, request)) {
+    return "{\"jsonrpc\":\"2.0\",\"error\":{\"code\":-32700,\"message\":\"Parse error\"},\"id\":null}";
+  }
+  if (request.type != SimValue::ARRAY) {
+    return call(request, reply, subscription, sent) ? reply : "";
+  }
+
+  std::string replies = "[";
+  for (const SimValue& item : request.items) {
+    if (call(item, reply, subscription, sent)) {
+      replies += (replies.size() > 1 ? "," : "") + reply;
+    }
+  }
+  return replies + "]";
+}
+
+// Answer one JSON-RPC call; false if it needs no reply
+bool MoonrakerSim::call(const std::string& text, std::string& reply, SimSelection& subscription, SimSnapshot& sent) {
+  SimValue request;
+  if (!parseJson(text, request)) {
+    reply = "{\"jsonrpc\":\"2.0\",\"error\":{\"code\":-32700,\"message\":\"Parse error\"},\"id\":null}";
+    return true;
+  }
+  return call(request, reply, subscription, sent);
+}
+
+bool MoonrakerSim::call(const SimValue& request, std::string& reply, SimSelection& subscription, SimSnapshot& sent) {
+  const SimValue* idValue = request.get("id");
+  if (idValue == nullptr) {
+    return false;
+  }
+  std::string id = idValue->type == SimValue::STRING ? jsonString(idValue->text) : idValue->text;
+  const SimValue* methodValue = request.get("method");
+  std::string method = methodValue != nullptr ? methodValue->text : "";
+  const SimValue* params = request.get("params");
+  const SimValue* objects = params != nullptr ? params->get("objects") : nullptr;
+
+  std::string result;
+  if (method == "printer.objects.subscribe" || method == "printer.objects.query") {
+    SimSelection selection = selectionFrom(objects);
+    std::string status;
+    if (method == "printer.objects.subscribe") {
+      subscription = selection;
+      sent.clear();
+      status = this->status(selection, &sent);
+    } else {
+      status = this->status(selection, nullptr);
+    }
+    result = "{\"eventtime\":" + eventTime() + ",\"status\":" + status + "}";
+  } else if (method == "printer.gcode.script") {
+    const SimValue* script = params != nullptr ? params->get("script") : nullptr;
+    std::string message;
+    std::lock_guard<std::mutex> lock(_printerLock);
+    _printer->advance();
+    if (!_printer->gcode(script != nullptr ? script->text : "", message)) {
+      reply = "{\"jsonrpc\":\"2.0\",\"error\":{\"code\":400,\"message\":" + jsonString(message) + "},\"id\":" + id + "}";
+      return true;
+    }
+    result = "\"ok\"";
+  } else if (method == "printer.info" || method == "server.info" || method == "server.job_queue.status" ||
+             method == "server.history.list") {
+    // The HTTP routes, /server/info for server.info and so on
+    std::string path = "/" + method;
+    std::replace(path.begin(), path.end(), '.', '/');
+    int status = route("GET", path, "", result);
+    (void)status;
+  } else if (method == "server.connection.identify") {
+    result = "{\"connection_id\":" + std::to_string(connections.load()) + "}";
+  } else {
+    reply = "{\"jsonrpc\":\"2.0\",\"error\":{\"code\":-32601,\"message\":\"Method not found\"},\"id\":" + id + "}";
+    return true;
+  }
+
+  reply = "{\"jsonrpc\":\"2.0\",\"result\":" + result + ",\"id\":" + id + "}";
+  return true;
+}
+
+// Write everything, in fragments if configured
+bool MoonrakerSim::sendAll(int fd, const std::string& data) {
+  size_t step = _options.fragment > 0 ? _options.fragment : data.size();
+  for (size_t offset = 0; offset < data.size(); offset += step) {
+    if (offset > 0 && _options.fragmentDelayUs > 0) {
+      usleep(_options.fragmentDelayUs);
+    }
+    size_t length = std::min(step, data.size() - offset);
+    size_t written = 0;
+    while (written < length) {
+      ssize_t n = send(fd, data.data() + offset + written, length - written, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      written += (size_t)n;
+    }
+  }
+  return true;
+}
+
+void MoonrakerSim::delayResponse() {
+  unsigned delay = _options.latencyMs;
+  if (_options.jitterMs > 0) {
+    delay += (unsigned)(roll() * (_options.jitterMs + 1));
+  }
+  if (delay > 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+  }
+}
+
+// Uniform in [0, 1), independent per connection thread
+double MoonrakerSim::roll() {
+  static thread_local std::mt19937 random((uint32_t)std::hash<std::thread::id>()(std::this_thread::get_id()));
+  return std::uniform_real_distribution<double>(0.0, 1.0)(random);
+}
+
+bool MoonrakerSim::parseOption(int argc, char** argv, int& i, MoonrakerSimOptions& options) {
+  const char* name = argv[i];
+  if (strcmp(name, "--no-keep-alive") == 0) {
+    options.keepAlive = false;
+    return true;
+  }
+  if (i + 1 >= argc) {
+    return false;
+  }
+  const char* value = argv[i + 1];
+
+  if (strcmp(name, "--latency") == 0) options.latencyMs = (unsigned)atoi(value);
+  else if (strcmp(name, "--jitter") == 0) options.jitterMs = (unsigned)atoi(value);
+  else if (strcmp(name, "--fragment") == 0) options.fragment = (size_t)atol(value);
+  else if (strcmp(name, "--fragment-delay") == 0) options.fragmentDelayUs = (unsigned)atoi(value);
+  else if (strcmp(name, "--chunked") == 0) options.chunkSize = (size_t)atol(value);
+  else if (strcmp(name, "--pad") == 0) options.padding = (size_t)atol(value);
+  else if (strcmp(name, "--error-rate") == 0) options.errorRate = atof(value);
+  else if (strcmp(name, "--drop-rate") == 0) options.dropRate = atof(value);
+  else if (strcmp(name, "--ws-interval") == 0) options.wsIntervalMs = (unsigned)atoi(value);
+  else return false;
+
+  i++;
+  return true;
+}
+
+void MoonrakerSim::printUsage(FILE* out) {
+  fprintf(out,
+          "simulator options:\n"
+          "  --latency MS         delay before every response\n"
+          "  --jitter MS          random extra delay, up to MS\n"
+          "  --fragment BYTES     write responses in pieces of BYTES\n"
+          "  --fragment-delay US  pause between pieces\n"
+          "  --chunked BYTES      chunked transfer encoding with BYTES per chunk\n"
+          "  --pad BYTES          filler added to every result\n"
+          "  --error-rate P       answer a share P of requests with 503\n"
+          "  --drop-rate P        close the connection on a share P of requests\n"
+          "  --ws-interval MS     status push interval, default 250\n"
+          "  --no-keep-alive      close the connection after every response\n");
+}
+
+void MoonrakerSim::printOptions(FILE* out, const MoonrakerSimOptions& options) {
+  fprintf(out, "latency %u+%u ms, fragment %zu B / %u us, %s, padding %zu B, errors %.1f%%, drops %.1f%%, keep-alive %s\n",
+          options.latencyMs, options.jitterMs, options.fragment, options.fragmentDelayUs,
+          options.chunkSize > 0 ? ("chunked " + std::to_string(options.chunkSize) + " B").c_str() : "content-length",
+          options.padding, options.errorRate * 100, options.dropRate * 100, options.keepAlive ? "on" : "off");
+}
@@ -0,0 +1,125 @@
+/*
+  MoonrakerSim.h - Local Moonraker stand-in for host builds
+
+  An HTTP/1.1 and websocket server for Linux that answers the endpoints
+  KlipperAPI uses from one simulated printer, whose heaters, toolhead and
+  print job move on with time:
+
+    GET  /printer/info, /server/info, /printer/objects/list,
+         /server/job_queue/status, /server/history/list
+    GET  /printer/objects/query?extruder=temperature,target&...
+    POST /printer/objects/query          {"objects":{"extruder":["temperature"]}}
+    POST /printer/gcode/script           M104, M140, M106, G28, G0/G1, ...
+    POST /printer/print/start|pause|resume|cancel, /printer/emergency_stop,
+         /printer/restart, /printer/firmware_restart, /server/files/upload
+    POST /server/jsonrpc                 One JSON-RPC call or a batch of them
+    GET  /websocket                      printer.objects.subscribe and
+                                         notify_status_update pushes
+
+  Network conditions are set through MoonrakerSimOptions: response latency
+  and jitter, responses written in small fragments, chunked transfer
+  encoding, padded payloads, and injected 503 errors or dropped
+  connections. The simulator reads and writes JSON by itself rather than
+  with ArduinoJson, so a parser bug in the library cannot be masked by the
+  same bug on the server side.
+
+    MoonrakerSim sim(options);
+    sim.start();                      // Free port on 127.0.0.1
+    api.init(client, IPAddress(127, 0, 0, 1), sim.port());
+*/
+
+#ifndef KAPI_HOST_MOONRAKER_SIM_H
+#define KAPI_HOST_MOONRAKER_SIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef struct {
+  unsigned latencyMs = 0;          // Added before every response
+  unsigned jitterMs = 0;           // Uniformly random extra latency, up to this
+  size_t fragment = 0;             // Bytes per write, 0 writes responses whole
+  unsigned fragmentDelayUs = 0;    // Pause between fragments
+  size_t chunkSize = 0;            // Chunked encoding with this chunk size, 0 for Content-Length
+  size_t padding = 0;              // Bytes of filler added to every HTTP result
+  double errorRate = 0;            // Share of requests answered 503
+  double dropRate = 0;             // Share of requests whose connection is closed unanswered
+  unsigned wsIntervalMs = 250;     // Status push interval for subscriptions
+  bool keepAlive = true;           // Honour keep-alive; false closes after each response
+} MoonrakerSimOptions;
+
+// Printer objects with the attributes asked for, none meaning all of them
+typedef std::vector<std::pair<std::string, std::vector<std::string> > > SimSelection;
+// Last value sent per "object attribute", to push only changes
+typedef std::map<std::string, std::string> SimSnapshot;
+
+class SimPrinter;
+struct SimValue;
+
+class MoonrakerSim {
+public:
+  explicit MoonrakerSim(const MoonrakerSimOptions& options = MoonrakerSimOptions());
+  ~MoonrakerSim();
+
+  // Listen on 127.0.0.1, or on every interface if any is set so real
+  // boards can reach it. Port 0 picks a free one.
+  bool start(uint16_t port = 0, bool any = false);
+  void stop();
+  uint16_t port() const { return _port; }
+  const MoonrakerSimOptions& options() const { return _options; }
+
+  // Parse the simulator option at argv[i], moving i past its value.
+  // Returns false if argv[i] is not a simulator option.
+  static bool parseOption(int argc, char** argv, int& i, MoonrakerSimOptions& options);
+  static void printUsage(FILE* out);
+  static void printOptions(FILE* out, const MoonrakerSimOptions& options);
+
+  std::atomic<uint64_t> connections{0};
+  std::atomic<uint64_t> requests{0};       // HTTP requests and websocket calls
+  std::atomic<uint64_t> errorsInjected{0};
+  std::atomic<uint64_t> drops{0};
+  std::atomic<uint64_t> pushes{0};         // notify_status_update messages sent
+
+private:
+  MoonrakerSim(const MoonrakerSim&);
+  MoonrakerSim& operator=(const MoonrakerSim&);
+
+  void acceptLoop();
+  void serve(int fd);
+  int route(const std::string& method, const std::string& target, const std::string& body,
+            std::string& result);
+  void serveWebsocket(int fd, const std::string& key, std::string& input);
+  bool call(const std::string& text, std::string& reply, SimSelection& subscription, SimSnapshot& sent);
+  bool call(const SimValue& request, std::string& reply, SimSelection& subscription, SimSnapshot& sent);
+  std::string jsonRpc(const std::string& body);
+  std::string status(const SimSelection& selection, SimSnapshot* sent);
+  std::string eventTime();
+  bool sendAll(int fd, const std::string& data);
+  void delayResponse();
+  double roll();
+
+  MoonrakerSimOptions _options;
+  SimPrinter* _printer;
+  std::mutex _printerLock;
+
+  int _listenFd = -1;
+  uint16_t _port = 0;
+  std::atomic<bool> _running{false};
+  std::thread _acceptThread;
+
+  // Open connections, each served by a detached thread
+  std::mutex _connectionLock;
+  std::condition_variable _connectionsDone;
+  std::set<int> _connectionFds;
+  int _active = 0;
+};
+
+#endif
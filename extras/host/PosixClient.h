@@ -0,0 +1,162 @@
+/*
+  PosixClient.h - Arduino Client over a real TCP socket for host builds
+
+  Lets host builds of KlipperAPI talk to a live server, such as
+  MoonrakerSim or a real Moonraker. Behaves like the ESP32 WiFiClient:
+  connect() and write() block, available() and read() never do, and
+  connected() stays true while received bytes are unread.
+*/
+
+#ifndef KAPI_HOST_POSIX_CLIENT_H
+#define KAPI_HOST_POSIX_CLIENT_H
+
+#include "Client.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define POSIX_CLIENT_BUFFER_SIZE   1460   // One TCP segment
+#define POSIX_CLIENT_CONNECT_TIMEOUT 3000 // ms
+
+class PosixClient : public Client {
+public:
+  PosixClient() {}
+  ~PosixClient() { stop(); }
+
+  int connect(IPAddress ip, uint16_t port) override {
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    uint32_t value = ip;
+    memcpy(&address.sin_addr, &value, 4);
+    return open((const sockaddr*)&address, sizeof(address));
+  }
+
+  int connect(const char* host, uint16_t port) override {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found = nullptr;
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    if (getaddrinfo(host, service, &hints, &found) != 0 || found == nullptr) {
+      return 0;
+    }
+    int ok = open(found->ai_addr, found->ai_addrlen);
+    freeaddrinfo(found);
+    return ok;
+  }
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buf, size_t size) override {
+    size_t sent = 0;
+    while (_fd >= 0 && sent < size) {
+      ssize_t n = send(_fd, buf + sent, size - sent, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) {
+        _peerClosed = true;
+        break;
+      }
+      sent += (size_t)n;
+    }
+    bytesSent += sent;
+    return sent;
+  }
+  using Print::write;
+
+  int available() override {
+    fill();
+    return (int)(_length - _position);
+  }
+  int read() override {
+    if (available() == 0) return -1;
+    bytesReceived++;
+    return _buffer[_position++];
+  }
+  int read(uint8_t* buf, size_t size) override {
+    size_t count = (size_t)available();
+    if (count == 0) return -1;
+    if (count > size) count = size;
+    memcpy(buf, _buffer + _position, count);
+    _position += count;
+    bytesReceived += count;
+    return (int)count;
+  }
+  int peek() override { return available() > 0 ? _buffer[_position] : -1; }
+  void flush() override {}
+
+  void stop() override {
+    if (_fd >= 0) {
+      close(_fd);
+      _fd = -1;
+    }
+    _position = _length = 0;
+    _peerClosed = false;
+  }
+
+  uint8_t connected() override {
+    fill();
+    return _position < _length || (_fd >= 0 && !_peerClosed);
+  }
+  operator bool() override { return connected(); }
+
+  uint32_t connects = 0;
+  uint64_t bytesSent = 0;
+  uint64_t bytesReceived = 0;
+
+private:
+  // Connect with a timeout, then switch back to blocking writes
+  int open(const sockaddr* address, socklen_t length) {
+    stop();
+    _fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (_fd < 0) return 0;
+    int one = 1;
+    setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    int flags = fcntl(_fd, F_GETFL, 0);
+    fcntl(_fd, F_SETFL, flags | O_NONBLOCK);
+    int result = ::connect(_fd, address, length);
+    if (result < 0 && errno == EINPROGRESS) {
+      pollfd waiting = { _fd, POLLOUT, 0 };
+      int error = 0;
+      socklen_t errorLength = sizeof(error);
+      if (poll(&waiting, 1, POSIX_CLIENT_CONNECT_TIMEOUT) == 1 &&
+          getsockopt(_fd, SOL_SOCKET, SO_ERROR, &error, &errorLength) == 0 && error == 0) {
+        result = 0;
+      }
+    }
+    if (result < 0) {
+      stop();
+      return 0;
+    }
+    fcntl(_fd, F_SETFL, flags);
+    connects++;
+    return 1;
+  }
+
+  // Pull what the socket has into the buffer once it is used up
+  void fill() {
+    if (_position < _length || _fd < 0 || _peerClosed) return;
+    _position = _length = 0;
+    ssize_t n = recv(_fd, _buffer, sizeof(_buffer), MSG_DONTWAIT);
+    if (n > 0) {
+      _length = (size_t)n;
+    } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+      _peerClosed = true;
+    }
+  }
+
+  int _fd = -1;
+  bool _peerClosed = false;
+  uint8_t _buffer[POSIX_CLIENT_BUFFER_SIZE];
+  size_t _position = 0;
+  size_t _length = 0;
+};
+
+#endif
@@ -0,0 +1,191 @@
+/*
+  Arduino.cpp - Host implementation of the minimal Arduino core
+*/
+
+#include "Arduino.h"
+
+#include <chrono>
+#include <thread>
+#include <random>
+#include <stdarg.h>
+
+HardwareSerial Serial;
+
+static const std::chrono::steady_clock::time_point bootTime = std::chrono::steady_clock::now();
+
+unsigned long millis() {
+  return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now() - bootTime).count();
+}
+
+unsigned long micros() {
+  return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - bootTime).count();
+}
+
+void delay(unsigned long ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+void delayMicroseconds(unsigned int us) { std::this_thread::sleep_for(std::chrono::microseconds(us)); }
+void yield() { std::this_thread::yield(); }
+
+static std::mt19937 &rng() {
+  static thread_local std::mt19937 gen(12345);
+  return gen;
+}
+
+void randomSeed(unsigned long seed) { rng().seed((uint32_t)seed); }
+long random(long max) { return max <= 0 ? 0 : (long)(rng()() % (unsigned long)max); }
+long random(long min, long max) { return max <= min ? min : min + random(max - min); }
+
+// String
+
+static std::string formatInt(unsigned long v, unsigned char base, bool negative) {
+  if (base < 2 || base > 36) base = 10;
+  char buf[72];
+  int i = sizeof(buf) - 1;
+  buf[i] = 0;
+  do {
+    int d = (int)(v % base);
+    buf[--i] = (char)(d < 10 ? '0' + d : 'a' + d - 10);
+    v /= base;
+  } while (v && i > 1);
+  if (negative) buf[--i] = '-';
+  return std::string(&buf[i]);
+}
+
+String::String(int v, unsigned char base) : String((long)v, base) {}
+String::String(unsigned int v, unsigned char base) : String((unsigned long)v, base) {}
+String::String(long v, unsigned char base) {
+  if (base == 10 && v < 0) _s = formatInt((unsigned long)(-v), base, true);
+  else _s = formatInt((unsigned long)v, base, false);
+}
+String::String(unsigned long v, unsigned char base) : _s(formatInt(v, base, false)) {}
+String::String(float v, unsigned char decimals) : String((double)v, decimals) {}
+String::String(double v, unsigned char decimals) {
+  char buf[48];
+  snprintf(buf, sizeof(buf), "%.*f", (int)decimals, v);
+  _s = buf;
+}
+
+bool String::equalsIgnoreCase(const String& o) const {
+  return _s.size() == o._s.size() && strncasecmp(_s.c_str(), o._s.c_str(), _s.size()) == 0;
+}
+
+bool String::endsWith(const String& o) const {
+  return _s.size() >= o._s.size() && _s.compare(_s.size() - o._s.size(), o._s.size(), o._s) == 0;
+}
+
+int String::indexOf(char c, unsigned int from) const {
+  size_t p = _s.find(c, from);
+  return p == std::string::npos ? -1 : (int)p;
+}
+
+int String::indexOf(const String& s, unsigned int from) const {
+  size_t p = _s.find(s._s, from);
+  return p == std::string::npos ? -1 : (int)p;
+}
+
+String String::substring(unsigned int from) const {
+  return from >= _s.size() ? String() : String(_s.substr(from));
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+  if (from > to) { unsigned int t = from; from = to; to = t; }
+  if (from >= _s.size()) return String();
+  return String(_s.substr(from, to - from));
+}
+
+void String::toLowerCase() { for (auto& c : _s) c = (char)tolower((unsigned char)c); }
+void String::toUpperCase() { for (auto& c : _s) c = (char)toupper((unsigned char)c); }
+
+void String::trim() {
+  size_t b = 0, e = _s.size();
+  while (b < e && isspace((unsigned char)_s[b])) b++;
+  while (e > b && isspace((unsigned char)_s[e - 1])) e--;
+  _s = _s.substr(b, e - b);
+}
+
+void String::toCharArray(char* buf, unsigned int size, unsigned int index) const {
+  if (!buf || size == 0) return;
+  if (index >= _s.size()) { buf[0] = 0; return; }
+  size_t n = _s.size() - index;
+  if (n > size - 1) n = size - 1;
+  memcpy(buf, _s.data() + index, n);
+  buf[n] = 0;
+}
+
+// Print and Stream
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+  size_t n = 0;
+  while (size--) {
+    if (write(*buffer++)) n++;
+    else break;
+  }
+  return n;
+}
+
+size_t Print::print(long v, int base) { return print(String(v, (unsigned char)base)); }
+size_t Print::print(unsigned long v, int base) { return print(String(v, (unsigned char)base)); }
+size_t Print::print(double v, int digits) { return print(String(v, (unsigned char)digits)); }
+
+size_t Print::printf(const char* fmt, ...) {
+  char buf[256];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (n < 0) return 0;
+  return write(buf, (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
+}
+
+int Stream::timedRead() {
+  unsigned long start = millis();
+  do {
+    int c = read();
+    if (c >= 0) return c;
+    yield();
+  } while (millis() - start < _timeout);
+  return -1;
+}
+
+size_t Stream::readBytes(char* buffer, size_t length) {
+  size_t count = 0;
+  while (count < length) {
+    int c = timedRead();
+    if (c < 0) break;
+    *buffer++ = (char)c;
+    count++;
+  }
+  return count;
+}
+
+String Stream::readString() {
+  String ret;
+  int c;
+  while ((c = timedRead()) >= 0) ret += (char)c;
+  return ret;
+}
+
+String Stream::readStringUntil(char terminator) {
+  String ret;
+  int c;
+  while ((c = timedRead()) >= 0 && c != terminator) ret += (char)c;
+  return ret;
+}
+
+// IPAddress
+
+String IPAddress::toString() const {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%u.%u.%u.%u", _addr[0], _addr[1], _addr[2], _addr[3]);
+  return String(buf);
+}
+
+bool IPAddress::fromString(const char* s) {
+  unsigned a, b, c, d;
+  char tail;
+  if (!s || sscanf(s, "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) != 4) return false;
+  if (a > 255 || b > 255 || c > 255 || d > 255) return false;
+  _addr[0] = (uint8_t)a; _addr[1] = (uint8_t)b; _addr[2] = (uint8_t)c; _addr[3] = (uint8_t)d;
+  return true;
+}
@@ -0,0 +1,183 @@
+/*
+  Arduino.h - Minimal Arduino core for host (Linux/g++) builds of KlipperAPI
+
+  Just enough of millis(), String, Print, Stream, IPAddress and Serial for
+  the library and ArduinoJson to compile and run unchanged on a PC.
+*/
+
+#ifndef KAPI_HOST_ARDUINO_H
+#define KAPI_HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+#include <string>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (s)
+#define strcpy_P strcpy
+#define strlen_P strlen
+#define memcpy_P memcpy
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+
+// Counted by extras/host/HostHeap.cpp, used like ESP.getFreeHeap()
+uint32_t hostHeapFree();
+#define KAPI_HEAP_FREE() hostHeapFree()
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+class String {
+public:
+  String() {}
+  String(const char* s) : _s(s ? s : "") {}
+  String(const std::string& s) : _s(s) {}
+  String(char c) : _s(1, c) {}
+  String(int v, unsigned char base = 10);
+  String(unsigned int v, unsigned char base = 10);
+  String(long v, unsigned char base = 10);
+  String(unsigned long v, unsigned char base = 10);
+  String(float v, unsigned char decimals = 2);
+  String(double v, unsigned char decimals = 2);
+
+  const char* c_str() const { return _s.c_str(); }
+  unsigned int length() const { return (unsigned int)_s.size(); }
+  bool reserve(unsigned int size) { _s.reserve(size); return true; }
+  char charAt(unsigned int i) const { return i < _s.size() ? _s[i] : 0; }
+  char operator[](unsigned int i) const { return charAt(i); }
+  char& operator[](unsigned int i) { return _s[i]; }
+
+  String& operator+=(const String& o) { _s += o._s; return *this; }
+  String& operator+=(const char* o) { if (o) _s += o; return *this; }
+  String& operator+=(char c) { _s += c; return *this; }
+  String& operator+=(int v) { return *this += String(v); }
+  String& operator+=(unsigned int v) { return *this += String(v); }
+  String& operator+=(long v) { return *this += String(v); }
+  String& operator+=(unsigned long v) { return *this += String(v); }
+  bool concat(const String& o) { _s += o._s; return true; }
+  bool concat(const char* o) { if (o) _s += o; return true; }
+  bool concat(const char* o, unsigned int n) { if (o) _s.append(o, n); return true; }
+  bool concat(char c) { _s += c; return true; }
+
+  bool operator==(const String& o) const { return _s == o._s; }
+  bool operator==(const char* o) const { return o && _s == o; }
+  bool operator!=(const String& o) const { return _s != o._s; }
+  bool operator!=(const char* o) const { return !(*this == o); }
+  bool equals(const String& o) const { return _s == o._s; }
+  bool equalsIgnoreCase(const String& o) const;
+  bool startsWith(const String& o) const { return _s.compare(0, o._s.size(), o._s) == 0; }
+  bool endsWith(const String& o) const;
+
+  int indexOf(char c, unsigned int from = 0) const;
+  int indexOf(const String& s, unsigned int from = 0) const;
+  String substring(unsigned int from) const;
+  String substring(unsigned int from, unsigned int to) const;
+  void toLowerCase();
+  void toUpperCase();
+  void trim();
+  long toInt() const { return atol(_s.c_str()); }
+  float toFloat() const { return (float)atof(_s.c_str()); }
+  void toCharArray(char* buf, unsigned int size, unsigned int index = 0) const;
+  void getBytes(unsigned char* buf, unsigned int size, unsigned int index = 0) const {
+    toCharArray((char*)buf, size, index);
+  }
+  void remove(unsigned int index) { if (index < _s.size()) _s.erase(index); }
+  void remove(unsigned int index, unsigned int count) { if (index < _s.size()) _s.erase(index, count); }
+
+  friend String operator+(const String& a, const String& b) { return String(a._s + b._s); }
+  friend String operator+(const String& a, const char* b) { return String(a._s + (b ? b : "")); }
+  friend String operator+(const char* a, const String& b) { return String(std::string(a ? a : "") + b._s); }
+  friend String operator+(const String& a, char b) { return String(a._s + b); }
+
+private:
+  std::string _s;
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  size_t write(const char* str) { return str ? write((const uint8_t*)str, strlen(str)) : 0; }
+  size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+  virtual void flush() {}
+
+  size_t print(const char* s) { return write(s); }
+  size_t print(const String& s) { return write(s.c_str(), s.length()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int v, int base = 10) { return print((long)v, base); }
+  size_t print(unsigned int v, int base = 10) { return print((unsigned long)v, base); }
+  size_t print(long v, int base = 10);
+  size_t print(unsigned long v, int base = 10);
+  size_t print(double v, int digits = 2);
+  size_t println() { return write("\r\n"); }
+  template <typename T> size_t println(const T& v) { size_t n = print(v); return n + println(); }
+  template <typename T> size_t println(const T& v, int arg) { size_t n = print(v, arg); return n + println(); }
+  size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  void setTimeout(unsigned long timeout) { _timeout = timeout; }
+  unsigned long getTimeout() const { return _timeout; }
+  size_t readBytes(char* buffer, size_t length);
+  size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+  String readString();
+  String readStringUntil(char terminator);
+
+protected:
+  int timedRead();
+  unsigned long _timeout = 1000;
+};
+
+class IPAddress {
+public:
+  IPAddress() { _addr[0] = _addr[1] = _addr[2] = _addr[3] = 0; }
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) { _addr[0] = a; _addr[1] = b; _addr[2] = c; _addr[3] = d; }
+  IPAddress(uint32_t v) { memcpy(_addr, &v, 4); }
+  operator uint32_t() const { uint32_t v; memcpy(&v, _addr, 4); return v; }
+  uint8_t operator[](int i) const { return _addr[i]; }
+  uint8_t& operator[](int i) { return _addr[i]; }
+  bool operator==(const IPAddress& o) const { return memcmp(_addr, o._addr, 4) == 0; }
+  bool operator!=(const IPAddress& o) const { return !(*this == o); }
+  String toString() const;
+  bool fromString(const char* s);
+
+private:
+  uint8_t _addr[4];
+};
+
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long) {}
+  size_t write(uint8_t c) override { return fwrite(&c, 1, 1, stdout); }
+  size_t write(const uint8_t* b, size_t n) override { return fwrite(b, 1, n, stdout); }
+  using Print::write;
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif
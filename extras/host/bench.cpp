@@ -0,0 +1,434 @@
+/*
+  bench.cpp - Host micro benchmarks for KlipperAPI
+
+  Runs every public request method against MockClient replaying recorded
+  Moonraker responses and reports per call latency, heap allocations,
+  peak heap and bytes sent/received.
+
+    bench [-n iterations] [-k] [--csv] [--metrics] [filter]
+
+  -k turns on keep-alive, filter runs only cases whose name contains it.
+  --metrics prints api.metrics afterwards (build with KAPI_ENABLE_METRICS=1).
+*/
+
+#include <KlipperAPI.h>
+#include <KlipperCodec.h>
+#include <KlipperHistory.h>
+#include "HostHeap.h"
+#include "MockClient.h"
+#include "MoonrakerFixtures.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+static MockClient client;
+static KlipperApi api;
+
+#if KAPI_ENABLE_SUBSCRIPTION
+static MockClient wsClient;
+static std::string statusFrame;
+#endif
+
+static KlipperHistory<60, 48, 10> history;
+
+#if KAPI_ENABLE_CODEC
+static KlipperEncoder encoder;
+static KlipperDecoder decoder;
+static KlipperApi display;             // Receives the frames, never connects
+static uint8_t frame[KAPI_CODEC_MAX_FRAME];
+static size_t frameLength = 0;
+static uint64_t fullBytes = 0;
+static uint64_t deltaBytes = 0;
+
+// What changes between two polls while printing
+static void advancePrint() {
+  PrinterStatistics& stats = api.printerStats;
+  stats.extruder.current = stats.extruder.current > 210 ? 209.6f : 210.3f;
+  stats.extruder.power = stats.extruder.power > 120 ? 96 : 140;
+  stats.positionX += 0.8f;
+  stats.positionY -= 0.4f;
+  stats.positionE += 0.05f;
+#if KAPI_ENABLE_PRINT_JOB
+  api.printJob.progress += 0.0002f;
+  api.printJob.printTime++;
+  api.printJob.printedBytes += 160;
+  api.printJob.timeLeft--;
+#endif
+}
+
+static bool encodeDelta() {
+  frameLength = encoder.encode(api, frame, sizeof(frame));
+  deltaBytes += frameLength;
+  return frameLength > 0;
+}
+#endif
+
+#if KAPI_ENABLE_UPLOAD
+// A G-code file in memory, read like a File on SD or LittleFS
+#define UPLOAD_FILE_SIZE 262144
+
+class MemoryFile : public Stream {
+public:
+  MemoryFile() {
+    for (size_t i = 0; i < UPLOAD_FILE_SIZE; i++) {
+      _data[i] = "G1 X10.5 Y20.25 E0.42\n"[i % 22];
+    }
+  }
+  void rewind() { _position = 0; }
+  int available() override { return (int)(UPLOAD_FILE_SIZE - _position); }
+  int read() override { return _position < UPLOAD_FILE_SIZE ? _data[_position++] : -1; }
+  int peek() override { return _position < UPLOAD_FILE_SIZE ? _data[_position] : -1; }
+  size_t write(uint8_t) override { return 0; }
+
+private:
+  char _data[UPLOAD_FILE_SIZE];
+  size_t _position = 0;
+};
+
+static MemoryFile uploadSource;
+#endif
+
+typedef struct {
+  const char* name;
+  void (*prepare)();   // Queue what one call needs, not measured
+  bool (*run)();
+} BenchCase;
+
+#if KAPI_ENABLE_ASYNC
+// Start a non-blocking request and poll it to completion
+static bool pollUntilDone(bool started) {
+  while (started && api.isBusy()) {
+    api.poll();
+  }
+  return started;
+}
+#endif
+
+static void replyOk() { client.queueJson(fixtureOk); }
+
+static const BenchCase benchCases[] = {
+  { "getPrinterInfo", [] { client.queueJson(fixturePrinterInfo); }, [] { return api.getPrinterInfo(); } },
+  { "getPrinterStatistics", [] { client.queueJson(fixturePrinterStatistics); }, [] { return api.getPrinterStatistics(); } },
+#if KAPI_ENABLE_SERVER_INFO
+  { "getServerInfo", [] { client.queueJson(fixtureServerInfo); }, [] { return api.getServerInfo(); } },
+#endif
+#if KAPI_ENABLE_PRINT_JOB
+  { "getPrintJob", [] { client.queueJson(fixturePrintJob); }, [] { return api.getPrintJob(); } },
+#endif
+#if KAPI_ENABLE_MOTION
+  { "getMotionLimits", [] { client.queueJson(fixtureMotionLimits); }, [] { return api.getMotionLimits(); } },
+  { "getMotionLimits (cached)", [] { api.setCacheTtl(KAPI_CACHE_TTL); client.queueJson(fixtureMotionLimits); api.getMotionLimits(); },
+    [] { bool ok = api.getMotionLimits(); api.setCacheTtl(0); return ok; } },
+#endif
+  { "refresh", [] { client.queueJson(fixtureRefreshAll); }, [] { return api.refresh(); } },
+#if KAPI_ENABLE_BATCH
+  // The same data as the next case, in one round trip instead of three
+  { "refreshBatch", [] { client.queueJson(fixtureBatchRefresh); }, [] {
+      return api.refreshBatch(KAPI_BATCH_STATUS | KAPI_BATCH_PRINTER_INFO | KAPI_BATCH_SERVER_INFO) ==
+             (KAPI_BATCH_STATUS | KAPI_BATCH_PRINTER_INFO | (KAPI_ENABLE_SERVER_INFO ? KAPI_BATCH_SERVER_INFO : 0));
+    } },
+#if KAPI_ENABLE_SERVER_INFO
+  { "refresh + get{Printer,Server}Info", [] {
+      client.queueJson(fixtureRefreshAll);
+      client.queueJson(fixturePrinterInfo);
+      client.queueJson(fixtureServerInfo);
+    }, [] { return api.refresh() && api.getPrinterInfo() && api.getServerInfo(); } },
+#endif
+  { "refreshBatch (all calls)", [] { client.queueJson(fixtureBatch); }, [] { return api.refreshBatch() != 0; } },
+#endif
+#if KAPI_ENABLE_OBJECTS
+  { "discoverObjects", [] { client.queueJson(fixtureObjectList); }, [] { return api.discoverObjects(); } },
+  { "refreshObjects", [] {
+      if (api.objectCount() == 0) {
+        client.queueJson(fixtureObjectList);
+        api.discoverObjects();
+      }
+      client.queueJson(fixtureObjectQuery);
+    }, [] { return api.refreshObjects(); } },
+#endif
+#if KAPI_ENABLE_FILES
+  { "listRecentFiles", [] { client.queueJson(fixtureFileList); }, [] {
+      static KlipperFileInfo files[3];
+      return api.listRecentFiles(files, 3) == 3;
+    } },
+#endif
+#if KAPI_ENABLE_STRING_API
+  { "sendGetToMoonraker", [] { client.queueJson(fixtureServerInfo); }, [] { return api.sendGetToMoonraker("/server/info").length() > 0; } },
+  { "sendPostToMoonraker", replyOk, [] { return api.sendPostToMoonraker("/printer/print/pause", "{}").length() > 0; } },
+  { "getMoonrakerEndpointResults", [] { client.queueJson(fixturePrinterInfo); }, [] { return api.getMoonrakerEndpointResults("/printer/info").length() > 0; } },
+#endif
+#if KAPI_ENABLE_CONTROL
+  { "startPrint", replyOk, [] { return api.startPrint("benchy_0.2mm_PLA_MK4_1h4m.gcode"); } },
+  { "pausePrint", replyOk, [] { return api.pausePrint(); } },
+  { "resumePrint", replyOk, [] { return api.resumePrint(); } },
+  { "cancelPrint", replyOk, [] { return api.cancelPrint(); } },
+  { "setExtruderTemperature", replyOk, [] { return api.setExtruderTemperature(210); } },
+  { "setBedTemperature", replyOk, [] { return api.setBedTemperature(60); } },
+  { "setFanSpeed", replyOk, [] { return api.setFanSpeed(80); } },
+  { "homeAll", replyOk, [] { return api.homeAll(); } },
+  { "homeAxis", replyOk, [] { return api.homeAxis('z'); } },
+  { "moveRelative", replyOk, [] { return api.moveRelative(10, 0, 0, 0); } },
+  { "moveAbsolute", replyOk, [] { return api.moveAbsolute(100, 100, 10, 0); } },
+  { "sendGcode", replyOk, [] { return api.sendGcode("SET_HEATER_TEMPERATURE HEATER=extruder TARGET=210"); } },
+  { "sendGcodeMultiple", replyOk, [] {
+      static const char* gcodes[] = { "G91", "G1 X10 F3000", "G1 Y10 F3000", "G90" };
+      return api.sendGcodeMultiple(gcodes, 4);
+    } },
+  { "restartFirmware", replyOk, [] { return api.restartFirmware(); } },
+  { "restartHost", replyOk, [] { return api.restartHost(); } },
+#endif
+  { "emergencyStop", replyOk, [] { return api.emergencyStop(); } },
+#if KAPI_ENABLE_UPLOAD
+  { "uploadFile 256 KB", [] { uploadSource.rewind(); client.queueJson(fixtureUploadCreated, 201); },
+    [] { return api.uploadFile(uploadSource, "benchy_0.2mm_PLA_MK4_1h4m.gcode", UPLOAD_FILE_SIZE); } },
+#endif
+#if KAPI_ENABLE_GCODE_QUEUE
+  { "queueGcode x10 + flushGcode", replyOk, [] {
+      bool ok = true;
+      for (uint8_t i = 0; i < 10; i++) {
+        ok &= api.queueGcode("G1 X10.5 Y20.25 E0.42 F1800");
+      }
+      return api.flushGcode() && ok;
+    } },
+#endif
+#if KAPI_ENABLE_ASYNC
+  { "beginGetPrinterInfo + poll", [] { client.queueJson(fixturePrinterInfo); },
+    [] { return pollUntilDone(api.beginGetPrinterInfo()); } },
+  { "beginGetPrinterStatistics + poll", [] { client.queueJson(fixturePrinterStatistics); },
+    [] { return pollUntilDone(api.beginGetPrinterStatistics()); } },
+#if KAPI_ENABLE_SERVER_INFO
+  { "beginGetServerInfo + poll", [] { client.queueJson(fixtureServerInfo); },
+    [] { return pollUntilDone(api.beginGetServerInfo()); } },
+#endif
+#if KAPI_ENABLE_PRINT_JOB
+  { "beginGetPrintJob + poll", [] { client.queueJson(fixturePrintJob); },
+    [] { return pollUntilDone(api.beginGetPrintJob()); } },
+#endif
+  { "beginRefresh + poll", [] { client.queueJson(fixtureRefreshAll); },
+    [] { return pollUntilDone(api.beginRefresh()); } },
+#if KAPI_ENABLE_CONTROL
+  { "beginSendGcode + poll", replyOk, [] { return pollUntilDone(api.beginSendGcode("M106 S255")); } },
+#endif
+#if KAPI_ENABLE_UPLOAD
+  { "beginUploadFile + poll", [] { uploadSource.rewind(); client.queueJson(fixtureUploadCreated, 201); },
+    [] { return pollUntilDone(api.beginUploadFile(uploadSource, "benchy_0.2mm_PLA_MK4_1h4m.gcode", UPLOAD_FILE_SIZE)); } },
+#endif
+#endif
+#if KAPI_ENABLE_SUBSCRIPTION
+  { "handleSubscription", [] { wsClient.pushRaw(statusFrame.data(), statusFrame.size()); },
+    [] { uint32_t before = api.statusUpdateCount; api.handleSubscription(); return api.statusUpdateCount == before + 1; } },
+#endif
+  { "KlipperHistory::add", [] {}, [] { history.add(api); return true; } },
+#if KAPI_ENABLE_CODEC
+  { "KlipperEncoder::encodeFull", [] {}, [] {
+      frameLength = encoder.encodeFull(api, frame, sizeof(frame));
+      fullBytes += frameLength;
+      return frameLength > 0;
+    } },
+  { "KlipperEncoder::encode (delta)", advancePrint, encodeDelta },
+  { "KlipperDecoder::decode", [] {
+      advancePrint();
+      frameLength = decoder.synced() ? encoder.encode(api, frame, sizeof(frame))
+                                     : encoder.encodeFull(api, frame, sizeof(frame));
+    }, [] { return decoder.decode(frame, frameLength, display); } },
+#endif
+#if KAPI_ENABLE_HEALTH
+  // Last, as it leaves the breaker open; the call is expected to fail fast
+  { "getPrinterInfo (breaker open)", [] {
+      api.health.reset();
+      client.failNextConnects(KAPI_BREAKER_THRESHOLD);
+      for (uint8_t i = 0; i < KAPI_BREAKER_THRESHOLD; i++) {
+        api.getPrinterInfo();
+      }
+    }, [] { return !api.getPrinterInfo(); } },
+#endif
+};
+
+typedef struct {
+  double meanUs;
+  double p99Us;
+  double maxUs;
+  double allocations;
+  double heapBytes;
+  size_t peakHeap;
+  double sent;
+  double received;
+  uint32_t failures;
+} BenchResult;
+
+static uint64_t nowNs() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Received over HTTP and the websocket
+static uint64_t bytesReceived() {
+#if KAPI_ENABLE_SUBSCRIPTION
+  return client.bytesReceived + wsClient.bytesReceived;
+#else
+  return client.bytesReceived;
+#endif
+}
+
+static BenchResult runCase(const BenchCase& bench, uint32_t iterations, std::vector<uint64_t>& times) {
+  BenchResult result = {};
+  uint64_t allocations = 0;
+  uint64_t heapBytes = 0;
+  uint64_t sent = 0;
+  uint64_t received = 0;
+
+  // One unmeasured call sizes the mock's buffers
+  bench.prepare();
+  bench.run();
+
+  times.clear();
+  for (uint32_t i = 0; i < iterations; i++) {
+    bench.prepare();
+    uint64_t sentBefore = client.bytesSent;
+    uint64_t receivedBefore = bytesReceived();
+    hostHeapResetPeak();
+    HostHeapStats before = hostHeapStats();
+
+    uint64_t start = nowNs();
+    bool ok = bench.run();
+    uint64_t elapsed = nowNs() - start;
+
+    HostHeapStats after = hostHeapStats();
+    times.push_back(elapsed);
+    allocations += after.allocations - before.allocations;
+    heapBytes += after.bytes - before.bytes;
+    result.peakHeap = std::max(result.peakHeap, after.peak - before.current);
+    sent += client.bytesSent - sentBefore;
+    received += bytesReceived() - receivedBefore;
+    if (!ok) {
+      result.failures++;
+    }
+  }
+
+  std::sort(times.begin(), times.end());
+  uint64_t total = 0;
+  for (uint64_t t : times) {
+    total += t;
+  }
+  result.meanUs = total / 1000.0 / iterations;
+  result.p99Us = times[(size_t)(iterations * 0.99) < iterations ? (size_t)(iterations * 0.99) : iterations - 1] / 1000.0;
+  result.maxUs = times.back() / 1000.0;
+  result.allocations = (double)allocations / iterations;
+  result.heapBytes = (double)heapBytes / iterations;
+  result.sent = (double)sent / iterations;
+  result.received = (double)received / iterations;
+  return result;
+}
+
+#if KAPI_ENABLE_SUBSCRIPTION
+// Server to client text frame, servers do not mask
+static std::string serverFrame(const char* payload) {
+  size_t length = strlen(payload);
+  std::string frame(1, (char)0x81);
+  if (length < 126) {
+    frame += (char)length;
+  } else {
+    frame += (char)126;
+    frame += (char)(length >> 8);
+    frame += (char)(length & 0xFF);
+  }
+  return frame + payload;
+}
+#endif
+
+int main(int argc, char** argv) {
+  uint32_t iterations = 1000;
+  bool keepAlive = false;
+  bool csv = false;
+  bool printMetrics = false;
+  const char* filter = nullptr;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      iterations = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-k") == 0) {
+      keepAlive = true;
+    } else if (strcmp(argv[i], "--csv") == 0) {
+      csv = true;
+    } else if (strcmp(argv[i], "--metrics") == 0) {
+      printMetrics = true;
+    } else if (argv[i][0] != '-') {
+      filter = argv[i];
+    } else {
+      fprintf(stderr, "usage: %s [-n iterations] [-k] [--csv] [--metrics] [filter]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (iterations == 0) {
+    iterations = 1;
+  }
+
+  api.init(client, IPAddress(192, 168, 1, 100), 7125, "0123456789abcdef0123456789abcdef");
+  api.setKeepAlive(keepAlive);
+  // Cases measure round trips; the cached case turns the cache on for itself
+  api.setCacheTtl(0);
+#if KAPI_ENABLE_CODEC
+  // Full frames have their own case
+  encoder.setKeyframeInterval(0);
+#endif
+
+#if KAPI_ENABLE_SUBSCRIPTION
+  statusFrame = serverFrame(fixtureStatusUpdate);
+  wsClient.queueReply("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n\r\n");
+  if (!api.subscribeStatus(wsClient)) {
+    fprintf(stderr, "websocket subscription failed\n");
+    return 1;
+  }
+#endif
+
+  std::vector<uint64_t> times;
+  times.reserve(iterations);
+
+  if (csv) {
+    printf("method,mean_us,p99_us,max_us,allocs_per_call,heap_bytes_per_call,peak_heap,tx_bytes,rx_bytes,failures\n");
+  } else {
+    printf("KlipperAPI host benchmark: %u iterations, keep-alive %s\n\n", iterations, keepAlive ? "on" : "off");
+    printf("%-34s %9s %9s %9s %8s %10s %9s %7s %7s %5s\n",
+           "method", "mean us", "p99 us", "max us", "allocs", "heap B", "peak B", "tx B", "rx B", "fail");
+  }
+
+  int failed = 0;
+  for (size_t i = 0; i < sizeof(benchCases) / sizeof(benchCases[0]); i++) {
+    const BenchCase& bench = benchCases[i];
+    if (filter != nullptr && strstr(bench.name, filter) == nullptr) {
+      continue;
+    }
+
+    BenchResult r = runCase(bench, iterations, times);
+    if (r.failures > 0) {
+      failed++;
+    }
+    if (csv) {
+      printf("%s,%.3f,%.3f,%.3f,%.2f,%.1f,%zu,%.1f,%.1f,%u\n", bench.name, r.meanUs, r.p99Us, r.maxUs,
+             r.allocations, r.heapBytes, r.peakHeap, r.sent, r.received, r.failures);
+    } else {
+      printf("%-34s %9.2f %9.2f %9.2f %8.2f %10.1f %9zu %7.0f %7.0f %5u\n", bench.name, r.meanUs, r.p99Us,
+             r.maxUs, r.allocations, r.heapBytes, r.peakHeap, r.sent, r.received, r.failures);
+    }
+  }
+
+  if (!csv) {
+    printf("\nrequests %u, requests that allocated while being written %u\n", api.requestCount, api.requestHeapAllocs);
+#if KAPI_ENABLE_CODEC
+    if (encoder.fullCount > 0 && encoder.deltaCount > 0) {
+      printf("frames: full %.0f B, delta %.1f B average\n", (double)fullBytes / (iterations + 1),
+             (double)deltaBytes / (iterations + 1));
+    }
+#endif
+  }
+  if (printMetrics) {
+#if KAPI_ENABLE_METRICS
+    printf("\n");
+    api.metrics.printPrometheus(Serial);
+#else
+    fprintf(stderr, "metrics not compiled in, use KAPI_FLAGS=-DKAPI_ENABLE_METRICS=1\n");
+#endif
+  }
+  return failed == 0 ? 0 : 1;
+}
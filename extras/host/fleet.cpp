@@ -0,0 +1,527 @@
+/*
+  fleet.cpp - Load test of many KlipperAPI displays against one Moonraker
+
+  Every client is a KlipperApi with its own PosixClient on its own thread,
+  all polling the same server the way a room full of displays would. The
+  mix of requests is weighted like a dashboard: mostly refresh(), some
+  statistics and server info, now and then a G-code or a pause/resume.
+  Client 0 starts a print first so the printer has something to report.
+
+    fleet [-c clients] [-d seconds] [-k] [--async] [--ws] [--worker]
+          [--interval ms] [--connect host:port] [simulator options]
+
+  Without --connect the simulator runs in process, on a free port, with
+  the simulator options applied. -k turns on keep-alive, --async uses the
+  begin*() requests with poll(), --ws also subscribes every client to
+  status pushes and --interval waits between requests instead of sending
+  them back to back. Reports p50/p99/max latency and the error rate per
+  request, and the total throughput.
+
+  --worker hands every api to a KlipperWorker instead, woken to refresh
+  every --interval ms (10 by default), while the client's thread reads
+  snapshots as fast as it can and posts a G-code job now and then. It
+  reports the read latency, retries and any torn snapshot, one whose
+  state string and state byte disagree.
+*/
+
+#include <KlipperAPI.h>
+#include <KlipperWorker.h>
+#include "MoonrakerSim.h"
+#include "PosixClient.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+// HostHeap.cpp is single threaded, so this build uses the system malloc
+uint32_t hostHeapFree() { return 0x40000000; }
+
+typedef struct {
+  const char* name;
+  unsigned weight;
+  bool (*run)(KlipperApi& api, uint32_t turn);
+#if KAPI_ENABLE_ASYNC
+  bool (*begin)(KlipperApi& api, uint32_t turn);   // nullptr: run() also in --async
+#endif
+} FleetOperation;
+
+#if KAPI_ENABLE_ASYNC
+static void fleetDone(KlipperApi& api, uint8_t request, bool success);
+#define FLEET_BEGIN(f) , f
+#else
+#define FLEET_BEGIN(f)
+#endif
+
+static const FleetOperation fleetOperations[] = {
+  { "refresh", 60, [](KlipperApi& api, uint32_t) { return api.refresh(); }
+    FLEET_BEGIN([](KlipperApi& api, uint32_t) { return api.beginRefresh(KAPI_REFRESH_ALL, fleetDone); }) },
+  { "getPrinterStatistics", 15, [](KlipperApi& api, uint32_t) { return api.getPrinterStatistics(); }
+    FLEET_BEGIN([](KlipperApi& api, uint32_t) { return api.beginGetPrinterStatistics(fleetDone); }) },
+#if KAPI_ENABLE_BATCH
+  { "refreshBatch", 10, [](KlipperApi& api, uint32_t) { return (api.refreshBatch() & KAPI_BATCH_STATUS) != 0; }
+    FLEET_BEGIN(nullptr) },
+#endif
+#if KAPI_ENABLE_SERVER_INFO
+  { "getServerInfo", 10, [](KlipperApi& api, uint32_t) { return api.getServerInfo(); }
+    FLEET_BEGIN([](KlipperApi& api, uint32_t) { return api.beginGetServerInfo(fleetDone); }) },
+#endif
+#if KAPI_ENABLE_CONTROL
+  { "sendGcode", 10, [](KlipperApi& api, uint32_t turn) { return api.sendGcode(turn & 1 ? "M106 S128" : "M106 S255"); }
+    FLEET_BEGIN([](KlipperApi& api, uint32_t turn) { return api.beginSendGcode(turn & 1 ? "M106 S128" : "M106 S255", fleetDone); }) },
+  { "pausePrint/resumePrint", 5, [](KlipperApi& api, uint32_t turn) { return turn & 1 ? api.resumePrint() : api.pausePrint(); }
+    FLEET_BEGIN(nullptr) },
+#endif
+};
+
+#define FLEET_OPERATIONS (sizeof(fleetOperations) / sizeof(fleetOperations[0]))
+
+typedef struct {
+  std::vector<uint32_t> latencyUs[FLEET_OPERATIONS];
+  uint32_t errors[FLEET_OPERATIONS];
+  uint32_t statusUpdates;
+  uint32_t rejected;                   // Failed fast by the open breaker
+  uint32_t connects;
+  uint64_t bytesSent;
+  uint64_t bytesReceived;
+  // --async
+  std::vector<uint32_t> pollUs;        // Time spent in each poll()
+  uint32_t bodyOverflows;
+  // --worker
+  std::vector<uint32_t> readNs;        // Every 64th read
+  uint64_t reads;
+  uint32_t readRetries;
+  uint32_t torn;
+  uint32_t generations;                // Changes the reader saw
+  uint32_t refreshes;
+  uint32_t publishes;
+  uint32_t jobs;
+} FleetWorker;
+
+typedef struct {
+  const char* host;                    // nullptr: 127.0.0.1
+  uint16_t port;
+  uint32_t clients;
+  unsigned seconds;
+  unsigned intervalMs;
+  bool keepAlive;
+  bool async;
+  bool websocket;
+  bool worker;
+} FleetOptions;
+
+#if KAPI_ENABLE_ASYNC
+// Result of the request in flight on this thread
+static thread_local bool asyncDone;
+static thread_local bool asyncOk;
+
+static void fleetDone(KlipperApi& api, uint8_t request, bool success) {
+  asyncDone = true;
+  asyncOk = success;
+}
+
+static bool runAsync(KlipperApi& api, const FleetOperation& operation, uint32_t turn,
+                     std::vector<uint32_t>& pollUs) {
+  asyncDone = false;
+  if (!operation.begin(api, turn)) {
+    return false;
+  }
+  while (!asyncDone) {
+    auto start = std::chrono::steady_clock::now();
+    api.poll();
+    pollUs.push_back((uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count());
+    if (!asyncDone) {
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+  }
+  return asyncOk;
+}
+#endif
+
+static void initApi(KlipperApi& api, Client& client, const FleetOptions& options) {
+  if (options.host != nullptr) {
+    api.init(client, options.host, options.port);
+  } else {
+    api.init(client, IPAddress(127, 0, 0, 1), options.port);
+  }
+}
+
+// The weighted request mix, back to back or --interval apart
+static void runRequests(KlipperApi& api, uint32_t index, const FleetOptions& options,
+                        std::chrono::steady_clock::time_point end, FleetWorker& worker) {
+  unsigned totalWeight = 0;
+  for (const FleetOperation& operation : fleetOperations) {
+    totalWeight += operation.weight;
+  }
+  std::mt19937 random(index + 1);
+  uint32_t turns[FLEET_OPERATIONS] = {};
+
+  while (std::chrono::steady_clock::now() < end) {
+    unsigned pick = random() % totalWeight;
+    size_t which = 0;
+    while (pick >= fleetOperations[which].weight) {
+      pick -= fleetOperations[which].weight;
+      which++;
+    }
+    const FleetOperation& operation = fleetOperations[which];
+
+#if KAPI_ENABLE_HEALTH
+    uint32_t rejectsBefore = api.health.rejectCount;
+#endif
+    auto start = std::chrono::steady_clock::now();
+    bool ok;
+#if KAPI_ENABLE_ASYNC
+    if (options.async && operation.begin != nullptr) {
+      ok = runAsync(api, operation, turns[which], worker.pollUs);
+    } else
+#endif
+    {
+      ok = operation.run(api, turns[which]);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    turns[which]++;
+
+    worker.latencyUs[which].push_back(
+      (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    if (!ok) {
+      worker.errors[which]++;
+    }
+#if KAPI_ENABLE_HEALTH
+    worker.rejected += api.health.rejectCount - rejectsBefore;
+#endif
+
+    // Keep the websocket drained while waiting for the next request
+    auto next = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.intervalMs);
+    do {
+#if KAPI_ENABLE_SUBSCRIPTION
+      if (options.websocket) {
+        api.handleSubscription();
+      }
+#endif
+      if (std::chrono::steady_clock::now() < next) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    } while (std::chrono::steady_clock::now() < next && std::chrono::steady_clock::now() < end);
+  }
+}
+
+#if KAPI_ENABLE_WORKER
+static void fanJob(KlipperApi& api, void* context) {
+  api.sendGcode(context != nullptr ? "M106 S255" : "M106 S128");
+}
+
+// Read snapshots while the worker refreshes them behind the reader's back
+static void readSnapshots(KlipperApi& api, const FleetOptions& options,
+                          std::chrono::steady_clock::time_point end, FleetWorker& worker) {
+  KlipperWorker background(api);
+  unsigned interval = options.intervalMs > 0 ? options.intervalMs : 10;
+  background.begin(interval);
+
+  KlipperSnapshot snapshot;
+  KlipperSnapshot latest;
+  uint32_t seen = 0;
+  auto nextWake = std::chrono::steady_clock::now();
+  auto nextJob = nextWake;
+  while (std::chrono::steady_clock::now() < end) {
+    for (int i = 0; i < 64; i++) {
+      auto start = std::chrono::steady_clock::now();
+      background.read(snapshot);
+      if (i == 0) {
+        worker.readNs.push_back((uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start).count());
+      }
+      if (KlipperApi::decodeState(snapshot.printerStats.state) != snapshot.printerStats.stateId) {
+        worker.torn++;
+      }
+    }
+    worker.reads += 64;
+    if (background.readIfChanged(latest, seen)) {
+      worker.generations++;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (now >= nextWake) {
+      background.wake();
+      nextWake = now + std::chrono::milliseconds(interval);
+    }
+    if (now >= nextJob && background.post(fanJob, worker.reads & 1 ? &worker : nullptr)) {
+      nextJob = now + std::chrono::milliseconds(250);
+    }
+  }
+
+  background.end();
+  worker.readRetries = background.readRetryCount();
+  worker.refreshes = background.refreshCount();
+  worker.publishes = background.publishCount();
+  worker.jobs = background.jobCount();
+}
+#endif
+
+static void runWorker(uint32_t index, const FleetOptions& options, std::atomic<bool>& go,
+                      std::chrono::steady_clock::time_point& end, FleetWorker& worker) {
+  PosixClient client;
+  KlipperApi api;
+  initApi(api, client, options);
+  api.setKeepAlive(options.keepAlive);
+  // Every call should reach the server
+  api.setCacheTtl(0);
+
+#if KAPI_ENABLE_SUBSCRIPTION
+  PosixClient wsClient;
+  if (options.websocket && !api.subscribeStatus(wsClient)) {
+    fprintf(stderr, "client %u: websocket subscription failed\n", index);
+  }
+#endif
+#if KAPI_ENABLE_CONTROL
+  if (index == 0) {
+    api.startPrint("fleet_benchy.gcode");
+  }
+#endif
+
+  while (!go) {
+    std::this_thread::yield();
+  }
+#if KAPI_ENABLE_WORKER
+  if (options.worker) {
+    readSnapshots(api, options, end, worker);
+  } else
+#endif
+  {
+    runRequests(api, index, options, end, worker);
+  }
+
+#if KAPI_ENABLE_SUBSCRIPTION
+  worker.statusUpdates = api.statusUpdateCount;
+  if (options.websocket) {
+    api.unsubscribeStatus();
+  }
+  worker.connects += wsClient.connects;
+  worker.bytesSent += wsClient.bytesSent;
+  worker.bytesReceived += wsClient.bytesReceived;
+#endif
+#if KAPI_ENABLE_ASYNC
+  worker.bodyOverflows = api.asyncOverflowCount;
+#endif
+  worker.connects += client.connects;
+  worker.bytesSent += client.bytesSent;
+  worker.bytesReceived += client.bytesReceived;
+}
+
+static double percentileMs(const std::vector<uint32_t>& sorted, double share) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t index = (size_t)(sorted.size() * share);
+  return sorted[index < sorted.size() ? index : sorted.size() - 1] / 1000.0;
+}
+
+static void usage(const char* name) {
+  fprintf(stderr, "usage: %s [-c clients] [-d seconds] [-k] [--async] [--ws] [--worker]\n"
+                  "       [--interval ms] [--connect host:port] [simulator options]\n", name);
+  MoonrakerSim::printUsage(stderr);
+}
+
+int main(int argc, char** argv) {
+  FleetOptions options = { nullptr, 0, 16, 10, 0, false, false, false, false };
+  MoonrakerSimOptions simOptions;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      options.clients = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+      options.seconds = (unsigned)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) {
+      options.intervalMs = (unsigned)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-k") == 0) {
+      options.keepAlive = true;
+    } else if (strcmp(argv[i], "--async") == 0) {
+      options.async = true;
+    } else if (strcmp(argv[i], "--ws") == 0) {
+      options.websocket = true;
+    } else if (strcmp(argv[i], "--worker") == 0) {
+      options.worker = true;
+    } else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+      static std::string host;
+      host = argv[++i];
+      size_t colon = host.rfind(':');
+      options.port = 7125;
+      if (colon != std::string::npos) {
+        options.port = (uint16_t)atoi(host.c_str() + colon + 1);
+        host.erase(colon);
+      }
+      options.host = host.c_str();
+    } else if (!MoonrakerSim::parseOption(argc, argv, i, simOptions)) {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (options.clients == 0) {
+    options.clients = 1;
+  }
+#if !KAPI_ENABLE_ASYNC
+  if (options.async) {
+    fprintf(stderr, "--async needs KAPI_ENABLE_ASYNC\n");
+    return 2;
+  }
+#endif
+#if !KAPI_ENABLE_SUBSCRIPTION
+  if (options.websocket) {
+    fprintf(stderr, "--ws needs KAPI_ENABLE_SUBSCRIPTION\n");
+    return 2;
+  }
+#endif
+#if !KAPI_ENABLE_WORKER
+  if (options.worker) {
+    fprintf(stderr, "--worker needs KAPI_ENABLE_WORKER\n");
+    return 2;
+  }
+#endif
+
+  MoonrakerSim sim(simOptions);
+  if (options.host == nullptr) {
+    if (!sim.start()) {
+      perror("fleet: cannot start the simulator");
+      return 1;
+    }
+    options.port = sim.port();
+  }
+
+  printf("KlipperAPI fleet: %u clients for %u s against %s:%u, keep-alive %s, %s%s",
+         options.clients, options.seconds, options.host != nullptr ? options.host : "127.0.0.1", options.port,
+         options.keepAlive ? "on" : "off", options.worker ? "worker" : options.async ? "async" : "blocking",
+         options.websocket ? ", websocket" : "");
+  if (options.intervalMs > 0) {
+    printf(", %u ms between requests", options.intervalMs);
+  }
+  printf("\n");
+  if (options.host == nullptr) {
+    printf("simulator: ");
+    MoonrakerSim::printOptions(stdout, simOptions);
+  }
+  printf("\n");
+
+  std::vector<FleetWorker> workers(options.clients);
+  for (FleetWorker& worker : workers) {
+    memset(worker.errors, 0, sizeof(worker.errors));
+    worker.statusUpdates = worker.rejected = worker.connects = 0;
+    worker.bytesSent = worker.bytesReceived = 0;
+    worker.bodyOverflows = 0;
+    worker.reads = 0;
+    worker.readRetries = worker.torn = worker.generations = 0;
+    worker.refreshes = worker.publishes = worker.jobs = 0;
+  }
+  std::vector<std::thread> threads;
+  std::atomic<bool> go{false};
+  std::chrono::steady_clock::time_point end;
+  for (uint32_t i = 0; i < options.clients; i++) {
+    threads.emplace_back(runWorker, i, std::cref(options), std::ref(go), std::ref(end), std::ref(workers[i]));
+  }
+
+  // Subscriptions and the print start happen before the clock starts
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  auto start = std::chrono::steady_clock::now();
+  end = start + std::chrono::seconds(options.seconds);
+  go = true;
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+#if KAPI_ENABLE_WORKER
+  if (options.worker) {
+    std::vector<uint32_t> readNs;
+    uint64_t reads = 0, retries = 0, torn = 0, generations = 0, refreshes = 0, publishes = 0, jobs = 0;
+    for (const FleetWorker& worker : workers) {
+      readNs.insert(readNs.end(), worker.readNs.begin(), worker.readNs.end());
+      reads += worker.reads;
+      retries += worker.readRetries;
+      torn += worker.torn;
+      generations += worker.generations;
+      refreshes += worker.refreshes;
+      publishes += worker.publishes;
+      jobs += worker.jobs;
+    }
+    std::sort(readNs.begin(), readNs.end());
+    printf("snapshot reads %llu (%.1f M/s), p50 %.0f ns, p99 %.0f ns, max %.0f ns\n", (unsigned long long)reads,
+           reads / elapsed / 1e6, percentileMs(readNs, 0.5) * 1000, percentileMs(readNs, 0.99) * 1000,
+           readNs.empty() ? 0.0 : (double)readNs.back());
+    printf("read retries %llu, torn snapshots %llu\n", (unsigned long long)retries, (unsigned long long)torn);
+    printf("refreshes %llu, publishes %llu, changes seen by readers %llu, jobs run %llu\n",
+           (unsigned long long)refreshes, (unsigned long long)publishes, (unsigned long long)generations,
+           (unsigned long long)jobs);
+    if (options.host == nullptr) {
+      sim.stop();
+      printf("server: connections %llu, requests %llu (%.1f/s)\n", (unsigned long long)sim.connections,
+             (unsigned long long)sim.requests, sim.requests / elapsed);
+    }
+    return torn == 0 ? 0 : 1;
+  }
+#endif
+
+  printf("%-24s %8s %7s %7s %9s %9s %9s\n", "request", "count", "errors", "err %", "p50 ms", "p99 ms", "max ms");
+  uint64_t total = 0;
+  uint64_t totalErrors = 0;
+  std::vector<uint32_t> all;
+  for (size_t op = 0; op < FLEET_OPERATIONS; op++) {
+    std::vector<uint32_t> times;
+    uint32_t errors = 0;
+    for (const FleetWorker& worker : workers) {
+      times.insert(times.end(), worker.latencyUs[op].begin(), worker.latencyUs[op].end());
+      errors += worker.errors[op];
+    }
+    std::sort(times.begin(), times.end());
+    all.insert(all.end(), times.begin(), times.end());
+    total += times.size();
+    totalErrors += errors;
+    printf("%-24s %8zu %7u %7.2f %9.2f %9.2f %9.2f\n", fleetOperations[op].name, times.size(), errors,
+           times.empty() ? 0.0 : errors * 100.0 / times.size(), percentileMs(times, 0.5), percentileMs(times, 0.99),
+           times.empty() ? 0.0 : times.back() / 1000.0);
+  }
+  std::sort(all.begin(), all.end());
+  printf("%-24s %8llu %7llu %7.2f %9.2f %9.2f %9.2f\n", "all", (unsigned long long)total,
+         (unsigned long long)totalErrors, total == 0 ? 0.0 : totalErrors * 100.0 / total,
+         percentileMs(all, 0.5), percentileMs(all, 0.99), all.empty() ? 0.0 : all.back() / 1000.0);
+
+  uint64_t statusUpdates = 0, rejected = 0, connects = 0, sent = 0, received = 0;
+  for (const FleetWorker& worker : workers) {
+    statusUpdates += worker.statusUpdates;
+    rejected += worker.rejected;
+    connects += worker.connects;
+    sent += worker.bytesSent;
+    received += worker.bytesReceived;
+  }
+  printf("\nthroughput %.1f req/s, %.1f req/s per client, %llu connects, tx %.1f KB/s, rx %.1f KB/s\n",
+         total / elapsed, total / elapsed / options.clients, (unsigned long long)connects,
+         sent / elapsed / 1024, received / elapsed / 1024);
+  if (rejected > 0) {
+    printf("failed fast by the open breaker: %llu\n", (unsigned long long)rejected);
+  }
+  if (options.async) {
+    std::vector<uint32_t> pollUs;
+    uint64_t overflows = 0;
+    for (const FleetWorker& worker : workers) {
+      pollUs.insert(pollUs.end(), worker.pollUs.begin(), worker.pollUs.end());
+      overflows += worker.bodyOverflows;
+    }
+    std::sort(pollUs.begin(), pollUs.end());
+    printf("poll() %zu calls, p50 %.3f ms, p99 %.3f ms, max %.3f ms, bodies over KAPI_ASYNC_BODY_SIZE %llu\n",
+           pollUs.size(), percentileMs(pollUs, 0.5), percentileMs(pollUs, 0.99),
+           pollUs.empty() ? 0.0 : pollUs.back() / 1000.0, (unsigned long long)overflows);
+  }
+  if (options.websocket) {
+    printf("status updates %llu, %.1f per client per s\n", (unsigned long long)statusUpdates,
+           statusUpdates / elapsed / options.clients);
+  }
+
+  if (options.host == nullptr) {
+    sim.stop();
+    printf("server: connections %llu, requests %llu, injected errors %llu, drops %llu, status pushes %llu\n",
+           (unsigned long long)sim.connections, (unsigned long long)sim.requests,
+           (unsigned long long)sim.errorsInjected, (unsigned long long)sim.drops,
+           (unsigned long long)sim.pushes);
+  }
+  return 0;
+}
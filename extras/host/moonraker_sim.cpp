@@ -0,0 +1,61 @@
+/*
+  moonraker_sim.cpp - Standalone Moonraker simulator
+
+  Serves one simulated printer until interrupted, for the examples on a
+  real board or for fleet --connect.
+
+    moonraker_sim [-p port] [--any] [simulator options]
+
+  -p sets the port, 7125 by default. --any listens on every interface
+  instead of 127.0.0.1 only.
+*/
+
+#include "MoonrakerSim.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char** argv) {
+  MoonrakerSimOptions options;
+  uint16_t port = 7125;
+  bool any = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      port = (uint16_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--any") == 0) {
+      any = true;
+    } else if (!MoonrakerSim::parseOption(argc, argv, i, options)) {
+      fprintf(stderr, "usage: %s [-p port] [--any] [simulator options]\n", argv[0]);
+      MoonrakerSim::printUsage(stderr);
+      return 2;
+    }
+  }
+
+  // Wait for Ctrl-C on this thread; the server threads never see it
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  MoonrakerSim sim(options);
+  if (!sim.start(port, any)) {
+    perror("moonraker_sim: cannot listen");
+    return 1;
+  }
+  printf("Moonraker simulator on %s:%u\n", any ? "0.0.0.0" : "127.0.0.1", sim.port());
+  MoonrakerSim::printOptions(stdout, options);
+  fflush(stdout);
+
+  int received;
+  sigwait(&signals, &received);
+  sim.stop();
+
+  printf("\nconnections %llu, requests %llu, injected errors %llu, drops %llu, status pushes %llu\n",
+         (unsigned long long)sim.connections, (unsigned long long)sim.requests,
+         (unsigned long long)sim.errorsInjected, (unsigned long long)sim.drops,
+         (unsigned long long)sim.pushes);
+  return 0;
+}
@@ -0,0 +1,94 @@
+#!/bin/bash
+#
+# Flash and RAM cost of each KlipperAPI feature switch.
+#
+# Builds extras/SizeReport once with every switch on and once with each
+# KAPI_ENABLE_* switch turned off, then prints what every switch saves.
+# Switches that default to 0 on the board (most of them on AVR) are
+# turned on for the baseline, otherwise they would report nothing saved.
+# KAPI_ENABLE_WORKER keeps its default; it only exists on the ESP32.
+# Needs arduino-cli with the board core, ArduinoJson 6 and Ethernet
+# installed, and this library in the sketchbook libraries folder.
+#
+# Usage: extras/size_report.sh [--markdown] [fqbn]   (default arduino:avr:mega)
+#
+# --markdown prints the table for the README. Extra flags for every build,
+# e.g. smaller buffers so all features fit an AVR board's RAM, go in
+# SIZE_FLAGS.
+
+MARKDOWN=0
+if [ "$1" = "--markdown" ]; then
+  MARKDOWN=1
+  shift
+fi
+FQBN="${1:-arduino:avr:mega}"
+SKETCH="$(cd "$(dirname "$0")" && pwd)/SizeReport"
+
+# "Sketch uses N bytes" and "Global variables use N bytes" from the output
+build() {
+  local output
+  output=$(arduino-cli compile --fqbn "$FQBN" --build-property "compiler.cpp.extra_flags=$SIZE_FLAGS $1" "$SKETCH" 2>&1)
+  if [ $? -ne 0 ]; then
+    echo "$output" >&2
+    return 1
+  fi
+  local flash ram
+  flash=$(echo "$output" | sed -n 's/^Sketch uses \([0-9]*\) bytes.*/\1/p')
+  ram=$(echo "$output" | sed -n 's/^Global variables use \([0-9]*\) bytes.*/\1/p')
+  echo "$flash ${ram:-0}"
+}
+
+# The queue needs the async and control code, so switching either of
+# those off also switches the queue off
+features="PRINT_JOB SERVER_INFO MOTION CONTROL STRING_API ASYNC GCODE_QUEUE SUBSCRIPTION SCHEDULER OBJECTS FILES UPLOAD HEALTH WORKER CODEC BATCH"
+
+# Every switch on, except the worker, which keeps the board's default
+all_on=""
+for feature in $features; do
+  [ "$feature" = "WORKER" ] || all_on="$all_on -DKAPI_ENABLE_$feature=1"
+done
+
+# Baseline with one switch replaced
+without() {
+  local flags
+  flags=$(echo "$all_on" | sed "s/-DKAPI_ENABLE_$1=1//")
+  flags="$flags -DKAPI_ENABLE_$1=0"
+  if [ "$1" = "CONTROL" ] || [ "$1" = "ASYNC" ]; then
+    flags=$(echo "$flags" | sed "s/-DKAPI_ENABLE_GCODE_QUEUE=1/-DKAPI_ENABLE_GCODE_QUEUE=0/")
+  fi
+  echo "$flags"
+}
+
+row() {
+  if [ $MARKDOWN -eq 1 ]; then
+    printf "| %s | %s | %s |\n" "$1" "$2" "$3"
+  else
+    printf "%-26s %10s %10s\n" "$1" "$2" "$3"
+  fi
+}
+
+read base_flash base_ram <<< "$(build "$all_on")" || exit 1
+if [ $MARKDOWN -eq 1 ]; then
+  echo "| \`$FQBN\` | Flash | RAM |"
+  echo "|---|---:|---:|"
+else
+  echo "KlipperAPI size report for $FQBN"
+  row "Configuration" "Flash" "RAM"
+fi
+row "all features" "$base_flash" "$base_ram"
+
+for feature in $features; do
+  read flash ram <<< "$(build "$(without $feature)")" || { echo "build without $feature failed" >&2; continue; }
+  row "KAPI_ENABLE_$feature=0" "-$((base_flash - flash))" "-$((base_ram - ram))"
+done
+
+# Opt-in features cost memory rather than save it
+read flash ram <<< "$(build "$all_on -DKAPI_ENABLE_METRICS=1")" || { echo "build with metrics failed" >&2; }
+row "KAPI_ENABLE_METRICS=1" "+$((flash - base_flash))" "+$((ram - base_ram))"
+
+all_off=""
+for feature in $features; do
+  all_off="$all_off -DKAPI_ENABLE_$feature=0"
+done
+read flash ram <<< "$(build "$all_off")" || exit 1
+row "all switches off" "$flash" "$ram"